@@ -0,0 +1,438 @@
+#include "lib/archiver/archiver.h"
+#include "lib/archiver/io/null_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Throughput baseline of the codec and of whole archive commands.
+//
+// Every result is the best of --repeat runs and is printed as one JSON
+// object per line inside "results", so a previous run can be given back as
+// --baseline and any result slower than (1 - tolerance) of it fails the run.
+
+const uint64_t kMegabyte = 1 << 20;
+const char* kUsage =
+    "hamarc_bench [--work-dir=DIR] [--output=FILE] [--repeat=N] [--filter=TEXT]\n"
+    "             [--codec-size=MB] [--small-files=N] [--small-size=KB] [--huge-files=N] [--huge-size=MB]\n"
+    "             [--threads=N] [--code=13/8|39/32|72/64] [--baseline=FILE] [--tolerance=R]\n";
+
+struct BenchOptions {
+    std::filesystem::path work_dir = std::filesystem::temp_directory_path() / "hamarc_bench";
+    std::filesystem::path output;
+    std::filesystem::path baseline;
+    size_t repeat = 3;
+    std::string filter;
+    uint64_t codec_size = 16 * kMegabyte;
+    size_t small_files = 500;
+    uint64_t small_size = 4 << 10;
+    size_t huge_files = 2;
+    uint64_t huge_size = 64 * kMegabyte;
+    size_t threads = 1;
+    CodeRate code_rate = CodeRate::kHamming13_8;
+    double tolerance = 0.2;
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t bytes;
+    uint64_t ops;
+    double seconds;
+};
+
+enum class CorpusData : uint8_t {
+    kRandom,
+    kZero,
+};
+
+struct Corpus {
+    std::string name;
+    size_t files;
+    uint64_t file_size;
+    CorpusData data;
+};
+
+BenchOptions ParseBenchOptions(int argc, char** argv);
+bool Selected(const BenchOptions& options, const std::string& name);
+double TimeBest(size_t repeat, const std::function<void()>& prepare, const std::function<void()>& run);
+void FlipBits(std::vector<char>& encoded, size_t codeword_bytes, uint8_t mask);
+void RunCodecBenchmarks(const BenchOptions& options, std::vector<BenchResult>& results);
+void MakeCorpus(const std::filesystem::path& root, const Corpus& corpus);
+void RunArchiveBenchmarks(const BenchOptions& options, const Corpus& corpus, std::vector<BenchResult>& results);
+void WriteJson(std::ostream& stream, const BenchOptions& options, const std::vector<BenchResult>& results);
+std::map<std::string, double> LoadBaseline(const std::filesystem::path& path);
+bool CheckBaseline(const BenchOptions& options, const std::vector<BenchResult>& results);
+
+BenchOptions ParseBenchOptions(int argc, char** argv) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equal_sign = arg.find('=');
+        std::string key = arg.substr(0, equal_sign);
+        std::string value = equal_sign == std::string::npos ? "" : arg.substr(equal_sign + 1);
+
+        if (key == "--help") {
+            std::cout << kUsage;
+
+            exit(0);
+        }
+
+        if (value.empty()) {
+            std::cerr << "Unknown argument " << arg << std::endl << kUsage;
+
+            exit(1);
+        }
+
+        if (key == "--work-dir") {
+            options.work_dir = value;
+        } else if (key == "--output") {
+            options.output = value;
+        } else if (key == "--baseline") {
+            options.baseline = value;
+        } else if (key == "--repeat") {
+            options.repeat = std::max<size_t>(std::stoul(value), 1);
+        } else if (key == "--filter") {
+            options.filter = value;
+        } else if (key == "--codec-size") {
+            options.codec_size = std::stoull(value) * kMegabyte;
+        } else if (key == "--small-files") {
+            options.small_files = std::stoul(value);
+        } else if (key == "--small-size") {
+            options.small_size = std::stoull(value) << 10;
+        } else if (key == "--huge-files") {
+            options.huge_files = std::stoul(value);
+        } else if (key == "--huge-size") {
+            options.huge_size = std::stoull(value) * kMegabyte;
+        } else if (key == "--threads") {
+            options.threads = std::stoul(value);
+        } else if (key == "--tolerance") {
+            options.tolerance = std::stod(value);
+        } else if (key == "--code") {
+            const CodeParameters* code = nullptr;
+            uint32_t rate = 0;
+
+            for (; (code = FindCodeParameters(rate)) != nullptr && value != code->name; ++rate) {}
+
+            if (code == nullptr) {
+                std::cerr << "Unknown code " << value << std::endl;
+
+                exit(1);
+            }
+
+            options.code_rate = static_cast<CodeRate>(rate);
+        } else {
+            std::cerr << "Unknown argument " << arg << std::endl << kUsage;
+
+            exit(1);
+        }
+    }
+
+    return options;
+}
+
+bool Selected(const BenchOptions& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+double TimeBest(size_t repeat, const std::function<void()>& prepare, const std::function<void()>& run) {
+    double best = 0;
+
+    for (size_t i = 0; i < repeat; ++i) {
+        prepare();
+
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+
+    return best;
+}
+
+void FlipBits(std::vector<char>& encoded, size_t codeword_bytes, uint8_t mask) {
+    // Bits 0 and 1 of the first byte belong to the codeword in every code.
+    for (size_t i = 0; i < encoded.size(); i += codeword_bytes) {
+        encoded[i] ^= mask;
+    }
+}
+
+void RunCodecBenchmarks(const BenchOptions& options, std::vector<BenchResult>& results) {
+    std::vector<char> data(options.codec_size);
+    std::vector<char> decoded(options.codec_size);
+    std::mt19937_64 generator(42);
+    NullBuffer null_buffer;
+    std::ostream null_stream(&null_buffer);
+
+    for (char& byte: data) {
+        byte = static_cast<char>(generator());
+    }
+
+    for (uint32_t rate = 0; FindCodeParameters(rate) != nullptr; ++rate) {
+        const CodeParameters& code = *FindCodeParameters(rate);
+        std::string prefix = std::string("codec/") + code.name + "/";
+        Manipulator manipulator(static_cast<CodeRate>(rate));
+
+        if (Selected(options, prefix + "load")) {
+            double seconds = TimeBest(options.repeat, [] {}, [&] {
+                manipulator.LoadData(null_stream, data.data(), data.size());
+            });
+
+            results.push_back({prefix + "load", data.size(), 1, seconds});
+        }
+
+        std::vector<char> clean(manipulator.EncodedSize(data.size()));
+
+        manipulator.EncodeBlock(data.data(), data.size(), clean.data());
+
+        // 0 - clean, 1 - one flipped bit in every codeword (all corrected),
+        // 2 - two flipped bits in every codeword (all detected, none corrected).
+        for (uint8_t errors = 0; errors <= 2; ++errors) {
+            std::string name = prefix + "unload/" + std::to_string(errors) + "bit";
+
+            if (!Selected(options, name)) {
+                continue;
+            }
+
+            std::vector<char> encoded = clean;
+            std::filesystem::path encoded_path = options.work_dir / "codec.bin";
+
+            FlipBits(encoded, code.codeword_bytes, (1 << errors) - 1);
+            std::ofstream(encoded_path, std::ios::binary).write(encoded.data(), encoded.size());
+
+            std::ifstream stream;
+
+            double seconds = TimeBest(options.repeat, [&] {
+                stream = std::ifstream(encoded_path, std::ios::binary);
+            }, [&] {
+                manipulator.UnloadData(stream, decoded.data(), decoded.size(), true);
+            });
+
+            if (errors < 2 && decoded != data) {
+                std::cerr << name << ": decoded data differs from the source." << std::endl;
+
+                exit(1);
+            }
+
+            results.push_back({name, data.size(), 1, seconds});
+        }
+    }
+}
+
+void MakeCorpus(const std::filesystem::path& root, const Corpus& corpus) {
+    std::mt19937_64 generator(corpus.files * 31 + corpus.file_size);
+    std::vector<char> buffer(std::min(corpus.file_size, kMegabyte));
+
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+
+    for (size_t i = 0; i < corpus.files; ++i) {
+        std::ofstream stream(root / ("file" + std::to_string(i) + ".bin"), std::ios::binary);
+
+        for (uint64_t left = corpus.file_size; left > 0;) {
+            size_t block = std::min<uint64_t>(left, buffer.size());
+
+            if (corpus.data == CorpusData::kRandom) {
+                for (size_t j = 0; j < block; ++j) {
+                    buffer[j] = static_cast<char>(generator());
+                }
+            }
+
+            stream.write(buffer.data(), block);
+            left -= block;
+        }
+    }
+}
+
+void RunArchiveBenchmarks(const BenchOptions& options, const Corpus& corpus, std::vector<BenchResult>& results) {
+    std::string prefix = "archive/" + corpus.name + "/";
+    std::filesystem::path root = options.work_dir / corpus.name;
+    std::filesystem::path archive_path = options.work_dir / (corpus.name + ".haf");
+    std::filesystem::path merged_path = options.work_dir / (corpus.name + "-merged.haf");
+    std::filesystem::path extract_dir = options.work_dir / (corpus.name + "-extract");
+    std::filesystem::path current_dir = std::filesystem::current_path();
+    uint64_t bytes = corpus.files * corpus.file_size;
+    ArchiverOptions archiver_options;
+
+    archiver_options.threads = options.threads;
+    archiver_options.code_rate = options.code_rate;
+
+    MakeCorpus(root, corpus);
+
+    std::vector<std::filesystem::path> inputs = {root};
+    std::unordered_set<std::string> deleted;
+
+    for (size_t i = 0; i < corpus.files; i += 2) {
+        deleted.insert(corpus.name + "/file" + std::to_string(i) + ".bin");
+    }
+
+    auto create = [&] {
+        std::filesystem::remove(archive_path);
+        Archiver(archive_path, archiver_options).Create(inputs);
+    };
+    auto measure = [&](const std::string& operation, uint64_t operation_bytes, uint64_t operations,
+                       const std::function<void()>& prepare, const std::function<void()>& run) {
+        if (Selected(options, prefix + operation)) {
+            results.push_back({prefix + operation, operation_bytes, operations, TimeBest(options.repeat, prepare, run)});
+        }
+    };
+    auto enter_extract_dir = [&] {
+        std::filesystem::current_path(current_dir);
+        std::filesystem::remove_all(extract_dir);
+        std::filesystem::create_directories(extract_dir);
+        std::filesystem::current_path(extract_dir);
+    };
+
+    // Every other command needs the archive, so it is made even when "create" is filtered out.
+    create();
+
+    measure("create", bytes, corpus.files, [] {}, create);
+    measure("list", 0, corpus.files, [] {}, [&] {
+        Archiver(archive_path, archiver_options).List();
+    });
+    measure("extract", bytes, corpus.files, enter_extract_dir, [&] {
+        Archiver(archive_path, archiver_options).Extract();
+    });
+    std::filesystem::current_path(current_dir);
+    std::filesystem::remove_all(extract_dir);
+    measure("merge", 2 * bytes, 2 * corpus.files, [&] {
+        std::filesystem::remove(merged_path);
+    }, [&] {
+        Archiver(merged_path, archiver_options).Merge({archive_path, archive_path});
+    });
+    measure("delete", 0, deleted.size(), create, [&] {
+        Archiver(archive_path, archiver_options).Delete(deleted);
+    });
+
+    std::filesystem::remove_all(root);
+    std::filesystem::remove(archive_path);
+    std::filesystem::remove(merged_path);
+}
+
+void WriteJson(std::ostream& stream, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    stream << "{" << std::endl;
+    stream << "  \"kernel\": \"" << GetCodecKernels().name << "\"," << std::endl;
+    stream << "  \"code\": \"" << GetCodeParameters(options.code_rate).name << "\"," << std::endl;
+    stream << "  \"threads\": " << options.threads << "," << std::endl;
+    stream << "  \"repeat\": " << options.repeat << "," << std::endl;
+    stream << "  \"results\": [" << std::endl;
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        double seconds = std::max(result.seconds, 1e-9);
+
+        stream << "    {\"name\": \"" << result.name << "\", \"seconds\": " << result.seconds;
+        stream << ", \"bytes\": " << result.bytes << ", \"ops\": " << result.ops;
+        stream << ", \"bytes_per_second\": " << static_cast<uint64_t>(result.bytes / seconds);
+        stream << ", \"ops_per_second\": " << result.ops / seconds << "}";
+        stream << (i + 1 == results.size() ? "" : ",") << std::endl;
+    }
+
+    stream << "  ]" << std::endl;
+    stream << "}" << std::endl;
+}
+
+std::map<std::string, double> LoadBaseline(const std::filesystem::path& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream stream(path);
+
+    if (!stream.is_open()) {
+        std::cerr << "Cannot open baseline " << path << std::endl;
+
+        exit(1);
+    }
+
+    // Only reads back what WriteJson() writes: one result per line.
+    for (std::string line; std::getline(stream, line);) {
+        size_t name = line.find("\"name\": \"");
+        size_t rate = line.find("\"ops_per_second\": ");
+
+        if (name == std::string::npos || rate == std::string::npos) {
+            continue;
+        }
+
+        name += strlen("\"name\": \"");
+        rate += strlen("\"ops_per_second\": ");
+        baseline[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(rate));
+    }
+
+    return baseline;
+}
+
+bool CheckBaseline(const BenchOptions& options, const std::vector<BenchResult>& results) {
+    std::map<std::string, double> baseline = LoadBaseline(options.baseline);
+    bool passed = true;
+
+    // ops/s is compared since every result has operations, not all have bytes.
+    for (const BenchResult& result: results) {
+        auto expected = baseline.find(result.name);
+
+        if (expected == baseline.end()) {
+            continue;
+        }
+
+        double actual = result.ops / std::max(result.seconds, 1e-9);
+
+        if (actual < expected->second * (1 - options.tolerance)) {
+            std::cerr << "Regression in " << result.name << ": " << actual << " ops/s, baseline " << expected->second << std::endl;
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options = ParseBenchOptions(argc, argv);
+    std::vector<BenchResult> results;
+    const Corpus corpora[] = {
+        {"small-random", options.small_files, options.small_size, CorpusData::kRandom},
+        {"small-zero", options.small_files, options.small_size, CorpusData::kZero},
+        {"huge-random", options.huge_files, options.huge_size, CorpusData::kRandom},
+        {"huge-zero", options.huge_files, options.huge_size, CorpusData::kZero},
+    };
+
+    options.work_dir = std::filesystem::absolute(options.work_dir);
+    std::filesystem::create_directories(options.work_dir);
+
+    RunCodecBenchmarks(options, results);
+    std::filesystem::remove(options.work_dir / "codec.bin");
+
+    for (const Corpus& corpus: corpora) {
+        const char* operations[] = {"create", "list", "extract", "merge", "delete"};
+        bool selected = false;
+
+        for (const char* operation: operations) {
+            selected |= Selected(options, "archive/" + corpus.name + "/" + operation);
+        }
+
+        if (selected) {
+            RunArchiveBenchmarks(options, corpus, results);
+        }
+    }
+
+    if (options.output.empty()) {
+        WriteJson(std::cout, options, results);
+    } else {
+        std::ofstream stream(options.output);
+
+        WriteJson(stream, options, results);
+    }
+
+    if (!options.baseline.empty() && !CheckBaseline(options, results)) {
+        return 1;
+    }
+
+    return 0;
+}
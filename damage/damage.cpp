@@ -0,0 +1,619 @@
+#include "lib/archiver/archiver.h"
+#include "lib/archiver/io/null_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Reproducible damage for archives: the same seed and the same profile
+// always hit the same bits.
+//
+// A profile is a comma-separated list of actions KIND:ARGUMENT[@REGION]:
+//     bits:RATE               - flips every bit of the region with probability RATE
+//     flip:OFFSET[.BIT]       - flips one bit (bit 0 by default)
+//     burst:COUNTxLENGTH      - COUNT runs of LENGTH garbage bytes
+//     zero:COUNTxLENGTH       - COUNT runs of LENGTH zero bytes
+//     truncate:BYTES          - cuts BYTES off the end of the archive
+// REGION is all (default), headers (everything that is not member data),
+// payload (member data) or OFFSET+LENGTH.
+//
+// With --harness every profile is applied to a copy of the archive, the
+// copy is extracted and scrubbed in a child process, and the run reports
+// their throughput and how many members came out intact.
+
+const uint64_t kCompareBlockSize = 1 << 20;
+const char* kDefaultProfiles[] = {
+    "none",
+    "bits:1e-7",
+    "bits:1e-5",
+    "bits:1e-3@payload",
+    "bits:1e-4@headers",
+    "burst:8x16",
+    "burst:8x4096",
+    "zero:1x65536@payload",
+    "truncate:4096",
+};
+const char* kUsage =
+    "hamarc-damage --file=ARCHIVE --damage=PROFILE [--seed=N]\n"
+    "hamarc-damage --harness --file=ARCHIVE [--damage=PROFILE]... [--seed=N] [--trials=N] [--threads=N] [--work-dir=DIR]\n";
+
+struct Range {
+    uint64_t offset;
+    uint64_t length;
+};
+
+enum class DamageKind : uint8_t {
+    kNone,
+    kBits,
+    kFlip,
+    kBurst,
+    kZero,
+    kTruncate,
+};
+
+struct DamageAction {
+    std::string spec;
+    DamageKind kind = DamageKind::kNone;
+    double rate = 0;
+    uint64_t count = 0;
+    uint64_t length = 0;
+    uint64_t offset = 0;
+    uint8_t bit = 0;
+    std::string region = "all";
+};
+
+struct DamageProfile {
+    std::string spec;
+    std::vector<DamageAction> actions;
+};
+
+struct DamageOptions {
+    std::filesystem::path archive;
+    std::vector<DamageProfile> profiles;
+    uint64_t seed = 1;
+    bool harness = false;
+    size_t trials = 1;
+    size_t threads = 1;
+    std::filesystem::path work_dir = std::filesystem::temp_directory_path() / "hamarc_damage";
+};
+
+// Layout of an archive before it is damaged.
+struct ArchiveLayout {
+    uint64_t size = 0;
+    bool has_directory = false;
+    std::vector<Range> headers;
+    std::vector<Range> payload;
+};
+
+struct ChildResult {
+    int status = -1;
+    double seconds = 0;
+    OperationStats stats;
+};
+
+DamageOptions ParseDamageOptions(int argc, char** argv);
+DamageProfile ParseProfile(const std::string& spec);
+DamageAction ParseAction(const std::string& spec);
+ArchiveLayout ReadLayout(const std::filesystem::path& path);
+std::vector<Range> SelectRegion(const DamageAction& action, const ArchiveLayout& layout);
+uint64_t PickOffset(const std::vector<Range>& ranges, uint64_t total, std::mt19937_64& generator);
+uint64_t ApplyAction(PositionalFile& archive, const DamageAction& action, const ArchiveLayout& layout, std::mt19937_64& generator);
+void ApplyProfile(const std::filesystem::path& path, const DamageProfile& profile, const ArchiveLayout& layout, uint64_t seed, bool verbose);
+ChildResult RunChild(const std::function<int()>& body);
+bool SameContents(const std::filesystem::path& first, const std::filesystem::path& second);
+void RunHarness(const DamageOptions& options);
+
+DamageOptions ParseDamageOptions(int argc, char** argv) {
+    DamageOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equal_sign = arg.find('=');
+        std::string key = arg.substr(0, equal_sign);
+        std::string value = equal_sign == std::string::npos ? "" : arg.substr(equal_sign + 1);
+
+        if (key == "--help") {
+            std::cout << kUsage;
+
+            exit(0);
+        }
+
+        if (key == "--harness") {
+            options.harness = true;
+
+            continue;
+        }
+
+        if (value.empty()) {
+            std::cerr << "Unknown argument " << arg << std::endl << kUsage;
+
+            exit(1);
+        }
+
+        if (key == "--file") {
+            options.archive = value;
+        } else if (key == "--damage") {
+            options.profiles.push_back(ParseProfile(value));
+        } else if (key == "--seed") {
+            options.seed = std::stoull(value);
+        } else if (key == "--trials") {
+            options.trials = std::max<size_t>(std::stoul(value), 1);
+        } else if (key == "--threads") {
+            options.threads = std::stoul(value);
+        } else if (key == "--work-dir") {
+            options.work_dir = value;
+        } else {
+            std::cerr << "Unknown argument " << arg << std::endl << kUsage;
+
+            exit(1);
+        }
+    }
+
+    if (options.archive.empty() || (!options.harness && options.profiles.empty())) {
+        std::cerr << kUsage;
+
+        exit(1);
+    }
+
+    if (options.harness && options.profiles.empty()) {
+        for (const char* spec: kDefaultProfiles) {
+            options.profiles.push_back(ParseProfile(spec));
+        }
+    }
+
+    return options;
+}
+
+DamageProfile ParseProfile(const std::string& spec) {
+    DamageProfile profile{spec, {}};
+    std::stringstream stream(spec);
+
+    for (std::string action; std::getline(stream, action, ',');) {
+        if (action != "none") {
+            profile.actions.push_back(ParseAction(action));
+        }
+    }
+
+    return profile;
+}
+
+DamageAction ParseAction(const std::string& spec) {
+    DamageAction action;
+
+    action.spec = spec;
+
+    size_t colon = spec.find(':');
+    size_t at = spec.find('@');
+    std::string kind = spec.substr(0, colon);
+    std::string argument = colon == std::string::npos ? "" : spec.substr(colon + 1, at == std::string::npos ? std::string::npos : at - colon - 1);
+
+    if (at != std::string::npos) {
+        action.region = spec.substr(at + 1);
+    }
+
+    try {
+        if (kind == "bits") {
+            action.kind = DamageKind::kBits;
+            action.rate = std::stod(argument);
+        } else if (kind == "flip") {
+            size_t dot = argument.find('.');
+
+            action.kind = DamageKind::kFlip;
+            action.offset = std::stoull(argument.substr(0, dot));
+            action.bit = dot == std::string::npos ? 0 : std::stoul(argument.substr(dot + 1)) % 8;
+        } else if (kind == "burst" || kind == "zero") {
+            size_t times = argument.find('x');
+
+            action.kind = kind == "burst" ? DamageKind::kBurst : DamageKind::kZero;
+            action.count = std::stoull(argument.substr(0, times));
+            action.length = times == std::string::npos ? 1 : std::stoull(argument.substr(times + 1));
+        } else if (kind == "truncate") {
+            action.kind = DamageKind::kTruncate;
+            action.length = std::stoull(argument);
+        }
+    } catch (const std::logic_error&) {
+        action.kind = DamageKind::kNone;
+    }
+
+    if (action.kind == DamageKind::kNone) {
+        std::cerr << "Incorrect damage " << spec << std::endl;
+
+        exit(1);
+    }
+
+    return action;
+}
+
+ArchiveLayout ReadLayout(const std::filesystem::path& path) {
+    ArchiveLayout layout;
+    Manipulator manipulator;
+    ArchiveFormat format;
+
+    layout.size = std::filesystem::file_size(path);
+
+    if (!ReadArchiveFormat(path, manipulator, format)) {
+        return layout;
+    }
+
+    ArchiveDirectory directory(format);
+
+    layout.has_directory = directory.Load(path, manipulator);
+
+    if (!layout.has_directory) {
+        return layout;
+    }
+
+    std::vector<ArchiveMember> members = directory.Members();
+    uint64_t offset = 0;
+
+    std::sort(members.begin(), members.end(), [](const ArchiveMember& first, const ArchiveMember& second) {
+        return first.data_offset < second.data_offset;
+    });
+
+    for (const ArchiveMember& member: members) {
+        uint64_t length = EncodedSize(format.code_rate, StoredSize(member.header));
+
+        layout.headers.push_back({offset, member.data_offset - offset});
+        layout.payload.push_back({member.data_offset, length});
+        offset = member.data_offset + length;
+    }
+
+    layout.headers.push_back({offset, layout.size - offset});
+
+    return layout;
+}
+
+std::vector<Range> SelectRegion(const DamageAction& action, const ArchiveLayout& layout) {
+    if (action.region == "all") {
+        return {{0, layout.size}};
+    }
+
+    if (action.region == "headers" || action.region == "payload") {
+        if (!layout.has_directory) {
+            std::cerr << "The archive has no readable directory, " << action.region << " cannot be told apart." << std::endl;
+
+            exit(1);
+        }
+
+        return action.region == "headers" ? layout.headers : layout.payload;
+    }
+
+    size_t plus = action.region.find('+');
+
+    if (plus == std::string::npos) {
+        std::cerr << "Unknown region " << action.region << std::endl;
+
+        exit(1);
+    }
+
+    uint64_t offset = std::min<uint64_t>(std::stoull(action.region.substr(0, plus)), layout.size);
+    uint64_t length = std::stoull(action.region.substr(plus + 1));
+
+    return {{offset, std::min(length, layout.size - offset)}};
+}
+
+uint64_t PickOffset(const std::vector<Range>& ranges, uint64_t total, std::mt19937_64& generator) {
+    uint64_t position = std::uniform_int_distribution<uint64_t>(0, total - 1)(generator);
+
+    for (const Range& range: ranges) {
+        if (position < range.length) {
+            return range.offset + position;
+        }
+
+        position -= range.length;
+    }
+
+    return ranges.back().offset + ranges.back().length - 1;
+}
+
+// Returns the number of damaged bits, bytes or, for truncation, removed bytes.
+uint64_t ApplyAction(PositionalFile& archive, const DamageAction& action, const ArchiveLayout& layout, std::mt19937_64& generator) {
+    uint64_t size = archive.Size();
+
+    if (action.kind == DamageKind::kTruncate) {
+        uint64_t length = std::min(action.length, size);
+
+        archive.Resize(size - length);
+
+        return length;
+    }
+
+    if (action.kind == DamageKind::kFlip) {
+        char byte = 0;
+
+        if (action.offset >= size || archive.ReadAt(&byte, 1, action.offset) != 1) {
+            return 0;
+        }
+
+        byte ^= 1 << action.bit;
+        archive.WriteAt(&byte, 1, action.offset);
+
+        return 1;
+    }
+
+    std::vector<Range> ranges = SelectRegion(action, layout);
+    uint64_t total = 0;
+
+    for (const Range& range: ranges) {
+        total += range.length;
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    if (action.kind == DamageKind::kBits) {
+        uint64_t flips = std::binomial_distribution<uint64_t>(total * 8, action.rate)(generator);
+
+        for (uint64_t i = 0; i < flips; ++i) {
+            uint64_t offset = PickOffset(ranges, total, generator);
+            char byte = 0;
+
+            archive.ReadAt(&byte, 1, offset);
+            byte ^= 1 << std::uniform_int_distribution<int>(0, 7)(generator);
+            archive.WriteAt(&byte, 1, offset);
+        }
+
+        return flips;
+    }
+
+    uint64_t damaged = 0;
+
+    for (uint64_t i = 0; i < action.count; ++i) {
+        uint64_t offset = PickOffset(ranges, total, generator);
+        std::vector<char> bytes(std::min(action.length, size - offset));
+
+        if (action.kind == DamageKind::kBurst) {
+            archive.ReadAt(bytes.data(), bytes.size(), offset);
+
+            // Every byte of a burst changes.
+            for (char& byte: bytes) {
+                byte ^= std::uniform_int_distribution<int>(1, 255)(generator);
+            }
+        }
+
+        archive.WriteAt(bytes.data(), bytes.size(), offset);
+        damaged += bytes.size();
+    }
+
+    return damaged;
+}
+
+void ApplyProfile(const std::filesystem::path& path, const DamageProfile& profile, const ArchiveLayout& layout, uint64_t seed, bool verbose) {
+    PositionalFile archive(path, O_RDWR);
+    std::mt19937_64 generator(seed);
+
+    if (!archive.IsOpen()) {
+        std::cerr << "Cannot open " << path << std::endl;
+
+        exit(1);
+    }
+
+    for (const DamageAction& action: profile.actions) {
+        uint64_t damaged = ApplyAction(archive, action, layout, generator);
+
+        if (!verbose) {
+            continue;
+        }
+
+        std::cout << action.spec << ": " << damaged;
+
+        if (action.kind == DamageKind::kBits || action.kind == DamageKind::kFlip) {
+            std::cout << " bits flipped" << std::endl;
+        } else if (action.kind == DamageKind::kTruncate) {
+            std::cout << " bytes cut" << std::endl;
+        } else {
+            std::cout << " bytes damaged" << std::endl;
+        }
+    }
+}
+
+ChildResult RunChild(const std::function<int()>& body) {
+    ChildResult result;
+    int channel[2];
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    if (pipe(channel) != 0) {
+        std::cerr << "Cannot create a pipe." << std::endl;
+
+        exit(1);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t child = fork();
+
+    if (child == 0) {
+        close(channel[0]);
+        ResetStats();
+
+        int status = body();
+        OperationStats stats = CollectStats();
+
+        std::cout.flush();
+        write(channel[1], &stats, sizeof(stats));
+        _exit(status);
+    }
+
+    close(channel[1]);
+
+    // A child that died on the way sends nothing, its counters stay zero.
+    if (read(channel[0], &result.stats, sizeof(result.stats)) != sizeof(result.stats)) {
+        result.stats = OperationStats();
+    }
+
+    close(channel[0]);
+
+    int status = 0;
+
+    waitpid(child, &status, 0);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    result.seconds = elapsed.count();
+    result.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    return result;
+}
+
+bool SameContents(const std::filesystem::path& first, const std::filesystem::path& second) {
+    std::error_code error;
+
+    if (!std::filesystem::is_regular_file(second, error) || std::filesystem::file_size(first) != std::filesystem::file_size(second)) {
+        return false;
+    }
+
+    std::ifstream first_stream(first, std::ios::binary);
+    std::ifstream second_stream(second, std::ios::binary);
+    std::vector<char> first_block(kCompareBlockSize);
+    std::vector<char> second_block(kCompareBlockSize);
+
+    while (first_stream) {
+        first_stream.read(first_block.data(), first_block.size());
+        second_stream.read(second_block.data(), second_block.size());
+
+        if (first_stream.gcount() != second_stream.gcount() ||
+            !std::equal(first_block.begin(), first_block.begin() + first_stream.gcount(), second_block.begin())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RunHarness(const DamageOptions& options) {
+    std::filesystem::path work_dir = std::filesystem::absolute(options.work_dir);
+    std::filesystem::path archive = std::filesystem::absolute(options.archive);
+    std::filesystem::path reference_dir = work_dir / "reference";
+    std::filesystem::path output_dir = work_dir / "extracted";
+    std::filesystem::path trial_path = work_dir / "trial.haf";
+    ArchiveLayout layout = ReadLayout(archive);
+    ArchiverOptions archiver_options;
+    // Children print through it until they exit.
+    NullBuffer null_buffer;
+
+    archiver_options.threads = options.threads;
+    // Whatever could not be restored is extracted and compared as it is.
+    archiver_options.on_damage = [](const std::string&) { return true; };
+
+    // Extracted files are compared with what the undamaged archive gives.
+    auto extract = [&](const std::filesystem::path& path, const std::filesystem::path& target_dir) {
+        std::filesystem::remove_all(target_dir);
+        std::filesystem::create_directories(target_dir);
+
+        return RunChild([&] {
+            std::filesystem::current_path(target_dir);
+            std::cout.rdbuf(&null_buffer);
+            std::cerr.rdbuf(&null_buffer);
+
+            try {
+                Archiver(path, archiver_options).Extract();
+            } catch (const ArchiveError&) {
+                return 1;
+            }
+
+            return 0;
+        });
+    };
+
+    std::filesystem::create_directories(work_dir);
+
+    if (extract(archive, reference_dir).status != 0) {
+        std::cerr << "Cannot extract " << archive << " as it is." << std::endl;
+
+        exit(1);
+    }
+
+    std::vector<std::filesystem::path> members;
+    uint64_t reference_bytes = 0;
+
+    for (const std::filesystem::directory_entry& entry: std::filesystem::recursive_directory_iterator(reference_dir)) {
+        if (entry.is_regular_file()) {
+            members.push_back(entry.path().lexically_relative(reference_dir));
+            reference_bytes += entry.file_size();
+        }
+    }
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"archive\": " << archive << "," << std::endl;
+    std::cout << "  \"archive_bytes\": " << layout.size << ", \"members\": " << members.size();
+    std::cout << ", \"member_bytes\": " << reference_bytes << ", \"seed\": " << options.seed << "," << std::endl;
+    std::cout << "  \"results\": [" << std::endl;
+
+    for (size_t i = 0; i < options.profiles.size(); ++i) {
+        const DamageProfile& profile = options.profiles[i];
+
+        for (size_t trial = 0; trial < options.trials; ++trial) {
+            std::filesystem::copy_file(archive, trial_path, std::filesystem::copy_options::overwrite_existing);
+            ApplyProfile(trial_path, profile, layout, options.seed + trial, false);
+
+            ChildResult extracted = extract(trial_path, output_dir);
+            ChildResult scrubbed = RunChild([&] {
+                std::cout.rdbuf(&null_buffer);
+                std::cerr.rdbuf(&null_buffer);
+
+                try {
+                    return Archiver(trial_path, archiver_options).Scrub().uncorrectable == 0 ? 0 : 1;
+                } catch (const ArchiveError&) {
+                    return 1;
+                }
+            });
+            size_t recovered = 0;
+
+            for (const std::filesystem::path& member: members) {
+                recovered += SameContents(reference_dir / member, output_dir / member);
+            }
+
+            std::cout << "    {\"profile\": \"" << profile.spec << "\", \"trial\": " << trial;
+            std::cout << ", \"extract_status\": " << extracted.status << ", \"extract_seconds\": " << extracted.seconds;
+            std::cout << ", \"extract_bytes_per_second\": " << static_cast<uint64_t>(reference_bytes / std::max(extracted.seconds, 1e-9));
+            std::cout << ", \"members_recovered\": " << recovered;
+            std::cout << ", \"recovery_rate\": " << (members.empty() ? 1.0 : static_cast<double>(recovered) / members.size());
+            std::cout << ", \"codewords_corrected\": " << extracted.stats.codewords_corrected;
+            std::cout << ", \"codewords_uncorrectable\": " << extracted.stats.codewords_damaged;
+            std::cout << ", \"scrub_status\": " << scrubbed.status << ", \"scrub_seconds\": " << scrubbed.seconds;
+            std::cout << ", \"scrub_bytes_per_second\": " << static_cast<uint64_t>(layout.size / std::max(scrubbed.seconds, 1e-9)) << "}";
+            std::cout << (i + 1 == options.profiles.size() && trial + 1 == options.trials ? "" : ",") << std::endl;
+        }
+    }
+
+    std::cout << "  ]" << std::endl;
+    std::cout << "}" << std::endl;
+
+    std::filesystem::remove_all(work_dir);
+}
+
+int main(int argc, char** argv) {
+    DamageOptions options = ParseDamageOptions(argc, argv);
+
+    if (!std::filesystem::is_regular_file(options.archive)) {
+        std::cerr << "There is no such archive as " << options.archive << std::endl;
+
+        return 1;
+    }
+
+    if (options.harness) {
+        RunHarness(options);
+
+        return 0;
+    }
+
+    ArchiveLayout layout = ReadLayout(options.archive);
+
+    for (const DamageProfile& profile: options.profiles) {
+        ApplyProfile(options.archive, profile, layout, options.seed, true);
+    }
+
+    return 0;
+}
@@ -1,19 +1,116 @@
 #include "archiver.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <deque>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
-
-const uint64_t kFileSizeLimit = 1'073'741'824; // 1 GB
-const uint8_t kHammingByte = 2;
-
+#include <mutex>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+const size_t kBufferSize = kChecksumChunkSize; // 1 MiB, source bytes per chunk, one checksum each
+const size_t kMappedWindowSize = 1 << 22; // 4 MiB, source bytes per mapped window
+const size_t kScrubTaskSize = 1 << 22; // 4 MiB, encoded bytes checked by one scrub task
+const size_t kScrubProbeCodewords = 512; // codewords of a faulty scrub task checked together for the faulty ones
+const size_t kReadAheadFiles = 16; // files opened and prefetched ahead of the one being read
+const size_t kAsyncDepth = 4; // pieces of one async extraction lane read, decoded or written at once
+const char kStandardStream[] = "-"; // stdin for files, stdout for archives
+const int64_t kNanosecondsPerSecond = 1000000000;
+
+bool IsStandardStream(const std::filesystem::path& path);
 void NormalizeArchivePath(std::filesystem::path& archive_path);
+// The absolute root of a directory tree, files in it are named relative to its parent.
+std::filesystem::path TreeRoot(const std::filesystem::path& path);
+// Whether the file has the contents hashed into `header`; false if no hash was taken.
+bool SameContents(const std::filesystem::path& path, const HAFInfo& header);
+// XXH64 of the data of a member, none if the archive lost some of it.
+std::optional<uint64_t> HashMember(const HafReader& reader, const HAFInfo& header);
+// Best effort: the data of a file is there even where its mode or time cannot be set.
+void RestoreMetadata(const HAFInfo& header);
 std::string MakeName(const std::filesystem::path& path, uint32_t copy_number);
+// Where a member is decoded before it takes the place of its file.
+std::filesystem::path PartialPath(const std::string& file_name);
 void MakeCopy(std::string& file_name);
-std::string BeautifySize(uint64_t file_size);
-void PrintFileData(const HAFInfo& header);
+// Chunks of deduplicated and piped members are frames, compressed or not.
+void EncodeChunk(Chunk& chunk, const Manipulator& payload, bool checksummed, bool compressed, bool framed = false);
+// Requested names the archive does not have are an error.
+void CheckRequested(const ArchiveDirectory& directory, const std::unordered_set<std::string>& files);
+// Whether the directory marker is at `offset`, undamaged.
+bool HasDirectoryMarker(const PositionalFile& archive, uint64_t offset, const Manipulator& manipulator);
+
+// A piece of member data: source bytes [offset, offset + length) and where
+// they are encoded in the archive.
+struct ExtractTask {
+    size_t member;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t encoded_offset;
+    uint64_t encoded_length;
+    const Frame* frame; // nullptr unless the piece is a frame of a compressed member
+};
+
+// Holes of sparse members are left out unless `holes`, otherwise they are
+// cut into pieces of zeros.
+void AddExtractTasks(std::vector<ExtractTask>& tasks, size_t member_index, const ArchiveMember& member, const std::vector<Frame>& frames,
+                     const Manipulator& payload, uint64_t piece_size, bool holes = true);
+// Decodes what the archive holds of a piece, `bytes_read` of its encoded
+// bytes. `decoded` gets the number of source bytes written to `output`, fewer
+// than the piece has if a truncated archive lost its tail (or a frame of it).
+CodecStats DecodeTask(const ExtractTask& task, const ArchiveMember& member, const Manipulator& payload, const char* encoded,
+                      size_t bytes_read, char* output, bool restore, std::vector<char>& scratch, size_t& decoded);
+// Checksums of the next `length` bytes of data, `offset` bytes came before.
+void ExtendChecksums(std::vector<uint32_t>& checksums, uint64_t& offset, const char* data, size_t length);
+// Reader of a pipeline over `tasks`, one chunk per task. `input` holds the
+// encoded bytes the archive has, a truncated one may lack some.
+bool ReadTask(const PositionalFile& archive, const std::vector<ExtractTask>& tasks, Chunk& chunk);
+
+// A piece of an async extraction: encoded bytes come in while the previous
+// piece decoded from it goes out.
+struct AsyncSlot {
+    AlignedBuffer input;
+    AlignedBuffer output;
+    size_t skip = 0; // bytes read in front of the piece to start on an aligned offset
+    uint64_t read_ticket = 0;
+    uint64_t write_ticket = 0;
+    size_t write_length = 0;
+    bool writing = false;
+};
+
+// A run of codewords of one code. Offsets and lengths are in encoded bytes.
+struct ScrubRegion {
+    std::string name;
+    CodeRate code_rate;
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct ScrubTask {
+    size_t region;
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct ScrubFinding {
+    size_t region;
+    uint64_t offset;
+    bool corrected;
+    uint64_t lost = 0; // codewords from `offset` on that a truncated archive lacks
+};
+
+bool IsStandardStream(const std::filesystem::path& path) {
+    return path == kStandardStream;
+}
 
 void NormalizeArchivePath(std::filesystem::path& archive_path) {
+    if (IsStandardStream(archive_path)) {
+        return;
+    }
+
     if (!archive_path.has_extension()) {
         archive_path += ".haf";
 
@@ -21,334 +118,2158 @@ void NormalizeArchivePath(std::filesystem::path& archive_path) {
     }
 
     if (archive_path.extension().string() != ".haf") {
-        std::cerr << archive_path.filename() << " is not an archive." << std::endl;
-
-        exit(1);
+        throw ArchiveError(archive_path.filename().string() + " is not an archive.");
     }
 }
 
-Archiver::Archiver(const std::filesystem::path& _archive_path, bool _restore) 
+Archiver::Archiver(const std::filesystem::path& _archive_path, const ArchiverOptions& _options) 
     : archive_path_(_archive_path)
     , manipulator_(Manipulator())
-    , restore_(_restore)
+    , restore_(_options.restore)
+    , threads_(_options.threads)
+    , io_backend_(_options.io_backend)
+    , code_rate_(_options.code_rate)
+    , compact_threshold_(_options.compact_threshold)
+    , to_stdout_(_options.to_stdout)
+    , stdin_name_(_options.stdin_name)
+    , repair_(_options.repair)
+    , checksums_(_options.checksums)
+    , compress_(_options.compress)
+    , dedup_(_options.dedup)
+    , sparse_(_options.sparse)
+    , content_hash_(_options.content_hash)
+    , range_(_options.range)
+    , on_existing_(_options.on_existing)
+    , on_damage_(_options.on_damage)
+    , on_warning_(_options.on_warning)
+    , direct_(_options.direct)
 {
     NormalizeArchivePath(archive_path_);
 }
 
-void Archiver::Create() {
-    if (std::filesystem::exists(archive_path_)) {
-        std::cout << "Archive " << archive_path_.filename() << " already exists." << std::endl;
-        std::cout << "Do you want to replace it? [y/n] ";
+const std::filesystem::path& Archiver::Path() const {
+    return archive_path_;
+}
+
+void Archiver::Create(const std::vector<std::filesystem::path>& paths) {
+    ArchiveDirectory directory(NewArchiveFormat());
+
+    if (IsStandardStream(archive_path_)) {
+        Append(paths);
+
+        return;
+    }
 
-        if (GetUserInput() == 'n') {
+    if (std::filesystem::exists(archive_path_)) {
+        if (ResolveExisting(on_existing_, Existing::kArchive, archive_path_.filename().string()) != Resolution::kReplace) {
             return;
         }
     }
 
-    std::ofstream{archive_path_};
+    std::ofstream stream(archive_path_, std::ios::binary);
+
+    directory.WriteHeader(stream, manipulator_);
+    directory.Write(stream, manipulator_);
+    CheckWritten(stream);
+    stream.close();
+
+    if (!paths.empty()) {
+        Append(paths);
+    }
+}
+
+void Archiver::WriteFileInfo(std::ostream& stream, const HAFInfo& header) {
+    WriteMemberHeader(stream, manipulator_, header);
 }
 
-void Archiver::WriteFileInfo(std::ofstream& stream, const HAFInfo& header) {
-    manipulator_.LoadData(stream, reinterpret_cast<const char*>(&header.file_name_length), sizeof(header.file_name_length));
-    manipulator_.LoadData(stream, static_cast<const char*>(header.file_name.data()), header.file_name_length);
-    manipulator_.LoadData(stream, reinterpret_cast<const char*>(&header.file_size), sizeof(header.file_size));
+ArchiveFormat Archiver::NewArchiveFormat(const ArchiveFormat& defaults) const {
+    // Each option takes the ones it builds on, the features of `defaults`
+    // come as they are.
+    bool dedup = dedup_ || sparse_;
+    bool compress = compress_ || dedup;
+
+    return MakeArchiveFormat(code_rate_.value_or(defaults.code_rate), checksums_ || compress || defaults.HasChecksums(),
+                             compress || defaults.HasCompression(), dedup || defaults.HasDedup(), sparse_ || defaults.HasSparse(),
+                             defaults.HasMetadata());
 }
 
-bool Archiver::CheckOnAvailability(const std::filesystem::path& path, const std::string& file_name) {
+ArchiveDirectory Archiver::LoadDirectory(const std::filesystem::path& path, const ArchiveFormat& defaults) {
+    if (IsStandardStream(path)) {
+        throw ArchiveError("Archives are only written to a pipe, reading needs a file.");
+    }
+
+    ArchiveFormat format = NewArchiveFormat(defaults);
+
+    if (!ReadArchiveFormat(path, manipulator_, format)) {
+        throw ArchiveError(path.filename().string() + " was written in a format this version cannot read.");
+    }
+
+    ArchiveDirectory directory(format);
+
+    if (directory.Load(path, manipulator_)) {
+        return directory;
+    }
+
+    // No trailer (an archive written before the directory existed) or a
+    // damaged one: rebuild the directory by walking the headers.
     std::ifstream stream(path, std::ios::binary);
+    PositionalFile archive(path, O_RDONLY);
+    Manipulator payload(format.code_rate);
+    HAFInfo current_file;
+    bool deleted;
+
+    stream.seekg(directory.DataEnd());
 
-    while (stream.peek() != EOF) {
-        HAFInfo current_file;
+    while (stream.peek() != EOF && ReadFileInfo(stream, current_file, deleted)) {
+        // A member streamed into a pipe is sized by its frames. One whose
+        // end is lost hides where the next header is.
+        bool whole = current_file.file_size != kUnknownSize && current_file.stored_size != kUnknownSize;
+
+        if (!whole && current_file.compressed) {
+            whole = MeasureFrames(archive, directory.DataEnd() + EncodedHeaderSize(current_file), payload, current_file);
+        } else if (!whole) {
+            break;
+        }
 
-        ReadFileInfo(stream, current_file);
+        directory.Add(current_file, deleted);
 
-        if (current_file.file_name == file_name) {
-            return false;
+        if (!whole) {
+            break;
         }
 
-        stream.seekg(kHammingByte * current_file.file_size, std::ios::cur);
+        stream.seekg(directory.DataEnd());
     }
 
-    return true;
+    return directory;
 }
 
-void Archiver::Append(const std::filesystem::path& file_path) {
-    File appending_file(file_path);
-
-    if (!std::filesystem::exists(file_path)) {
-        std::cerr << file_path.filename() << " does not exist." << std::endl;
+std::ofstream Archiver::OpenForAppend(const ArchiveDirectory& directory) {
+    bool is_new = !std::filesystem::exists(archive_path_) || std::filesystem::file_size(archive_path_) == 0;
 
-        exit(1);
+    // New members go where the old directory used to start.
+    if (!is_new) {
+        std::filesystem::resize_file(archive_path_, directory.DataEnd());
     }
 
-    if (std::filesystem::is_directory(file_path)) {
-        std::cerr << file_path.filename() << " is a directory. Archiving directories is not supported (yet)." << std::endl;
+    std::ofstream stream(archive_path_, std::ios::binary | std::ios::app);
 
-        exit(1);
+    if (is_new) {
+        directory.WriteHeader(stream, manipulator_);
     }
 
-    HAFInfo info_header = appending_file.ExportIntoHAF();
+    return stream;
+}
 
-    if (info_header.file_size > kFileSizeLimit) {
-        std::cerr << "The size of the file " << info_header.file_name << " exceeds 1 GB. ";
-        std::cerr << "File cannot be archived." << std::endl;
+std::vector<ArchiveInput> Archiver::CollectInputs(const std::vector<std::filesystem::path>& paths) {
+    std::vector<ArchiveInput> inputs;
 
-        exit(1);
-    }
+    for (const std::filesystem::path& path: paths) {
+        if (IsStandardStream(path)) {
+            inputs.push_back({path, HAFInfo(stdin_name_.size(), stdin_name_, kUnknownSize)});
 
-    if (!CheckOnAvailability(archive_path_, info_header.file_name)) {
-        std::cout << "Archive already contains file with name " << info_header.file_name << std::endl;
-        std::cout << "Do you want to replace it? [y/n] ";
+            continue;
+        }
 
-        if (GetUserInput() == 'n') {
-            return;
+        if (!std::filesystem::exists(path)) {
+            throw ArchiveError(path.filename().string() + " does not exist.");
         }
 
-        Delete({info_header.file_name});
-    }
+        if (!std::filesystem::is_directory(path)) {
+            inputs.push_back({path, MakeHeader(path, path.filename().string())});
 
-    std::ofstream stream(archive_path_, std::ios::binary | std::ios::app);
+            continue;
+        }
 
-    WriteFileInfo(stream, info_header);
+        // Files of a tree are named relative to the parent of its root, so
+        // the root directory keeps its own name.
+        std::filesystem::path root = TreeRoot(path);
+        std::vector<std::filesystem::path> tree;
+
+        for (const std::filesystem::directory_entry& entry: std::filesystem::recursive_directory_iterator(root)) {
+            if (entry.is_regular_file()) {
+                tree.push_back(entry.path());
+            }
+        }
 
-    std::ifstream file_stream(file_path, std::ios::binary);
+        std::sort(tree.begin(), tree.end());
 
-    for (char byte; file_stream.get(byte);) {
-        manipulator_.LoadData(stream, static_cast<const char*>(&byte), sizeof(byte));
+        for (const std::filesystem::path& file: tree) {
+            inputs.push_back({file, MakeHeader(file, file.lexically_relative(root.parent_path()).generic_string())});
+        }
     }
+
+    return inputs;
 }
 
-void Archiver::ReadFileInfo(std::ifstream& stream, HAFInfo& header) {
-    manipulator_.UnloadData(stream, reinterpret_cast<char*>(&header.file_name_length), sizeof(header.file_name_length), restore_);
+std::filesystem::path TreeRoot(const std::filesystem::path& path) {
+    std::filesystem::path root = std::filesystem::absolute(path).lexically_normal();
 
-    char buffer[header.file_name_length + 1];
+    return root.has_filename() ? root : root.parent_path();
+}
 
-    manipulator_.UnloadData(stream, buffer, header.file_name_length, restore_);
+HAFInfo Archiver::MakeHeader(const std::filesystem::path& file_path, const std::string& file_name) {
+    HAFInfo header = File(file_path).ExportIntoHAF();
 
-    buffer[header.file_name_length] = '\0';
-    header.file_name = std::string(buffer);
+    header.file_name = file_name;
+    header.file_name_length = file_name.size();
 
-    manipulator_.UnloadData(stream, reinterpret_cast<char*>(&header.file_size), sizeof(header.file_size), restore_);
+    return header;
 }
 
-std::string MakeName(const std::filesystem::path& path, uint32_t copy_number) {
-    return path.stem().string() + "_" + std::to_string(copy_number) + path.extension().string();
-}
+void Archiver::Append(const std::vector<std::filesystem::path>& paths) {
+    std::vector<ArchiveInput> inputs = CollectInputs(paths);
 
-void MakeCopy(std::string& file_name) {
-    std::filesystem::path actual_path(file_name);
+    // A piped archive is a new one: header, members and the directory. A
+    // member read from stdin is framed there, which takes compression.
+    if (IsStandardStream(archive_path_)) {
+        bool streamed = std::any_of(inputs.begin(), inputs.end(), [](const ArchiveInput& input) {
+            return IsStandardStream(input.path);
+        });
+        ArchiveDirectory directory(NewArchiveFormat(streamed ? MakeArchiveFormat(CodeRate::kHamming13_8, true, true) : ArchiveFormat()));
 
-    for (uint32_t copy_number = 1;; ++copy_number) {
-        std::string temp_file_name = MakeName(actual_path, copy_number);
+        directory.WriteHeader(std::cout, manipulator_);
+        WriteMembers(std::cout, directory, inputs);
+        directory.Write(std::cout, manipulator_);
+        CheckWritten(std::cout);
 
-        if (!std::filesystem::exists(temp_file_name)) {
-            file_name = temp_file_name;
-            break;
+        return;
+    }
+
+    ArchiveDirectory directory = LoadDirectory(archive_path_);
+    std::vector<ArchiveInput> accepted;
+    std::unordered_map<std::string, size_t> accepted_names;
+    std::vector<size_t> replaced; // members the accepted files take the place of
+
+    // Every question is asked before anything is written.
+    for (const ArchiveInput& input: inputs) {
+        const std::string& file_name = input.header.file_name;
+        auto it = accepted_names.find(file_name);
+
+        if (it != accepted_names.end() || directory.Find(file_name) != nullptr) {
+            if (ResolveExisting(on_existing_, Existing::kMember, file_name) != Resolution::kReplace) {
+                continue;
+            }
+        }
+
+        if (it != accepted_names.end()) {
+            accepted[it->second] = input;
+
+            continue;
+        }
+
+        if (std::optional<size_t> member_index = directory.FindIndex(file_name)) {
+            replaced.push_back(*member_index);
+        }
+
+        accepted_names[file_name] = accepted.size();
+        accepted.push_back(input);
+    }
+
+    std::ofstream stream = OpenForAppend(directory);
+
+    WriteMembers(stream, directory, accepted);
+
+    // Replaced members are only deleted once their successors are written:
+    // an append that fails halfway leaves them in place.
+    if (!replaced.empty()) {
+        PositionalFile archive(archive_path_, O_RDWR);
+
+        stream.flush();
+
+        for (size_t member_index: replaced) {
+            WriteTombstone(archive, directory.MarkDeleted(member_index));
         }
     }
+
+    directory.Write(stream, manipulator_);
+    CheckWritten(stream);
 }
 
-void Archiver::Extract(const std::unordered_set<std::string>& files) {
-    std::ifstream input_stream(archive_path_, std::ios::binary);
+void Archiver::Update(const std::vector<std::filesystem::path>& paths) {
+    if (IsStandardStream(archive_path_)) {
+        throw ArchiveError("Only an archive file can be updated.");
+    }
 
-    while (input_stream.peek() != EOF) {
-        HAFInfo current_file;
+    ArchiveDirectory directory = LoadDirectory(archive_path_, MakeArchiveFormat(CodeRate::kHamming13_8, false, false, false, false, true));
+    std::vector<std::filesystem::path> existing;
+    std::vector<std::string> prefixes; // of the members of the trees given
+    std::vector<size_t> removed; // members of changed files and of files that are gone
 
-        ReadFileInfo(input_stream, current_file);
+    // A file that is gone takes its member with it, as do the files gone
+    // from a tree.
+    for (const std::filesystem::path& path: paths) {
+        if (IsStandardStream(path)) {
+            throw ArchiveError("Data from stdin cannot be compared with the archive, append it instead.");
+        }
 
-        if (!files.empty() && files.find(current_file.file_name) == files.end()) {
-            input_stream.seekg(kHammingByte * current_file.file_size, std::ios::cur);
+        if (!std::filesystem::exists(path)) {
+            std::optional<size_t> member_index = directory.FindIndex(path.filename().string());
+
+            if (!member_index.has_value()) {
+                throw ArchiveError(path.filename().string() + " does not exist.");
+            }
+
+            removed.push_back(*member_index);
 
             continue;
         }
 
-        if (std::filesystem::exists(current_file.file_name)) {
-            std::cout << "File " << current_file.file_name << " already exists." << std::endl;
-            std::cout << "Do you want to replace it? [y/n] ";
+        if (std::filesystem::is_directory(path)) {
+            prefixes.push_back(TreeRoot(path).filename().string() + "/");
+        }
 
-            if (GetUserInput() == 'n') {
-                std::cout << "Do you want to create a copy? [y/n] ";
+        existing.push_back(path);
+    }
 
-                if (GetUserInput() == 'n') {
-                    continue;
-                }
+    std::vector<ArchiveInput> inputs = CollectInputs(existing);
+    std::vector<ArchiveInput> changed;
+    std::vector<ArchiveInput> retimed; // unchanged files whose member only gets a new time or mode
+    std::unordered_set<std::string> present;
+    std::optional<HafReader> reader;
+    bool damaged = false;
+
+    // A member without metadata only has its contents to tell it from its
+    // file by: they are hashed here, which takes a read of both. A damaged
+    // one is replaced.
+    auto same_contents = [&](const ArchiveInput& input, HAFInfo stored) {
+        if (!reader.has_value()) {
+            reader.emplace(archive_path_, directory, restore_, [&damaged](const std::string&) {
+                damaged = true;
+
+                return true;
+            });
+        }
 
-                MakeCopy(current_file.file_name);
-                current_file.file_name_length = current_file.file_name.size();
-            }
+        damaged = false;
+        stored.content_hash = HashMember(*reader, stored);
+
+        return !damaged && SameContents(input.path, stored);
+    };
+
+    // Members are compared by size and modification time. A file touched
+    // without being changed keeps its member where its contents were hashed.
+    for (const ArchiveInput& input: inputs) {
+        const std::string& file_name = input.header.file_name;
+
+        if (!present.insert(file_name).second) {
+            continue;
+        }
+
+        std::optional<size_t> member_index = directory.FindIndex(file_name);
+
+        if (!member_index.has_value()) {
+            changed.push_back(input);
+
+            continue;
         }
 
-        std::ofstream output_stream(current_file.file_name, std::ios::binary);
+        const HAFInfo& stored = directory.Members()[*member_index].header;
+
+        if (stored.file_size != input.header.file_size
+            || (!stored.metadata && !same_contents(input, stored))
+            || (stored.metadata && stored.modified != input.header.modified && !SameContents(input.path, stored))) {
+            removed.push_back(*member_index);
+            changed.push_back(input);
 
-        for (size_t i = 0; i < current_file.file_size; ++i) {
-            char byte;
+            continue;
+        }
+
+        if (!stored.metadata) {
+            continue;
+        }
 
-            manipulator_.UnloadData(input_stream, reinterpret_cast<char*>(&byte), sizeof(byte), restore_);
-            output_stream.write(static_cast<const char*>(&byte), sizeof(byte));
+        if (stored.modified != input.header.modified || stored.mode != input.header.mode) {
+            retimed.push_back(input);
         }
     }
-}
 
-std::string BeautifySize(uint64_t file_size) {
-    const uint16_t kOneStep = 1024;
-    size_t power = 0;
+    for (size_t i = 0; i < directory.Members().size(); ++i) {
+        const ArchiveMember& member = directory.Members()[i];
+        const std::string& file_name = member.header.file_name;
 
-    while (file_size >= kOneStep) {
-        file_size /= kOneStep;
-        ++power;
+        if (!member.deleted && present.find(file_name) == present.end()
+            && std::any_of(prefixes.begin(), prefixes.end(), [&](const std::string& prefix) {
+                   return file_name.compare(0, prefix.size(), prefix) == 0;
+               })) {
+            removed.push_back(i);
+        }
     }
 
-    std::string result = std::to_string(file_size) + " ";
-    
-    if (power == 1) {
-        result += "K";
-    } else if (power == 2) {
-        result += "M";
-    } else if (power == 3) {
-        result += "G";
+    if (changed.empty() && retimed.empty() && removed.empty() && std::filesystem::exists(archive_path_)) {
+        return;
     }
 
-    result += "B";
+    std::ofstream stream = OpenForAppend(directory);
 
-    return result;
-}
+    if (!changed.empty()) {
+        WriteMembers(stream, directory, changed);
+    }
 
-void PrintFileData(const HAFInfo& header) {
-    std::cout << header.file_name << " " << BeautifySize(header.file_size) << std::endl;
-}
+    // Only the headers of retimed and removed members are rewritten, once
+    // the changed files are appended: an update that fails halfway leaves
+    // the members they replace in place.
+    if (!retimed.empty() || !removed.empty()) {
+        PositionalFile archive(archive_path_, O_RDWR);
+
+        stream.flush();
 
-void Archiver::ShowData() {
-    std::cout << "Archive " << archive_path_ << " contains:" << std::endl;
+        for (const ArchiveInput& input: retimed) {
+            RewriteFileInfo(archive, *directory.SetMetadata(input.header.file_name, input.header.modified, input.header.mode));
+        }
 
-    std::ifstream input_stream(archive_path_, std::ios::binary);
-    uint32_t file_count = 0;
-    uint64_t archive_size = 0;
+        for (size_t member_index: removed) {
+            WriteTombstone(archive, directory.MarkDeleted(member_index));
+        }
+    }
 
-    while (input_stream.peek() != EOF) {
-        HAFInfo current_file;
+    directory.Write(stream, manipulator_);
+    CheckWritten(stream);
+}
 
-        ReadFileInfo(input_stream, current_file);
-        PrintFileData(current_file);
+std::optional<uint64_t> HashMember(const HafReader& reader, const HAFInfo& header) {
+    std::vector<char> buffer(kBufferSize);
+    XxHasher hasher;
+    uint64_t offset = 0;
 
-        ++file_count;
-        archive_size += current_file.file_size;
+    for (size_t bytes_read; (bytes_read = reader.ReadAt(header.file_name, offset, buffer.data(), buffer.size())) > 0; offset += bytes_read) {
+        hasher.Update(buffer.data(), bytes_read);
+    }
 
-        input_stream.seekg(kHammingByte * current_file.file_size, std::ios::cur);
+    if (offset != header.file_size) {
+        return std::nullopt;
     }
 
-    if (file_count == 0) {
-        std::cout << "Nothing." << std::endl;
+    return hasher.Digest();
+}
 
-        return;
+bool SameContents(const std::filesystem::path& path, const HAFInfo& header) {
+    if (!header.content_hash.has_value()) {
+        return false;
+    }
+
+    PositionalFile file(path, O_RDONLY);
+    std::vector<char> buffer(kBufferSize);
+    XxHasher hasher;
+    uint64_t offset = 0;
+
+    if (!file.IsOpen()) {
+        return false;
+    }
+
+    for (size_t bytes_read; (bytes_read = file.ReadAt(buffer.data(), buffer.size(), offset)) > 0; offset += bytes_read) {
+        hasher.Update(buffer.data(), bytes_read);
     }
 
-    std::cout << std::endl;
-    std::cout << "Amount of files: " << file_count << std::endl;
-    std::cout << "Size archived: " << BeautifySize(archive_size) << std::endl;
+    return offset == header.file_size && hasher.Digest() == *header.content_hash;
 }
 
-void Archiver::Delete(const std::unordered_set<std::string>& files) {
-    if (files.empty()) {
-        std::cerr << "No files provided. See --help for more information." << std::endl;
-        
-        exit(1);
+bool Archiver::UseCompression(const ArchiveFormat& format) const {
+    return format.HasCompression() && (!IsStandardStream(archive_path_) || compress_ || dedup_ || sparse_);
+}
+
+bool Archiver::UseMappedEncoding(const ArchiveInput& input, const ArchiveFormat& format) const {
+    // Mapping a small file costs more than reading it. Frames are only sized
+    // once compressed, they cannot be mapped in advance.
+    return !IsStandardStream(archive_path_) && !format.HasCompression()
+        && UseMappings(io_backend_, input.path) && UseMappings(io_backend_, archive_path_)
+        && (io_backend_ == IoBackend::kMmap || input.header.file_size >= kMappedWindowSize);
+}
+
+void Archiver::WriteMembers(std::ostream& stream, ArchiveDirectory& directory, const std::vector<ArchiveInput>& inputs) {
+    Manipulator payload(directory.Format().code_rate);
+    ChunkIndex index;
+
+    // New members refer to the chunks of the members already there.
+    if (directory.Format().HasDedup() && !IsStandardStream(archive_path_)) {
+        index.Load(PositionalFile(archive_path_, O_RDONLY), directory);
     }
 
-    std::filesystem::path new_archive = std::filesystem::path(archive_path_.stem().string() + ".tmp");
-    std::ofstream output_stream(new_archive, std::ios::binary | std::ios::app);
-    std::ifstream input_stream(archive_path_, std::ios::binary);
+    for (size_t begin = 0; begin < inputs.size();) {
+        const ArchiveInput& input = inputs[begin];
+        HAFInfo header = input.header;
+
+        if (IsStandardStream(input.path)) {
+            std::vector<uint32_t> checksums;
 
-    while (input_stream.peek() != EOF) {
-        HAFInfo current_file;
+            EncodeStream(std::cin, stream, payload, UseCompression(directory.Format()), IsStandardStream(archive_path_), header,
+                         checksums);
 
-        ReadFileInfo(input_stream, current_file);
+            const ArchiveMember& member = directory.Add(header, false, std::move(checksums));
 
-        if (files.find(current_file.file_name) != files.end()) {
-            input_stream.seekg(kHammingByte * current_file.file_size, std::ios::cur);
+            // The sizes are only known now: an archive file gets them in the
+            // header, a piped one has them in the directory only.
+            if (!IsStandardStream(archive_path_)) {
+                PositionalFile archive(archive_path_, O_WRONLY);
+
+                stream.flush();
+                RewriteFileInfo(archive, member);
+            }
+
+            ++begin;
 
             continue;
         }
 
-        WriteFileInfo(output_stream, current_file);
+        if (UseMappedEncoding(input, directory.Format())) {
+            WriteFileInfo(stream, header);
+            stream.flush();
+
+            std::vector<uint32_t> checksums = EncodeMapped(input.path, directory.DataEnd() + EncodedHeaderSize(header), header.file_size, payload);
 
-        for (size_t bytes_read = 0; bytes_read < current_file.file_size; ++bytes_read) {
-            char byte;
+            directory.Add(header, false, std::move(checksums));
+            ++begin;
 
-            manipulator_.UnloadData(input_stream, static_cast<char*>(&byte), sizeof(byte), restore_);
-            manipulator_.LoadData(output_stream, static_cast<const char*>(&byte), sizeof(byte));
+            continue;
+        }
+
+        size_t end = begin + 1;
+
+        while (end < inputs.size() && !IsStandardStream(inputs[end].path) && !UseMappedEncoding(inputs[end], directory.Format())) {
+            ++end;
         }
+
+        EncodeFiles(stream, directory, inputs, begin, end, payload, index);
+
+        begin = end;
     }
 
-    input_stream.close();
-    output_stream.close();
+    CheckWritten(stream);
+}
+
+void Archiver::CheckWritten(std::ostream& stream) const {
+    stream.flush();
 
-    std::filesystem::remove(archive_path_);
-    std::filesystem::rename(new_archive, archive_path_);
+    if (!stream) {
+        throw ArchiveError(IsStandardStream(archive_path_) ? "Cannot write the archive."
+                                                           : "Cannot write into " + archive_path_.filename().string() + ".");
+    }
 }
 
-void Archiver::WriteArchive(std::ofstream& output_stream, const std::filesystem::path& path, std::unordered_set<std::string>& merged_files) {
-    std::ifstream input_stream(path, std::ios::binary);
+void Archiver::EncodeFiles(std::ostream& stream, ArchiveDirectory& directory, const std::vector<ArchiveInput>& inputs,
+                           size_t begin, size_t end, const Manipulator& payload, ChunkIndex& index) {
+    ChunkPipeline pipeline(threads_);
+    std::deque<PositionalFile> opened; // files [current, prefetched)
+    size_t current = begin;
+    size_t prefetched = begin;
+    size_t next_header = begin;
+    uint64_t offset = 0;
+    bool checksummed = directory.Format().HasChecksums();
+    bool compressing = UseCompression(directory.Format());
+    bool deduplicating = directory.Format().HasDedup();
+    bool sparse = directory.Format().HasSparse();
+    std::vector<char> compressed(end - begin, false); // decided by the reader on the first data of a file
+    bool sampled = false; // whether the current file has been decided
+    std::vector<size_t> rewritten; // members whose headers get their stored size at the end
+    std::vector<char> window; // bytes of the current file read ahead of `offset` from `window_begin` on, to be cut into chunks
+    size_t window_begin = 0;
+    uint64_t data_end = 0; // of the current file's data from `offset` on, the window is not filled past it
+    std::mutex index_mutex; // the reader adds chunks the writer fills in
+    std::vector<ChunkRef> recipe; // of the member being written
+    bool metadata = directory.Format().HasMetadata();
+    bool hashing = metadata && content_hash_;
+    XxHasher hasher; // of the contents of the member being written
+
+    // A deduplicated chunk goes into the recipe, and into the archive unless
+    // it is there already.
+    auto store_chunk = [&](Chunk& chunk) {
+        bool collision = false;
+
+        // Zeros only take a recipe entry, or grow the hole before them.
+        if (chunk.hole != 0) {
+            if (!recipe.empty() && IsHole(recipe.back()) && recipe.back().source_length + chunk.hole <= kMaxHoleLength) {
+                recipe.back().source_length += chunk.hole;
+            } else {
+                ChunkRef hole;
+
+                hole.source_length = chunk.hole;
+                recipe.push_back(hole);
+            }
 
-    while (input_stream.peek() != EOF) {
-        HAFInfo appending_file;
+            return;
+        }
 
-        ReadFileInfo(input_stream, appending_file);
+        if (chunk.duplicate) {
+            ChunkRef stored;
 
-        if (merged_files.find(appending_file.file_name) != merged_files.end()) {
-            std::filesystem::path temp_path(appending_file.file_name);
+            {
+                std::lock_guard<std::mutex> lock(index_mutex);
 
-            for (uint32_t copy_number = 1;; ++copy_number) {
-                std::string temp_file_name = MakeName(temp_path, copy_number);
+                stored = index[chunk.reference];
+            }
 
-                if (merged_files.find(temp_file_name) == merged_files.end()) {
-                    appending_file.file_name = temp_file_name;
-                    appending_file.file_name_length = temp_file_name.size();
-                    
-                    break;
+            if (stored.checksum == chunk.checksum) {
+                recipe.push_back(stored);
+
+                return;
+            }
+
+            // Equal hashes of different data: the chunk is stored after all.
+            collision = true;
+            chunk.duplicate = false;
+            EncodeChunk(chunk, payload, false, compressed[chunk.source - begin], true);
+        }
+
+        ChunkRef added;
+
+        added.position = directory.DataEnd();
+        added.source_length = chunk.input.size();
+        added.stored_length = StoredLength(chunk.frame);
+        added.checksum = chunk.checksum;
+        added.hash = chunk.hash;
+
+        WriteCounted(stream, chunk.output.data(), chunk.output.size());
+        directory.AddStored(chunk.frame.size());
+        recipe.push_back(added);
+
+        if (!collision) {
+            std::lock_guard<std::mutex> lock(index_mutex);
+
+            index[chunk.reference] = added;
+        }
+    };
+
+    auto write_recipe = [&]() {
+        std::vector<char> bytes = MakeRecipe(recipe);
+        std::vector<char> encoded(payload.EncodedSize(bytes.size()));
+
+        payload.EncodeBlock(bytes.data(), bytes.size(), encoded.data());
+        WriteCounted(stream, encoded.data(), encoded.size());
+        directory.AddStored(bytes.size());
+        recipe.clear();
+    };
+
+    // One pipeline runs over all the files. Every file gives at least one
+    // chunk (an empty one for an empty file), the writer puts the header
+    // before the first chunk of each file.
+    pipeline.Run(
+        [&](Chunk& chunk) {
+            if (current == end) {
+                return false;
+            }
+
+            // The kernel reads the next files ahead while this one is encoded.
+            for (; prefetched < end && prefetched < current + kReadAheadFiles; ++prefetched) {
+                opened.emplace_back(inputs[prefetched].path, O_RDONLY);
+                opened.back().Advise(POSIX_FADV_WILLNEED);
+            }
+
+            const PositionalFile& file = opened.front();
+            uint64_t file_size = inputs[current].header.file_size;
+            uint64_t rest = file_size - offset;
+            size_t block = std::min<uint64_t>(rest, kBufferSize);
+
+            if (!file.IsOpen()) {
+                throw ArchiveError("Cannot read " + inputs[current].path.filename().string() + ".");
+            }
+
+            chunk.source = current;
+            chunk.duplicate = false;
+            chunk.hole = 0;
+
+            // Holes of a sparse file are not read: a chunk stands for the
+            // zeros, the data after them is read up to the next hole. A file
+            // that changes meanwhile is read up to its end.
+            if (deduplicating && offset == data_end) {
+                uint64_t data = sparse ? std::min(file.NextData(offset), file_size) : offset;
+
+                if (data > offset) {
+                    chunk.hole = std::min<uint64_t>(data - offset, kMaxHoleLength);
+                    data_end = offset + chunk.hole;
+                } else {
+                    data_end = sparse ? std::min(file.NextHole(offset), file_size) : file_size;
+                    data_end = data_end > offset ? data_end : file_size;
+                }
+            }
+
+            // Content-defined chunks are cut from a window that holds the
+            // longest possible chunk, read a block at a time. A file that
+            // shrank since it was listed is padded with zeros.
+            if (!deduplicating) {
+                chunk.input.resize(block);
+
+                size_t bytes_read = file.ReadAt(chunk.input.data(), block, offset);
+
+                std::fill(chunk.input.begin() + bytes_read, chunk.input.end(), 0);
+            } else if (chunk.hole == 0 && window.size() - window_begin < std::min<uint64_t>(data_end - offset, kMaxDedupChunk)) {
+                size_t available = window.size() - window_begin;
+
+                window.erase(window.begin(), window.begin() + window_begin);
+                window_begin = 0;
+                block = std::min<uint64_t>(data_end - offset - available, kBufferSize);
+                window.resize(available + block);
+
+                size_t bytes_read = file.ReadAt(window.data() + available, block, offset + available);
+
+                std::fill(window.begin() + available + bytes_read, window.end(), 0);
+            }
+
+            if (compressing && !sampled && chunk.hole == 0) {
+                compressed[current - begin] = deduplicating ? WorthCompressing(window.data() + window_begin, window.size() - window_begin)
+                                                            : WorthCompressing(chunk.input.data(), chunk.input.size());
+                sampled = true;
+            }
+
+            // Zero runs of a sparse file are cut out like its holes, the
+            // data before them ends where they start.
+            if (deduplicating && chunk.hole == 0) {
+                const char* data = window.data() + window_begin;
+                size_t available = window.size() - window_begin;
+                size_t zeros = sparse ? ZeroRunLength(data, available) : 0;
+
+                if (zeros >= kMinZeroRun) {
+                    chunk.hole = zeros;
+                    window_begin += zeros;
+                } else {
+                    block = NextChunkLength(data, sparse ? FindZeroRun(data, std::min(available, kMaxDedupChunk + kMinZeroRun)) : available);
+                    chunk.input.assign(data, data + block);
+                    window_begin += block;
+                }
+            }
+
+            if (chunk.hole != 0) {
+                block = chunk.hole;
+                chunk.input.clear();
+            }
+
+            offset += block;
+
+            if (deduplicating && !chunk.input.empty()) {
+                chunk.hash = XxHash64(chunk.input.data(), chunk.input.size());
+
+                std::lock_guard<std::mutex> lock(index_mutex);
+                std::optional<size_t> found = index.Find(chunk.hash, chunk.input.size());
+                ChunkRef pending;
+
+                pending.source_length = chunk.input.size();
+                pending.hash = chunk.hash;
+                chunk.duplicate = found.has_value();
+                chunk.reference = chunk.duplicate ? *found : index.Add(pending);
+            }
+
+            if (offset == file_size) {
+                opened.pop_front();
+                ++current;
+                offset = 0;
+                data_end = 0;
+                sampled = false;
+            }
+
+            return true;
+        },
+        [&](Chunk& chunk) {
+            // Zeros have nothing to encode, and their file may not be decided yet.
+            if (chunk.hole == 0) {
+                EncodeChunk(chunk, payload, checksummed, compressed[chunk.source - begin], deduplicating);
+            }
+        },
+        [&](Chunk& chunk) {
+            if (chunk.source == next_header) {
+                if (deduplicating && next_header != begin) {
+                    write_recipe();
+                }
+
+                if (hashing && next_header != begin) {
+                    directory.SetContentHash(hasher.Digest());
+                    hasher = XxHasher();
                 }
+
+                HAFInfo header = inputs[next_header].header;
+
+                // Frames are counted as they are written.
+                header.compressed = !deduplicating && compressed[next_header - begin];
+                header.deduplicated = deduplicating;
+                header.sparse = sparse;
+                header.metadata = metadata;
+                header.stored_size = HasStoredSize(header) ? kUnknownSize : 0;
+                WriteFileInfo(stream, header);
+                header.stored_size = 0;
+                directory.Add(header);
+                ++next_header;
+
+                if (HasStoredSize(header) || hashing) {
+                    rewritten.push_back(directory.Members().size() - 1);
+                }
+            }
+
+            // The contents are hashed as they are read, holes as zeros.
+            if (hashing) {
+                static const std::vector<char> kZeros(kBufferSize, 0);
+
+                hasher.Update(chunk.input.data(), chunk.input.size());
+
+                for (uint64_t zeros = chunk.hole; zeros > 0; zeros -= std::min<uint64_t>(zeros, kBufferSize)) {
+                    hasher.Update(kZeros.data(), std::min<uint64_t>(zeros, kBufferSize));
+                }
+            }
+
+            if (deduplicating) {
+                if (!chunk.input.empty() || chunk.hole != 0) {
+                    store_chunk(chunk);
+                }
+
+                return;
+            }
+
+            // The empty chunk of an empty file has no checksum.
+            if (checksummed && !chunk.input.empty()) {
+                directory.AddChecksum(chunk.checksum);
+            }
+
+            if (compressed[chunk.source - begin]) {
+                directory.AddStored(chunk.frame.size());
             }
+
+            WriteCounted(stream, chunk.output.data(), chunk.output.size());
         }
+    );
 
-        merged_files.insert(appending_file.file_name);
+    if (deduplicating && next_header != begin) {
+        write_recipe();
+    }
+
+    if (hashing && next_header != begin) {
+        directory.SetContentHash(hasher.Digest());
+    }
+
+    // Like a member from stdin, a compressed or deduplicated member in a
+    // piped archive is only sized in the directory.
+    if (rewritten.empty() || IsStandardStream(archive_path_)) {
+        return;
+    }
+
+    PositionalFile archive(archive_path_, O_WRONLY);
+
+    stream.flush();
+
+    for (size_t member: rewritten) {
+        RewriteFileInfo(archive, directory.Members()[member]);
+    }
+}
+
+void EncodeChunk(Chunk& chunk, const Manipulator& payload, bool checksummed, bool compressed, bool framed) {
+    if (checksummed) {
+        chunk.checksum = Crc32c(chunk.input.data(), chunk.input.size());
+    }
+
+    chunk.frame.clear();
+    chunk.output.clear();
+
+    // A chunk stored already is only checksummed, to tell a hash collision.
+    if (chunk.duplicate) {
+        return;
+    }
+
+    if ((compressed || framed) && !chunk.input.empty()) {
+        MakeFrame(chunk.input.data(), chunk.input.size(), chunk.frame, compressed);
+    }
+
+    const std::vector<char>& data = chunk.frame.empty() ? chunk.input : chunk.frame;
 
-        WriteFileInfo(output_stream, appending_file);
+    chunk.output.resize(payload.EncodedSize(data.size()));
+    payload.EncodeBlock(data.data(), data.size(), chunk.output.data());
+}
 
-        for (size_t bytes_read = 0; bytes_read < appending_file.file_size; ++bytes_read) {
-            char byte;
+void Archiver::EncodeStream(std::istream& input_stream, std::ostream& output_stream, const Manipulator& payload, bool compress,
+                            bool framed, HAFInfo& header, std::vector<uint32_t>& checksums) {
+    ChunkPipeline pipeline(threads_);
+    std::vector<char> first(kBufferSize);
+
+    // The first chunk decides, it is read before the header is written.
+    first.resize(ReadCounted(input_stream, first.data(), first.size()));
+    compress = compress && WorthCompressing(first.data(), first.size());
+    header.compressed = compress || framed;
+    header.file_size = kUnknownSize;
+    header.stored_size = header.compressed ? kUnknownSize : 0;
+    WriteFileInfo(output_stream, header);
+    header.file_size = 0;
+    header.stored_size = 0;
+
+    pipeline.Run(
+        [&](Chunk& chunk) {
+            if (chunk.sequence == 0) {
+                chunk.input.swap(first);
+            } else {
+                chunk.input.resize(kBufferSize);
+                chunk.input.resize(ReadCounted(input_stream, chunk.input.data(), chunk.input.size()));
+            }
 
-            manipulator_.UnloadData(input_stream, static_cast<char*>(&byte), sizeof(byte), restore_);
-            manipulator_.LoadData(output_stream, static_cast<const char*>(&byte), sizeof(byte));
+            return !chunk.input.empty();
+        },
+        [&](Chunk& chunk) {
+            EncodeChunk(chunk, payload, true, compress, framed);
+        },
+        [&](Chunk& chunk) {
+            WriteCounted(output_stream, chunk.output.data(), chunk.output.size());
+            header.file_size += chunk.input.size();
+            header.stored_size += header.compressed ? chunk.frame.size() : 0;
+            checksums.push_back(chunk.checksum);
         }
+    );
+
+    if (framed) {
+        char end[kFrameHeaderSize] = {};
+        std::vector<char> encoded(payload.EncodedSize(sizeof(end)));
+
+        payload.EncodeBlock(end, sizeof(end), encoded.data());
+        WriteCounted(output_stream, encoded.data(), encoded.size());
+        header.stored_size += sizeof(end);
     }
 }
 
-void Archiver::Merge(std::filesystem::path& archive_1, std::filesystem::path& archive_2) {
-    NormalizeArchivePath(archive_1);
-    NormalizeArchivePath(archive_2);
-    
-    if (archive_path_.empty()) {
-        std::cerr << "No merge archive provided. Merging was not done." << std::endl;
+void Archiver::RewriteFileInfo(PositionalFile& archive, const ArchiveMember& member) {
+    std::ostringstream stream;
+
+    WriteFileInfo(stream, member.header);
 
-        exit(1);
+    std::string encoded = stream.str();
+
+    if (!archive.WriteAt(encoded.data(), encoded.size(), member.header_offset)) {
+        throw ArchiveError("Cannot write into " + archive_path_.filename().string() + ".");
     }
+}
 
-    if (!std::filesystem::exists(archive_1)) {
-        std::cerr << "There is no such archive as " << archive_1.filename() << "." << std::endl;
+bool Archiver::ReadFileInfo(std::ifstream& stream, HAFInfo& header, bool& deleted) {
+    PhaseTimer timer(Phase::kHeader);
+    std::string archive_name = archive_path_.filename().string();
+    uint64_t name_length;
 
-        exit(1);
+    on_damage_.Check(manipulator_.UnloadData(stream, reinterpret_cast<char*>(&name_length), sizeof(name_length), restore_),
+         archive_name);
+
+    if (name_length == kDirectoryMarker || !TakeNameLengthField(name_length, header, deleted)) {
+        return false;
     }
 
-    if (!std::filesystem::exists(archive_2)) {
-        std::cerr << "There is no such archive as " << archive_2.filename() << "." << std::endl;
+    header.file_name.resize(header.file_name_length);
+    header.stored_size = 0;
+    on_damage_.Check(manipulator_.UnloadData(stream, header.file_name.data(), header.file_name_length, restore_), archive_name);
+    on_damage_.Check(manipulator_.UnloadData(stream, reinterpret_cast<char*>(&header.file_size), sizeof(header.file_size), restore_),
+         archive_name);
 
-        exit(1);
+    if (HasStoredSize(header)) {
+        on_damage_.Check(manipulator_.UnloadData(stream, reinterpret_cast<char*>(&header.stored_size), sizeof(header.stored_size),
+                                                 restore_), archive_name);
     }
 
-    NormalizeArchivePath(archive_path_);
+    if (header.metadata) {
+        uint64_t fields[kMetadataFields] = {};
+
+        on_damage_.Check(manipulator_.UnloadData(stream, reinterpret_cast<char*>(fields), sizeof(fields), restore_), archive_name);
+        TakeMetadataFields(fields, header);
+    }
 
-    std::ofstream output_stream(archive_path_, std::ios::binary | std::ios::app);
-    std::unordered_set<std::string> merged_files;
+    return true;
+}
+
+std::string MakeName(const std::filesystem::path& path, uint32_t copy_number) {
+    std::string name = path.stem().string() + "_" + std::to_string(copy_number) + path.extension().string();
+
+    return (path.parent_path() / name).generic_string();
+}
+
+void MakeCopy(std::string& file_name) {
+    std::filesystem::path actual_path(file_name);
+
+    for (uint32_t copy_number = 1;; ++copy_number) {
+        std::string temp_file_name = MakeName(actual_path, copy_number);
+
+        if (!std::filesystem::exists(temp_file_name)) {
+            file_name = temp_file_name;
+            break;
+        }
+    }
+}
+
+// Frames of a compressed or deduplicated member are its pieces, wherever
+// they are in the archive. Without them the stored bytes are cut as they
+// are, at offsets that are multiples of every codeword's data size.
+void AddExtractTasks(std::vector<ExtractTask>& tasks, size_t member_index, const ArchiveMember& member, const std::vector<Frame>& frames,
+                     const Manipulator& payload, uint64_t piece_size, bool holes) {
+    for (const Frame& frame: frames) {
+        if (!frame.hole) {
+            tasks.push_back({member_index, frame.source_offset, frame.source_length, frame.position,
+                             payload.EncodedSize(frame.stored_length), &frame});
+
+            continue;
+        }
+
+        for (uint64_t offset = 0; holes && offset < frame.source_length; offset += piece_size) {
+            tasks.push_back({member_index, frame.source_offset + offset, std::min(frame.source_length - offset, piece_size), 0, 0, &frame});
+        }
+    }
+
+    // An empty deduplicated member has no frames, only its recipe.
+    if (!frames.empty() || member.header.deduplicated) {
+        return;
+    }
+
+    uint64_t stored_size = StoredSize(member.header);
+
+    for (uint64_t offset = 0; offset < stored_size; offset += piece_size) {
+        uint64_t length = std::min(stored_size - offset, piece_size);
+
+        tasks.push_back({member_index, offset, length, member.data_offset + payload.EncodedSize(offset), payload.EncodedSize(length), nullptr});
+    }
+}
+
+CodecStats DecodeTask(const ExtractTask& task, const ArchiveMember& member, const Manipulator& payload, const char* encoded,
+                      size_t bytes_read, char* output, bool restore, std::vector<char>& scratch, size_t& decoded) {
+    decoded = task.length;
+
+    // A piece of a hole has nothing to decode.
+    if (task.frame != nullptr && task.frame->hole) {
+        std::fill(output, output + task.length, 0);
+
+        return CodecStats();
+    }
+
+    // A frame is decoded whole or not at all. One whose header was lost is
+    // already counted as damaged.
+    if (task.frame != nullptr) {
+        if (task.frame->stored_length == 0) {
+            decoded = 0;
+
+            return CodecStats();
+        }
+
+        if (bytes_read < task.encoded_length) {
+            decoded = 0;
+
+            return payload.LostCodewords(task.frame->stored_length, bytes_read);
+        }
+
+        return DecodeFrame(payload, *task.frame, encoded, output, restore, scratch);
+    }
+
+    // Checksums are taken over source bytes, not over frames.
+    const uint32_t* checksums = HasFrames(member.header) ? nullptr : FindChecksums(member, task.offset);
+    CodecStats stats;
+
+    decoded = payload.ReadableLength(task.length, bytes_read);
+    stats = payload.DecodeBlock(encoded, decoded, output, restore, checksums);
+    stats.damaged += payload.LostCodewords(task.length, bytes_read).damaged;
+
+    return stats;
+}
+
+void Archiver::Extract(const std::unordered_set<std::string>& files) {
+    if (range_.has_value() || to_stdout_) {
+        Extract(files, std::cout);
+
+        return;
+    }
+
+    ArchiveDirectory directory = LoadDirectory(archive_path_);
+    std::vector<ArchiveMember> members;
+
+    CheckRequested(directory, files);
+
+    // Every question is asked before any data is touched.
+    for (ArchiveMember member: directory.Members()) {
+        HAFInfo& current_file = member.header;
+
+        if (member.deleted) {
+            continue;
+        }
+
+        if (!files.empty() && files.find(current_file.file_name) == files.end()) {
+            continue;
+        }
+
+        std::filesystem::path name(current_file.file_name);
+
+        if (name.is_absolute() || std::find(name.begin(), name.end(), "..") != name.end()) {
+            if (on_warning_) {
+                on_warning_("File name " + name.string() + " points outside of the current directory, skipped.");
+            }
+
+            continue;
+        }
+
+        if (std::filesystem::exists(current_file.file_name)) {
+            Resolution resolution = ResolveExisting(on_existing_, Existing::kFile, current_file.file_name);
+
+            if (resolution == Resolution::kSkip) {
+                continue;
+            }
+
+            if (resolution == Resolution::kCopy) {
+                MakeCopy(current_file.file_name);
+                current_file.file_name_length = current_file.file_name.size();
+            }
+        }
+
+        members.push_back(member);
+    }
+
+    // Members are cut into pieces, so one large member is decoded by several
+    // workers just like many small ones. Compressed and deduplicated members
+    // are cut into their frames.
+    Manipulator payload(directory.Format().code_rate);
+    bool mapped = UseMappings(io_backend_, archive_path_) && !direct_;
+    uint64_t task_size = mapped ? kMappedWindowSize : kBufferSize;
+    PositionalFile archive(archive_path_, O_RDONLY);
+    std::vector<std::vector<Frame>> frames(members.size());
+    std::vector<ExtractTask> tasks;
+    std::vector<std::filesystem::path> outputs;
+
+    // Members are decoded next to their files and only renamed over them
+    // once every one of them is done. A run that fails, on damage the policy
+    // declines or anything else, leaves the files as they were.
+    try {
+        for (size_t i = 0; i < members.size(); ++i) {
+            std::filesystem::path parent = std::filesystem::path(members[i].header.file_name).parent_path();
+
+            if (!parent.empty()) {
+                std::filesystem::create_directories(parent);
+            }
+
+            outputs.push_back(PartialPath(members[i].header.file_name));
+
+            PositionalFile output(outputs.back(), O_WRONLY | O_CREAT | O_TRUNC);
+            uint64_t file_size = members[i].header.file_size;
+
+            if (HasFrames(members[i].header)) {
+                CodecStats stats;
+
+                frames[i] = ReadFrames(archive, members[i], payload, stats);
+                on_damage_.Check(stats, members[i].header.file_name);
+            }
+
+            bool sparse = std::any_of(frames[i].begin(), frames[i].end(), [](const Frame& frame) {
+                return frame.hole;
+            });
+
+            // The size is known, blocks reserved up front keep the file in one
+            // piece. Mapped windows are written through memory, a missing block
+            // would only show up as SIGBUS. Holes of a sparse member are never
+            // written, the file is only sized so they stay holes; its frames are
+            // not mapped.
+            if (!output.IsOpen() || !(sparse ? output.Resize(file_size) : output.Allocate(file_size))) {
+                throw ArchiveError("Cannot create file " + members[i].header.file_name + ".");
+            }
+
+            AddExtractTasks(tasks, i, members[i], frames[i], payload, task_size, false);
+        }
+
+        std::vector<uint64_t> data_ends;
+
+        for (const ArchiveMember& member: members) {
+            data_ends.push_back(member.header.file_size);
+        }
+
+        if (io_backend_ == IoBackend::kAsync || direct_) {
+            ExtractAsync(members, tasks, outputs, payload, data_ends);
+        } else {
+            ExtractTasks(archive, members, tasks, outputs, payload, mapped, data_ends);
+        }
+
+        // Nothing stands in for data a truncated archive lost (the policy took
+        // the loss): the file ends where the loss starts. Written files get the
+        // time and mode of the originals.
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (data_ends[i] < members[i].header.file_size && !PositionalFile(outputs[i], O_WRONLY).Resize(data_ends[i])) {
+                throw ArchiveError("Cannot write file " + members[i].header.file_name + ".");
+            }
+        }
+
+        for (size_t i = 0; i < members.size(); ++i) {
+            std::filesystem::rename(outputs[i], members[i].header.file_name);
+            RestoreMetadata(members[i].header);
+        }
+    } catch (const ArchiveError&) {
+        std::error_code ignored;
+
+        for (const std::filesystem::path& output: outputs) {
+            std::filesystem::remove(output, ignored);
+        }
+
+        throw;
+    } catch (const std::filesystem::filesystem_error& error) {
+        std::error_code ignored;
+
+        for (const std::filesystem::path& output: outputs) {
+            std::filesystem::remove(output, ignored);
+        }
+
+        throw ArchiveError("Cannot write file " + error.path1().string() + ": " + error.code().message() + ".");
+    }
+}
+
+void CheckRequested(const ArchiveDirectory& directory, const std::unordered_set<std::string>& files) {
+    for (const std::string& file_name: files) {
+        if (directory.Find(file_name) == nullptr) {
+            throw ArchiveError("There is no file " + file_name + " in the archive.");
+        }
+    }
+}
+
+bool HasDirectoryMarker(const PositionalFile& archive, uint64_t offset, const Manipulator& manipulator) {
+    char encoded[kHammingByte * sizeof(uint64_t)];
+    uint64_t marker;
+
+    if (archive.ReadAt(encoded, sizeof(encoded), offset) != sizeof(encoded)) {
+        return false;
+    }
+
+    return manipulator.DecodeBlock(encoded, sizeof(marker), reinterpret_cast<char*>(&marker)).damaged == 0 && marker == kDirectoryMarker;
+}
+
+std::filesystem::path PartialPath(const std::string& file_name) {
+    return std::filesystem::path(file_name).concat(".hamarc-part");
+}
+
+void Archiver::ExtractTasks(const PositionalFile& archive, const std::vector<ArchiveMember>& members, const std::vector<ExtractTask>& tasks,
+                            const std::vector<std::filesystem::path>& outputs, const Manipulator& payload, bool mapped,
+                            std::vector<uint64_t>& data_ends) {
+    uint64_t archive_size = archive.Size();
+    TaskPool pool(threads_);
+    std::vector<Chunk> buffers(pool.Threads());
+    std::mutex data_ends_mutex;
+
+    pool.Run(tasks.size(), [&](size_t task_index, size_t worker_index) {
+        const ExtractTask& task = tasks[task_index];
+        const ArchiveMember& member = members[task.member];
+
+        // Pieces running past the end of a truncated archive cannot be mapped.
+        if (mapped && task.frame == nullptr && task.encoded_offset + task.encoded_length <= archive_size
+            && DecodeMapped(archive, task.encoded_offset, outputs[task.member], member.header.file_name, task.offset, task.length,
+                            payload, FindChecksums(member, task.offset))) {
+            return;
+        }
+
+        Chunk& chunk = buffers[worker_index];
+
+        chunk.input.resize(task.encoded_length);
+        chunk.output.resize(task.length);
+
+        size_t bytes_read = archive.ReadAt(chunk.input.data(), chunk.input.size(), task.encoded_offset);
+        size_t decoded;
+
+        on_damage_.Check(DecodeTask(task, member, payload, chunk.input.data(), bytes_read, chunk.output.data(), restore_,
+                                    chunk.frame, decoded), member.header.file_name);
+
+        PositionalFile output(outputs[task.member], O_WRONLY);
+
+        if (!output.WriteAt(chunk.output.data(), decoded, task.offset)) {
+            throw ArchiveError("Cannot write file " + member.header.file_name + ".");
+        }
+
+        if (decoded < task.length) {
+            std::lock_guard<std::mutex> lock(data_ends_mutex);
+
+            data_ends[task.member] = std::min(data_ends[task.member], task.offset + decoded);
+        }
+    });
+}
+
+void RestoreMetadata(const HAFInfo& header) {
+    if (!header.metadata) {
+        return;
+    }
+
+    timespec times[2];
+    int64_t seconds = header.modified / kNanosecondsPerSecond;
+    int64_t nanoseconds = header.modified % kNanosecondsPerSecond;
+
+    // Times before the epoch are negative, nanoseconds never are.
+    if (nanoseconds < 0) {
+        --seconds;
+        nanoseconds += kNanosecondsPerSecond;
+    }
+
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = seconds;
+    times[1].tv_nsec = nanoseconds;
+
+    chmod(header.file_name.c_str(), header.mode);
+    utimensat(AT_FDCWD, header.file_name.c_str(), times, 0);
+}
+
+void Archiver::ExtractAsync(const std::vector<ArchiveMember>& members, const std::vector<ExtractTask>& tasks,
+                            const std::vector<std::filesystem::path>& output_paths, const Manipulator& payload,
+                            std::vector<uint64_t>& data_ends) {
+    std::unique_ptr<PositionalFile> archive = OpenDirect(archive_path_, O_RDONLY, direct_);
+    std::mutex data_ends_mutex;
+    std::vector<std::unique_ptr<PositionalFile>> outputs;
+    std::vector<bool> direct_writes;
+    std::vector<bool> aligned(members.size(), true);
+
+    // Chunks of deduplicated members start anywhere in the file, such files
+    // are written through the page cache.
+    for (const ExtractTask& task: tasks) {
+        if (task.offset % kDirectAlignment != 0) {
+            aligned[task.member] = false;
+        }
+    }
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        const ArchiveMember& member = members[i];
+
+        outputs.push_back(OpenDirect(output_paths[i], O_WRONLY, direct_ && aligned[i]));
+
+        if (!outputs.back()->IsOpen()) {
+            throw ArchiveError("Cannot write file " + member.header.file_name + ".");
+        }
+
+        direct_writes.push_back(IsDirect(*outputs.back()));
+    }
+
+    if (!archive->IsOpen()) {
+        throw ArchiveError("Cannot read " + archive_path_.filename().string() + ".");
+    }
+
+    bool direct_read = IsDirect(*archive);
+    TaskPool pool(threads_);
+    size_t lanes = std::min(pool.Threads(), tasks.size());
+
+    // Every lane takes a contiguous share of the pieces and keeps the disk
+    // busy: the next pieces are read and the previous ones written while the
+    // current one is decoded.
+    pool.Run(lanes, [&](size_t lane, size_t) {
+        size_t begin = tasks.size() * lane / lanes;
+        size_t end = tasks.size() * (lane + 1) / lanes;
+        std::vector<AsyncSlot> slots(kAsyncDepth);
+        std::vector<char> scratch;
+        size_t next_read = begin;
+
+        for (AsyncSlot& slot: slots) {
+            slot.input = AlignedBuffer(payload.EncodedSize(kBufferSize) + 2 * kDirectAlignment);
+            slot.output = AlignedBuffer(AlignUp(kBufferSize));
+        }
+
+        // Declared after the buffers, so it waits for the kernel before they are freed.
+        AsyncIo io(2 * kAsyncDepth + 2);
+
+        auto submit_read = [&]() {
+            const ExtractTask& task = tasks[next_read];
+            AsyncSlot& slot = slots[next_read % kAsyncDepth];
+
+            // O_DIRECT reads whole aligned blocks around the piece.
+            slot.skip = direct_read ? task.encoded_offset % kDirectAlignment : 0;
+            slot.read_ticket = io.Read(*archive, slot.input.Data(), direct_read ? AlignUp(slot.skip + task.encoded_length) : task.encoded_length,
+                                       task.encoded_offset - slot.skip);
+            ++next_read;
+        };
+
+        auto finish_write = [&](AsyncSlot& slot, const ArchiveMember& member) {
+            if (slot.writing && io.Wait(slot.write_ticket) != slot.write_length) {
+                throw ArchiveError("Cannot write file " + member.header.file_name + ".");
+            }
+
+            slot.writing = false;
+        };
+
+        for (; next_read < end && next_read < begin + kAsyncDepth;) {
+            submit_read();
+        }
+
+        for (size_t i = begin; i < end; ++i) {
+            const ExtractTask& task = tasks[i];
+            const ArchiveMember& member = members[task.member];
+            const PositionalFile& output = *outputs[task.member];
+            AsyncSlot& slot = slots[i % kAsyncDepth];
+            size_t bytes_read = io.Wait(slot.read_ticket);
+            char* encoded = slot.input.Data() + slot.skip;
+
+            size_t decoded;
+
+            bytes_read = std::min<size_t>(bytes_read - std::min(bytes_read, slot.skip), task.encoded_length);
+            finish_write(slot, member);
+            on_damage_.Check(DecodeTask(task, member, payload, encoded, bytes_read, slot.output.Data(), restore_, scratch, decoded),
+                 member.header.file_name);
+
+            if (decoded < task.length) {
+                std::lock_guard<std::mutex> lock(data_ends_mutex);
+
+                data_ends[task.member] = std::min(data_ends[task.member], task.offset + decoded);
+            }
+
+            // O_DIRECT writes whole blocks, the file is cut back to size at the end.
+            slot.write_length = direct_writes[task.member] ? AlignUp(decoded) : decoded;
+            std::fill(slot.output.Data() + decoded, slot.output.Data() + slot.write_length, 0);
+            slot.write_ticket = io.Write(output, slot.output.Data(), slot.write_length, task.offset);
+            slot.writing = true;
+
+            if (next_read < end) {
+                submit_read();
+            }
+        }
+
+        for (size_t i = 0; i < slots.size() && begin + i < end; ++i) {
+            finish_write(slots[(end - 1 - i) % kAsyncDepth], members[tasks[end - 1 - i].member]);
+        }
+    });
+
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (direct_writes[i] && !outputs[i]->Resize(data_ends[i])) {
+            throw ArchiveError("Cannot write file " + members[i].header.file_name + ".");
+        }
+    }
+}
+
+void Archiver::Extract(const std::unordered_set<std::string>& files, std::ostream& stream) {
+    if (range_.has_value()) {
+        ExtractRange(files, stream);
+    } else {
+        ArchiveDirectory directory = LoadDirectory(archive_path_);
+
+        CheckRequested(directory, files);
+        DecodeToStream(directory, files, stream);
+    }
+
+    stream.flush();
+
+    if (!stream) {
+        throw ArchiveError("Cannot write the extracted data.");
+    }
+}
+
+void Archiver::ExtractRange(const std::unordered_set<std::string>& files, std::ostream& output_stream) {
+    if (files.size() != 1) {
+        throw ArchiveError("A range is extracted from exactly one file.");
+    }
+
+    HafReader reader = OpenReader();
+    const std::string& file_name = *files.begin();
+    const ArchiveMember* member = reader.Directory().Find(file_name);
+
+    if (member == nullptr) {
+        throw ArchiveError("There is no file " + file_name + " in the archive.");
+    }
+
+    if (range_->offset > member->header.file_size) {
+        throw ArchiveError("The range starts past the end of " + file_name + ".");
+    }
+
+    // The range may be as long as the member, it is read piece by piece.
+    std::vector<char> buffer(kBufferSize);
+    uint64_t offset = range_->offset;
+    uint64_t end = offset + std::min(range_->length, member->header.file_size - offset);
+
+    // A truncated archive (whose loss the policy took) ends the range early.
+    for (size_t bytes_read; offset < end; offset += bytes_read) {
+        bytes_read = reader.ReadAt(file_name, offset, buffer.data(), std::min<uint64_t>(end - offset, buffer.size()));
+        WriteCounted(output_stream, buffer.data(), bytes_read);
+
+        if (bytes_read == 0) {
+            break;
+        }
+    }
+
+    output_stream.flush();
+}
+
+void Archiver::DecodeToStream(const ArchiveDirectory& directory, const std::unordered_set<std::string>& files, std::ostream& output_stream) {
+    PositionalFile archive(archive_path_, O_RDONLY);
+    Manipulator payload(directory.Format().code_rate);
+
+    // Members follow each other in archive order. Nothing can be asked here,
+    // damage is only reported.
+    for (const ArchiveMember& member: directory.Members()) {
+        if (member.deleted || (!files.empty() && files.find(member.header.file_name) == files.end())) {
+            continue;
+        }
+
+        ChunkPipeline pipeline(threads_);
+        std::vector<Frame> frames;
+        std::vector<ExtractTask> tasks;
+        CodecStats stats;
+        std::mutex stats_mutex;
+        bool cut = false; // the member ends where a truncated archive lost its data
+
+        if (HasFrames(member.header)) {
+            frames = ReadFrames(archive, member, payload, stats);
+        }
+
+        AddExtractTasks(tasks, 0, member, frames, payload, kBufferSize);
+
+        pipeline.Run(
+            [&](Chunk& chunk) {
+                return ReadTask(archive, tasks, chunk);
+            },
+            [&](Chunk& chunk) {
+                const ExtractTask& task = tasks[chunk.source];
+
+                size_t decoded;
+
+                chunk.output.resize(task.length);
+                CodecStats chunk_stats = DecodeTask(task, member, payload, chunk.input.data(), chunk.input.size(), chunk.output.data(),
+                                                    restore_, chunk.frame, decoded);
+                std::lock_guard<std::mutex> lock(stats_mutex);
+
+                chunk.output.resize(decoded);
+                stats.damaged += chunk_stats.damaged;
+            },
+            [&](Chunk& chunk) {
+                if (cut) {
+                    return;
+                }
+
+                WriteCounted(output_stream, chunk.output.data(), chunk.output.size());
+                cut = chunk.output.size() < tasks[chunk.source].length;
+            }
+        );
+
+        // Written already, the policy only decides whether to go on.
+        on_damage_.Check(stats, member.header.file_name);
+    }
+
+    output_stream.flush();
+}
+
+std::vector<uint32_t> Archiver::EncodeMapped(const std::filesystem::path& file_path, uint64_t data_offset, uint64_t file_size,
+                                             const Manipulator& payload) {
+    PositionalFile input(file_path, O_RDONLY);
+    PositionalFile archive(archive_path_, O_RDWR);
+
+    if (!input.IsOpen() || !archive.IsOpen() || !archive.Allocate(data_offset + payload.EncodedSize(file_size))) {
+        throw ArchiveError("Cannot write " + file_path.filename().string() + " into the archive.");
+    }
+
+    TaskPool pool(threads_);
+    size_t windows = (file_size + kMappedWindowSize - 1) / kMappedWindowSize;
+    std::vector<uint32_t> checksums(ChecksumCount(file_size));
+
+    pool.Run(windows, [&](size_t window, size_t) {
+        uint64_t offset = window * kMappedWindowSize;
+        size_t length = std::min<uint64_t>(file_size - offset, kMappedWindowSize);
+        MappedRegion source(input, offset, length, false);
+        MappedRegion target(archive, data_offset + payload.EncodedSize(offset), payload.EncodedSize(length), true);
+
+        if (!source.IsMapped() || !target.IsMapped()) {
+            throw ArchiveError("Cannot map " + file_path.filename().string() + " into memory.");
+        }
+
+        source.Advise(MADV_SEQUENTIAL);
+        payload.EncodeBlock(source.Data(), length, target.Data());
+
+        for (size_t done = 0; done < length; done += kChecksumChunkSize) {
+            checksums[(offset + done) / kChecksumChunkSize] = Crc32c(source.Data() + done, std::min(length - done, kChecksumChunkSize));
+        }
+    });
+
+    return checksums;
+}
+
+bool Archiver::DecodeMapped(const PositionalFile& archive, uint64_t encoded_offset, const std::filesystem::path& output_path,
+                            const std::string& file_name, uint64_t offset, uint64_t length, const Manipulator& payload,
+                            const uint32_t* checksums) {
+    PositionalFile output(output_path, O_RDWR);
+    MappedRegion source(archive, encoded_offset, payload.EncodedSize(length), false);
+    MappedRegion target(output, offset, length, true);
+
+    if (!source.IsMapped() || !target.IsMapped()) {
+        return false;
+    }
+
+    source.Advise(MADV_SEQUENTIAL);
+    source.Advise(MADV_WILLNEED);
+
+    on_damage_.Check(payload.DecodeBlock(source.Data(), length, target.Data(), restore_, checksums), file_name);
+
+    return true;
+}
+
+// Frames of a deduplicated member are not cut at checksum chunk
+// boundaries, a checksum may take several of them.
+void ExtendChecksums(std::vector<uint32_t>& checksums, uint64_t& offset, const char* data, size_t length) {
+    while (length > 0) {
+        size_t chunk_offset = offset % kChecksumChunkSize;
+        size_t piece = std::min(length, kChecksumChunkSize - chunk_offset);
+
+        if (chunk_offset == 0) {
+            checksums.push_back(Crc32c(data, piece));
+        } else {
+            checksums.back() = Crc32c(data, piece, checksums.back());
+        }
+
+        data += piece;
+        length -= piece;
+        offset += piece;
+    }
+}
+
+bool ReadTask(const PositionalFile& archive, const std::vector<ExtractTask>& tasks, Chunk& chunk) {
+    if (chunk.sequence == tasks.size()) {
+        return false;
+    }
+
+    const ExtractTask& task = tasks[chunk.sequence];
+
+    chunk.source = chunk.sequence;
+    chunk.input.resize(task.encoded_length);
+
+    chunk.input.resize(archive.ReadAt(chunk.input.data(), chunk.input.size(), task.encoded_offset));
+
+    return true;
+}
+
+std::vector<uint32_t> Archiver::RecodeData(const PositionalFile& input, std::ofstream& output_stream, const ArchiveMember& member,
+                                           const Manipulator& source, const Manipulator& target, bool expand) {
+    ChunkPipeline pipeline(threads_);
+    std::vector<Frame> frames;
+    std::vector<ExtractTask> tasks;
+    std::vector<uint32_t> recoded_checksums;
+    uint64_t recoded = 0;
+
+    if (expand) {
+        CodecStats stats;
+
+        frames = ReadFrames(input, member, source, stats);
+        on_damage_.Check(stats, member.header.file_name);
+    }
+
+    AddExtractTasks(tasks, 0, member, frames, source, kBufferSize);
+
+    pipeline.Run(
+        [&](Chunk& chunk) {
+            return ReadTask(input, tasks, chunk);
+        },
+        [&](Chunk& chunk) {
+            const ExtractTask& task = tasks[chunk.source];
+
+            size_t decoded;
+
+            chunk.output.resize(task.length);
+            on_damage_.Check(DecodeTask(task, member, source, chunk.input.data(), chunk.input.size(), chunk.output.data(), restore_,
+                                        chunk.frame, decoded), member.header.file_name);
+
+            // The recoded member keeps its size, so zeros stand in for data a
+            // truncated archive lost once the policy took the loss.
+            std::fill(chunk.output.begin() + decoded, chunk.output.end(), 0);
+            chunk.input.resize(target.EncodedSize(task.length));
+            target.EncodeBlock(chunk.output.data(), task.length, chunk.input.data());
+            chunk.input.swap(chunk.output);
+        },
+        [&](Chunk& chunk) {
+            WriteCounted(output_stream, chunk.output.data(), chunk.output.size());
+            ExtendChecksums(recoded_checksums, recoded, chunk.input.data(), chunk.input.size());
+        }
+    );
+
+    // Frames recoded as they are keep the checksums of their source bytes.
+    if (member.header.compressed && !expand) {
+        return member.checksums;
+    }
+
+    return recoded_checksums;
+}
+
+ScrubReport Archiver::Scrub() {
+    ArchiveDirectory directory = LoadDirectory(archive_path_);
+    PositionalFile archive(archive_path_, repair_ ? O_RDWR : O_RDONLY);
+    uint64_t archive_size = archive.Size();
+    std::vector<ScrubRegion> regions;
+
+    if (!archive.IsOpen()) {
+        throw ArchiveError("Cannot open " + archive_path_.filename().string() + ".");
+    }
+
+    // Every byte of the archive belongs to exactly one region.
+    if (directory.Format().version != 0) {
+        regions.push_back({"archive header", CodeRate::kHamming13_8, 0, kArchiveHeaderSize});
+    }
+
+    for (const ArchiveMember& member: directory.Members()) {
+        uint64_t data_length = EncodedSize(directory.Format().code_rate, StoredSize(member.header));
+
+        regions.push_back({"header of " + member.header.file_name, CodeRate::kHamming13_8,
+                           member.header_offset, member.data_offset - member.header_offset});
+        regions.push_back({member.header.file_name, directory.Format().code_rate, member.data_offset, data_length});
+    }
+
+    // Without a trailer the members were found by their headers. What
+    // follows them is the directory if it starts with its marker, otherwise
+    // members behind a header the scan could not get past: they are lost
+    // with the directory.
+    ArchiveDirectory trailer(directory.Format());
+    uint64_t tail = archive_size - std::min(archive_size, directory.DataEnd());
+    bool has_trailer = directory.Format().version == 0 || trailer.Load(archive_path_, manipulator_);
+    bool unreachable = !has_trailer && tail > 0 && !HasDirectoryMarker(archive, directory.DataEnd(), manipulator_);
+    uint64_t directory_codewords = directory.WrittenSize() / kHammingByte; // at least, members the scan missed have entries too
+
+    if (unreachable) {
+        regions.push_back({"unreachable members", directory.Format().code_rate, directory.DataEnd(), 0});
+    }
+
+    size_t directory_region = regions.size();
+
+    regions.push_back({"directory", CodeRate::kHamming13_8, directory.DataEnd(), unreachable ? 0 : tail});
+
+    // A truncated archive is checked as far as it goes, the codewords it
+    // lacks cannot be corrected.
+    std::vector<ScrubTask> tasks;
+    std::vector<ScrubFinding> lost;
+
+    for (size_t i = 0; i < regions.size(); ++i) {
+        ScrubRegion& region = regions[i];
+        uint64_t codeword_bytes = GetCodeParameters(region.code_rate).codeword_bytes;
+        uint64_t task_size = kScrubTaskSize / codeword_bytes * codeword_bytes;
+        uint64_t codewords = region.length / codeword_bytes;
+
+        region.length = std::min(region.length, archive_size - std::min(archive_size, region.offset));
+        region.length -= region.length % codeword_bytes;
+
+        if (region.length / codeword_bytes < codewords) {
+            lost.push_back({i, region.offset + region.length, false, codewords - region.length / codeword_bytes});
+        }
+
+        for (uint64_t offset = 0; offset < region.length; offset += task_size) {
+            tasks.push_back({i, offset, std::min(region.length - offset, task_size)});
+        }
+    }
+
+    const Manipulator codecs[] = {
+        Manipulator(CodeRate::kHamming13_8),
+        Manipulator(CodeRate::kSecded39_32),
+        Manipulator(CodeRate::kSecded72_64),
+    };
+    TaskPool pool(threads_);
+    std::vector<Chunk> buffers(pool.Threads());
+    std::vector<std::vector<ScrubFinding>> findings(tasks.size());
+
+    pool.Run(tasks.size(), [&](size_t task_index, size_t worker_index) {
+        const ScrubTask& task = tasks[task_index];
+        const ScrubRegion& region = regions[task.region];
+        const Manipulator& codec = codecs[static_cast<size_t>(region.code_rate)];
+        const CodeParameters& code = GetCodeParameters(region.code_rate);
+        Chunk& chunk = buffers[worker_index];
+        size_t codewords = task.length / code.codeword_bytes;
+
+        chunk.input.resize(task.length);
+        chunk.output.resize(codewords * code.data_bytes);
+
+        if (archive.ReadAt(chunk.input.data(), chunk.input.size(), region.offset + task.offset) != chunk.input.size()) {
+            throw ArchiveError("Cannot read " + archive_path_.filename().string() + ".");
+        }
+
+        CodecStats stats = codec.DecodeBlock(chunk.input.data(), chunk.output.size(), chunk.output.data());
+
+        if (stats.corrected == 0 && stats.damaged == 0) {
+            return;
+        }
+
+        // Rare: find the faulty codewords. They are already counted, so this
+        // goes straight to the kernels: runs of codewords in bulk, then the
+        // codewords of a faulty run one by one through the scalar kernels,
+        // which cost nothing to set up per call.
+        const CodecKernels& bulk = GetCodecKernels(region.code_rate);
+        const CodecKernels& single = region.code_rate == CodeRate::kHamming13_8 ? GetScalarKernels() : bulk;
+
+        for (size_t run = 0; run < codewords; run += kScrubProbeCodewords) {
+            size_t run_codewords = std::min(codewords - run, kScrubProbeCodewords);
+            CodecStats run_stats;
+
+            bulk.decode(reinterpret_cast<const uint8_t*>(chunk.input.data() + run * code.codeword_bytes), run_codewords * code.data_bytes,
+                        reinterpret_cast<uint8_t*>(chunk.output.data()), false, run_stats);
+
+            if (run_stats.corrected == 0 && run_stats.damaged == 0) {
+                continue;
+            }
+
+            for (size_t i = run; i < run + run_codewords; ++i) {
+                const char* codeword = chunk.input.data() + i * code.codeword_bytes;
+                uint64_t offset = region.offset + task.offset + i * code.codeword_bytes;
+                char data[sizeof(uint64_t)];
+                char fixed[sizeof(uint64_t) + 1];
+                CodecStats codeword_stats;
+
+                single.decode(reinterpret_cast<const uint8_t*>(codeword), code.data_bytes, reinterpret_cast<uint8_t*>(data), true,
+                              codeword_stats);
+
+                if (codeword_stats.corrected == 0 && codeword_stats.damaged == 0) {
+                    continue;
+                }
+
+                bool corrected = codeword_stats.damaged == 0;
+
+                findings[task_index].push_back({task.region, offset, corrected});
+
+                if (!corrected || !repair_) {
+                    continue;
+                }
+
+                codec.EncodeBlock(data, code.data_bytes, fixed);
+
+                if (!archive.WriteAt(fixed, code.codeword_bytes, offset)) {
+                    throw ArchiveError("Cannot write into " + archive_path_.filename().string() + ".");
+                }
+            }
+        }
+    });
+
+    // An archive with a header always ends with its directory. One that
+    // cannot be loaded lacks the codewords the directory of the members
+    // found would take, at least one if damaged codewords do not explain it.
+    bool directory_damaged = std::any_of(findings.begin(), findings.end(), [&](const std::vector<ScrubFinding>& task_findings) {
+        return std::any_of(task_findings.begin(), task_findings.end(), [&](const ScrubFinding& finding) {
+            return finding.region == directory_region && !finding.corrected;
+        });
+    });
+
+    if (unreachable) {
+        uint64_t codeword_bytes = GetCodeParameters(directory.Format().code_rate).codeword_bytes;
+
+        lost.push_back({directory_region - 1, directory.DataEnd(), false, (tail + codeword_bytes - 1) / codeword_bytes});
+        lost.push_back({directory_region, archive_size, false, directory_codewords});
+    } else if (!has_trailer) {
+        uint64_t present = regions[directory_region].length / kHammingByte;
+
+        if (present < directory_codewords) {
+            lost.push_back({directory_region, archive_size, false, directory_codewords - present});
+        } else if (!directory_damaged) {
+            lost.push_back({directory_region, archive_size, false, 1});
+        }
+    }
+
+    findings.push_back(std::move(lost));
+
+    ScrubReport report;
+
+    report.archive_size = archive_size;
+
+    for (const std::vector<ScrubFinding>& task_findings: findings) {
+        for (const ScrubFinding& finding: task_findings) {
+            report.damage.push_back({regions[finding.region].name, finding.offset, finding.lost != 0 ? finding.lost : 1,
+                                     finding.corrected, finding.lost != 0});
+            report.corrected += finding.corrected;
+            report.uncorrectable += finding.lost != 0 ? finding.lost : !finding.corrected;
+        }
+    }
+
+    // Tasks run in archive order, but the codewords a truncated archive lacks
+    // are found apart from them.
+    std::stable_sort(report.damage.begin(), report.damage.end(), [](const ScrubDamage& first, const ScrubDamage& second) {
+        return first.offset < second.offset;
+    });
+    report.repaired = repair_ && report.corrected != 0;
+
+    return report;
+}
+
+ArchiveListing Archiver::List() {
+    ArchiveDirectory directory = LoadDirectory(archive_path_);
+    ArchiveListing listing;
+
+    for (const ArchiveMember& member: directory.Members()) {
+        if (!member.deleted) {
+            listing.members.push_back(member.header);
+        }
+    }
+
+    listing.data_end = directory.DataEnd();
+    listing.dead_bytes = directory.DeadBytes();
+    listing.code_rate = directory.Format().code_rate;
+
+    return listing;
+}
+
+void Archiver::Delete(const std::unordered_set<std::string>& files) {
+    if (files.empty()) {
+        throw ArchiveError("No files provided. See --help for more information.");
+    }
+
+    if (!std::filesystem::exists(archive_path_)) {
+        throw ArchiveError("There is no such archive as " + archive_path_.filename().string() + ".");
+    }
+
+    ArchiveDirectory directory = LoadDirectory(archive_path_);
+    PositionalFile archive(archive_path_, O_RDWR);
+
+    // Only the flags and the directory are rewritten, the data stays in place
+    // until the archive is compacted.
+    for (const std::string& file_name: files) {
+        const ArchiveMember* member = directory.MarkDeleted(file_name);
+
+        if (member != nullptr) {
+            WriteTombstone(archive, *member);
+        }
+    }
+
+    std::ofstream stream = OpenForAppend(directory);
+
+    directory.Write(stream, manipulator_);
+    CheckWritten(stream);
+}
+
+void Archiver::WriteTombstone(PositionalFile& archive, const ArchiveMember& member) {
+    uint64_t name_length = NameLengthField(member.header, true);
+    char encoded[kHammingByte * sizeof(name_length)];
+
+    manipulator_.EncodeBlock(reinterpret_cast<const char*>(&name_length), sizeof(name_length), encoded);
+
+    if (!archive.WriteAt(encoded, sizeof(encoded), member.header_offset)) {
+        throw ArchiveError("Cannot write into " + archive_path_.filename().string() + ".");
+    }
+}
+
+bool Archiver::Compact() {
+    if (!std::filesystem::exists(archive_path_)) {
+        throw ArchiveError("There is no such archive as " + archive_path_.filename().string() + ".");
+    }
+
+    ArchiveDirectory directory = LoadDirectory(archive_path_);
+
+    if (directory.DeadBytes() == 0 || directory.DeadBytes() < compact_threshold_ * directory.DataEnd()) {
+        return false;
+    }
+
+    // The archive is rewritten next to the original, renaming the copy over
+    // it replaces it at once. Until then the original stays untouched.
+    std::filesystem::path new_archive = std::filesystem::path(archive_path_).concat(".tmp");
+    std::string archive_name = archive_path_.filename().string();
+
+    try {
+        std::filesystem::remove(new_archive);
+
+        // The rewritten archive keeps the format of the original one. Raw copies
+        // land at DataEnd() and the stream appends after them.
+        std::ofstream output_stream(new_archive, std::ios::binary | std::ios::app);
+        ArchiveDirectory new_directory(directory.Format());
+        ChunkIndex index;
+
+        new_directory.WriteHeader(output_stream, manipulator_);
+        CopyMembers(output_stream, new_archive, archive_path_, directory, new_directory, index);
+        new_directory.Write(output_stream, manipulator_);
+
+        output_stream.close();
+
+        if (!output_stream) {
+            throw ArchiveError("Cannot write the compacted copy of " + archive_name + ".");
+        }
+
+        std::filesystem::rename(new_archive, archive_path_);
+    } catch (const ArchiveError&) {
+        std::error_code ignored;
+
+        std::filesystem::remove(new_archive, ignored);
+
+        throw;
+    } catch (const std::filesystem::filesystem_error& error) {
+        std::error_code ignored;
+
+        std::filesystem::remove(new_archive, ignored);
+
+        throw ArchiveError("Cannot compact " + archive_name + ": " + error.code().message() + ".");
+    }
+
+    return true;
+}
+
+void Archiver::CopyMembers(std::ofstream& output_stream, const std::filesystem::path& output_path, const std::filesystem::path& path,
+                           const ArchiveDirectory& directory, ArchiveDirectory& merged_directory, ChunkIndex& index) {
+    PositionalFile input(path, O_RDONLY);
+    PositionalFile output(output_path, O_WRONLY);
+    Manipulator source(directory.Format().code_rate);
+    Manipulator target(merged_directory.Format().code_rate);
+    bool same_code = directory.Format().code_rate == merged_directory.Format().code_rate;
+
+    if (!input.IsOpen() || !output.IsOpen()) {
+        throw ArchiveError("Cannot copy members of " + path.filename().string() + ".");
+    }
+
+    for (const ArchiveMember& member: directory.Members()) {
+        HAFInfo appending_file = member.header;
+
+        if (member.deleted) {
+            continue;
+        }
+
+        if (merged_directory.Find(appending_file.file_name) != nullptr) {
+            std::filesystem::path temp_path(appending_file.file_name);
+
+            for (uint32_t copy_number = 1;; ++copy_number) {
+                std::string temp_file_name = MakeName(temp_path, copy_number);
+
+                if (merged_directory.Find(temp_file_name) == nullptr) {
+                    appending_file.file_name = temp_file_name;
+                    appending_file.file_name_length = temp_file_name.size();
+                    
+                    break;
+                }
+            }
+        }
+
+        // Encoded bytes are copied as they are: errors in them stay
+        // correctable by the same code. Only a renamed member gets a new
+        // header and only a change of code needs the data decoded. An
+        // archive that cannot hold compressed, deduplicated or sparse members
+        // gets them expanded, as does a deduplicated member whose recipe is lost.
+        std::vector<ChunkRef> chunks;
+        CodecStats recipe_stats;
+        bool relocate = member.header.deduplicated && merged_directory.Format().HasDedup()
+            && (!member.header.sparse || merged_directory.Format().HasSparse())
+            && ReadRecipe(input, member, source, chunks, recipe_stats) && recipe_stats.damaged == 0;
+        // Metadata the archive cannot keep is dropped, the member gets a new
+        // header like a renamed one.
+        appending_file.metadata = member.header.metadata && merged_directory.Format().HasMetadata();
+
+        bool renamed = appending_file.file_name != member.header.file_name || appending_file.metadata != member.header.metadata;
+        bool expand = (member.header.compressed && !merged_directory.Format().HasCompression()) || (member.header.deduplicated && !relocate);
+        uint64_t copy_from = renamed ? member.data_offset : member.header_offset;
+        bool copied = true;
+        std::vector<uint32_t> checksums = member.checksums;
+
+        if (relocate) {
+            CopyChunks(input, output, output_stream, chunks, appending_file, source, target, merged_directory, index);
+
+            continue;
+        }
+
+        if (expand) {
+            appending_file.compressed = false;
+            appending_file.deduplicated = false;
+            appending_file.sparse = false;
+            appending_file.stored_size = 0;
+        }
+
+        if (renamed || !same_code || expand) {
+            WriteFileInfo(output_stream, appending_file);
+        }
+
+        output_stream.flush();
+
+        if (same_code && !expand) {
+            uint64_t copy_to = merged_directory.DataEnd() + (renamed ? EncodedHeaderSize(appending_file) : 0);
+            uint64_t length = member.data_offset + source.EncodedSize(StoredSize(member.header)) - copy_from;
+            uint64_t input_size = input.Size();
+
+            // Zero codewords stand in for those a truncated archive lost,
+            // once the policy took the loss.
+            on_damage_.Check(source.LostCodewords(StoredSize(member.header), input_size - std::min(input_size, member.data_offset)),
+                 appending_file.file_name);
+            copied = CopyRange(input, copy_from, output, copy_to, length);
+        } else {
+            checksums = RecodeData(input, output_stream, member, source, target, expand);
+        }
+
+        if (!copied || !output_stream) {
+            throw ArchiveError("Cannot write " + appending_file.file_name + " into " + output_path.filename().string() + ".");
+        }
+
+        merged_directory.Add(appending_file, false, std::move(checksums));
+    }
+}
+
+void Archiver::CopyChunks(const PositionalFile& input, PositionalFile& output, std::ofstream& output_stream,
+                          const std::vector<ChunkRef>& chunks, HAFInfo header, const Manipulator& source, const Manipulator& target,
+                          ArchiveDirectory& merged_directory, ChunkIndex& index) {
+    std::vector<ChunkRef> recipe;
+    std::vector<char> encoded;
+    std::vector<char> frame;
+    uint64_t input_size = input.Size();
+
+    header.stored_size = kUnknownSize;
+    WriteFileInfo(output_stream, header);
+    header.stored_size = 0;
+    merged_directory.Add(header);
+    output_stream.flush();
+
+    for (const ChunkRef& chunk: chunks) {
+        if (IsHole(chunk)) {
+            recipe.push_back(chunk);
+
+            continue;
+        }
+
+        std::optional<size_t> found = index.Find(chunk.hash, chunk.source_length);
+
+        if (found.has_value() && index[*found].checksum == chunk.checksum) {
+            recipe.push_back(index[*found]);
+
+            continue;
+        }
+
+        ChunkRef copied = chunk;
+        uint64_t length = FrameSize(chunk.stored_length);
+        bool written;
+
+        copied.position = merged_directory.DataEnd();
+
+        // Zero codewords stand in for those a truncated archive lost, once
+        // the policy took the loss.
+        on_damage_.Check(source.LostCodewords(length, input_size - std::min(input_size, chunk.position)), header.file_name);
+
+        if (source.Rate() == target.Rate()) {
+            written = CopyRange(input, chunk.position, output, copied.position, source.EncodedSize(length));
+        } else {
+            encoded.resize(source.EncodedSize(length));
+            frame.resize(length);
+
+            size_t bytes_read = input.ReadAt(encoded.data(), encoded.size(), chunk.position);
+
+            std::fill(encoded.begin() + bytes_read, encoded.end(), 0);
+            on_damage_.Check(source.DecodeBlock(encoded.data(), length, frame.data(), restore_), header.file_name);
+
+            encoded.resize(target.EncodedSize(length));
+            target.EncodeBlock(frame.data(), length, encoded.data());
+            written = output.WriteAt(encoded.data(), encoded.size(), copied.position);
+        }
+
+        if (!written) {
+            throw ArchiveError("Cannot write " + header.file_name + " into the archive.");
+        }
+
+        merged_directory.AddStored(length);
+        recipe.push_back(copied);
+
+        if (!found.has_value()) {
+            index.Add(copied);
+        }
+    }
+
+    std::vector<char> bytes = MakeRecipe(recipe);
+
+    encoded.resize(target.EncodedSize(bytes.size()));
+    target.EncodeBlock(bytes.data(), bytes.size(), encoded.data());
+
+    if (!output.WriteAt(encoded.data(), encoded.size(), merged_directory.DataEnd())) {
+        throw ArchiveError("Cannot write " + header.file_name + " into the archive.");
+    }
+
+    merged_directory.AddStored(bytes.size());
+    RewriteFileInfo(output, merged_directory.Members().back());
+}
+
+HafReader Archiver::OpenReader() {
+    return HafReader(archive_path_, LoadDirectory(archive_path_), restore_, on_damage_.Policy());
+}
+
+void Archiver::Merge(std::vector<std::filesystem::path> archives) {
+    if (archive_path_.empty()) {
+        throw ArchiveError("No merge archive provided. Merging was not done.");
+    }
+
+    if (archives.empty()) {
+        throw ArchiveError("No archives to merge provided. See --help for more information.");
+    }
+
+    for (std::filesystem::path& archive: archives) {
+        NormalizeArchivePath(archive);
+
+        if (!std::filesystem::exists(archive)) {
+            throw ArchiveError("There is no such archive as " + archive.filename().string() + ".");
+        }
+    }
+
+    // Members already stored in the target archive are kept, merged ones go
+    // in place of its directory. A new target takes the format of the first archive.
+    ArchiveFormat first_format = LoadDirectory(archives.front()).Format();
+    ArchiveDirectory merged_directory = LoadDirectory(archive_path_, first_format);
+    std::ofstream output_stream = OpenForAppend(merged_directory);
+    ChunkIndex index;
+
+    // Merged members refer to the chunks the target has already.
+    if (merged_directory.Format().HasDedup()) {
+        index.Load(PositionalFile(archive_path_, O_RDONLY), merged_directory);
+    }
+
+    for (const std::filesystem::path& archive: archives) {
+        CopyMembers(output_stream, archive_path_, archive, LoadDirectory(archive), merged_directory, index);
+    }
 
-    WriteArchive(output_stream, archive_1, merged_files);
-    WriteArchive(output_stream, archive_2, merged_files);
+    merged_directory.Write(output_stream, manipulator_);
+    CheckWritten(output_stream);
 }
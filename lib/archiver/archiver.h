@@ -1,28 +1,204 @@
 #pragma once
 
+#include "compression.h"
+#include "dedup.h"
+#include "directory.h"
+#include "io/async_io.h"
+#include "io/mapped_region.h"
+#include "io/positional_file.h"
+#include "pipeline/pipeline.h"
+#include "pipeline/task_pool.h"
+#include "policy.h"
+#include "reader.h"
+#include "stats/stats.h"
 #include "tools/tools.h"
 #include "../filemaker/filemaker.h"
 
 #include <filesystem>
+#include <optional>
+#include <string>
 #include <unordered_set>
+#include <vector>
+
+struct ByteRange {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+// What List() finds in an archive.
+struct ArchiveListing {
+    std::vector<HAFInfo> members; // live ones, in archive order
+    uint64_t data_end = 0; // where member data ends, deleted members included
+    uint64_t dead_bytes = 0; // taken by deleted members until Compact()
+    CodeRate code_rate = CodeRate::kHamming13_8;
+};
+
+// A codeword Scrub() found damaged, or a run of them a truncated archive lacks.
+struct ScrubDamage {
+    std::string region; // "archive header", "header of NAME", NAME (its data), "unreachable members" or "directory"
+    uint64_t offset = 0;
+    uint64_t codewords = 1;
+    bool corrected = false;
+    bool missing = false; // the archive ends before these codewords
+};
+
+struct ScrubReport {
+    uint64_t archive_size = 0;
+    uint64_t corrected = 0;
+    uint64_t uncorrectable = 0; // missing codewords included
+    bool repaired = false; // corrected codewords were written back
+    std::vector<ScrubDamage> damage; // in archive order
+};
+
+struct ArchiverOptions {
+    bool restore = true;
+    size_t threads = 1;
+    IoBackend io_backend = IoBackend::kAuto;
+    // Payload code of new archives, existing ones keep their own.
+    std::optional<CodeRate> code_rate;
+    // Share of deleted bytes that makes Compact() rewrite the archive.
+    double compact_threshold = 0.25;
+    // Extracted members go to stdout one after another.
+    bool to_stdout = false;
+    // Member name of data appended from stdin ("-").
+    std::string stdin_name = "stdin";
+    // Scrub writes corrected codewords back into the archive.
+    bool repair = false;
+    // New archives keep a checksum of every chunk of member data, so clean
+    // chunks are extracted without decoding.
+    bool checksums = false;
+    // New archives compress member data before it is encoded. Members that
+    // do not compress are stored as they are. Implies checksums.
+    bool compress = false;
+    // New archives store every chunk of member data once, members that
+    // repeat chunks of earlier ones refer to them. Applies to files added by
+    // Create(), Append() and Merge(), not to stdin or HafWriter. Implies
+    // compression.
+    bool dedup = false;
+    // New archives leave holes and runs of zeros of files out, extraction
+    // recreates them as holes. Implies deduplication.
+    bool sparse = false;
+    // Files added to archives with metadata get an XXH64 of their contents,
+    // so Update() tells a file that was only touched from a changed one.
+    bool content_hash = false;
+    // Extract writes only this range of one member to its stream.
+    std::optional<ByteRange> range;
+    // Extraction reads and writes past the page cache (O_DIRECT) where the
+    // file systems allow it, through the async backend.
+    bool direct = false;
+    // Nothing is ever asked interactively, these decide instead.
+    ExistingPolicy on_existing;
+    DamagePolicy on_damage;
+    WarningPolicy on_warning;
+};
+
+struct ExtractTask;
+
+// A file to be archived and the header it gets.
+struct ArchiveInput {
+    std::filesystem::path path;
+    HAFInfo header;
+};
 
 class Archiver {
 public:
-    Archiver(const std::filesystem::path& _archive_path, bool _restore = true);
+    Archiver(const std::filesystem::path& _archive_path, const ArchiverOptions& _options = {});
+
+    // The archive, with the extension it gets when none was given.
+    const std::filesystem::path& Path() const;
 
-    void Create();
-    void Append(const std::filesystem::path& file_path);
+    // Files and whole directory trees; "-" is stdin.
+    void Create(const std::vector<std::filesystem::path>& paths = {});
+    void Append(const std::vector<std::filesystem::path>& paths);
+    // Appends the files that are new or changed since they were archived,
+    // the members they replace and those of files gone from the trees given
+    // are deleted. A new archive keeps the metadata this needs; members
+    // without it are compared with their files by contents.
+    void Update(const std::vector<std::filesystem::path>& paths);
     void Extract(const std::unordered_set<std::string>& files = {});
-    void ShowData();
+    // Members (or the range of one) one after another into `stream`.
+    void Extract(const std::unordered_set<std::string>& files, std::ostream& stream);
+    ArchiveListing List();
     void Delete(const std::unordered_set<std::string>& files);
-    void Merge(std::filesystem::path& archive_1, std::filesystem::path& archive_2);
+    // Returns false, leaving the archive as it is, if deleted members take
+    // less than the compact threshold of its data.
+    bool Compact();
+    // Checks every codeword of the archive without asking anything.
+    ScrubReport Scrub();
+    // Appends the live members of `archives`, in order, to the archive.
+    void Merge(std::vector<std::filesystem::path> archives);
+    // Random access to the members of the archive.
+    HafReader OpenReader();
 private:
     std::filesystem::path archive_path_;
     Manipulator manipulator_;
     bool restore_;
+    size_t threads_;
+    IoBackend io_backend_;
+    std::optional<CodeRate> code_rate_;
+    double compact_threshold_;
+    bool to_stdout_;
+    std::string stdin_name_;
+    bool repair_;
+    bool checksums_;
+    bool compress_;
+    bool dedup_;
+    bool sparse_;
+    bool content_hash_;
+    std::optional<ByteRange> range_;
+    ExistingPolicy on_existing_;
+    DamageHandler on_damage_;
+    WarningPolicy on_warning_;
+    bool direct_;
 
-    bool CheckOnAvailability(const std::filesystem::path& archive_path, const std::string& file_name);
-    void ReadFileInfo(std::ifstream& stream, HAFInfo& header);
-    void WriteFileInfo(std::ofstream& stream, const HAFInfo& header);
-    void WriteArchive(std::ofstream& output_stream, const std::filesystem::path& path, std::unordered_set<std::string>& merged_files);
+    // Options override `defaults`, the format a new archive would otherwise get.
+    ArchiveFormat NewArchiveFormat(const ArchiveFormat& defaults = {}) const;
+    ArchiveDirectory LoadDirectory(const std::filesystem::path& path, const ArchiveFormat& defaults = {});
+    std::ofstream OpenForAppend(const ArchiveDirectory& directory);
+    bool ReadFileInfo(std::ifstream& stream, HAFInfo& header, bool& deleted);
+    void WriteFileInfo(std::ostream& stream, const HAFInfo& header);
+    // Writes the header of `member` again, once its sizes are known.
+    void RewriteFileInfo(PositionalFile& archive, const ArchiveMember& member);
+    std::vector<ArchiveInput> CollectInputs(const std::vector<std::filesystem::path>& paths);
+    HAFInfo MakeHeader(const std::filesystem::path& file_path, const std::string& file_name);
+    bool UseMappedEncoding(const ArchiveInput& input, const ArchiveFormat& format) const;
+    // A piped archive may have compression only for the frames of streamed
+    // members, its members are compressed if the options ask for it.
+    bool UseCompression(const ArchiveFormat& format) const;
+    void WriteMembers(std::ostream& stream, ArchiveDirectory& directory, const std::vector<ArchiveInput>& inputs);
+    // Flushes what was written into the archive, throws if any of it failed.
+    void CheckWritten(std::ostream& stream) const;
+    void EncodeFiles(std::ostream& stream, ArchiveDirectory& directory, const std::vector<ArchiveInput>& inputs,
+                     size_t begin, size_t end, const Manipulator& payload, ChunkIndex& index);
+    void WriteTombstone(PositionalFile& archive, const ArchiveMember& member);
+    // Writes the header as well: whether the member is compressed depends on
+    // its data. A `framed` member is written as frames whatever its data,
+    // its header is never rewritten (see compression.h).
+    void EncodeStream(std::istream& input_stream, std::ostream& output_stream, const Manipulator& payload, bool compress,
+                      bool framed, HAFInfo& header, std::vector<uint32_t>& checksums);
+    // Both decode members[i] into outputs[i] and lower `data_ends` (where
+    // the data of each member ends) to the first byte a truncated archive lost.
+    void ExtractTasks(const PositionalFile& archive, const std::vector<ArchiveMember>& members, const std::vector<ExtractTask>& tasks,
+                      const std::vector<std::filesystem::path>& outputs, const Manipulator& payload, bool mapped,
+                      std::vector<uint64_t>& data_ends);
+    void ExtractAsync(const std::vector<ArchiveMember>& members, const std::vector<ExtractTask>& tasks,
+                      const std::vector<std::filesystem::path>& outputs, const Manipulator& payload, std::vector<uint64_t>& data_ends);
+    void ExtractRange(const std::unordered_set<std::string>& files, std::ostream& output_stream);
+    void DecodeToStream(const ArchiveDirectory& directory, const std::unordered_set<std::string>& files, std::ostream& output_stream);
+    std::vector<uint32_t> EncodeMapped(const std::filesystem::path& file_path, uint64_t data_offset, uint64_t file_size,
+                                       const Manipulator& payload);
+    bool DecodeMapped(const PositionalFile& archive, uint64_t encoded_offset, const std::filesystem::path& output_path,
+                      const std::string& file_name, uint64_t offset, uint64_t length, const Manipulator& payload, const uint32_t* checksums);
+    // Returns the checksums of the recoded data. `expand` turns a compressed
+    // or deduplicated member into its source bytes, otherwise the frames of
+    // a compressed member are recoded as they are.
+    std::vector<uint32_t> RecodeData(const PositionalFile& input, std::ofstream& output_stream, const ArchiveMember& member,
+                                     const Manipulator& source, const Manipulator& target, bool expand);
+    // `index` holds the chunks of the target archive, deduplicated members
+    // are copied as references to them and only bring the chunks it lacks.
+    void CopyMembers(std::ofstream& output_stream, const std::filesystem::path& output_path, const std::filesystem::path& path,
+                     const ArchiveDirectory& directory, ArchiveDirectory& merged_directory, ChunkIndex& index);
+    void CopyChunks(const PositionalFile& input, PositionalFile& output, std::ofstream& output_stream, const std::vector<ChunkRef>& chunks,
+                    HAFInfo header, const Manipulator& source, const Manipulator& target, ArchiveDirectory& merged_directory,
+                    ChunkIndex& index);
 };
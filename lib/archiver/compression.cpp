@@ -0,0 +1,227 @@
+#include "compression.h"
+#include "dedup.h"
+#include "tools/lz.h"
+
+#include <algorithm>
+#include <cstring>
+
+const size_t kCompressionSample = 1 << 16; // 64 KiB, bytes tried before a member is compressed
+
+uint64_t AlignFrame(uint64_t length);
+std::vector<Frame> RecipeFrames(const PositionalSource& archive, const ArchiveMember& member, const Manipulator& payload, CodecStats& stats);
+
+uint64_t AlignFrame(uint64_t length) {
+    return (length + kFrameAlignment - 1) / kFrameAlignment * kFrameAlignment;
+}
+
+uint64_t FrameSize(uint32_t stored_length) {
+    return kFrameHeaderSize + AlignFrame(stored_length);
+}
+
+bool HasFrames(const HAFInfo& header) {
+    return header.compressed || header.deduplicated;
+}
+
+bool WorthCompressing(const char* data, size_t length) {
+    size_t sample = std::min(length, kCompressionSample);
+    std::vector<char> compressed(sample);
+
+    // Anything that does not save an eighth is not worth a decompression on every read.
+    return LzCompress(data, sample, compressed.data(), sample - sample / 8) != 0;
+}
+
+uint32_t MakeFrame(const char* data, size_t length, std::vector<char>& frame, bool compress) {
+    frame.resize(kFrameHeaderSize + AlignFrame(length));
+
+    // Only a shorter result is kept.
+    uint32_t source_length = length;
+    uint32_t stored_length = compress && length > 1 ? LzCompress(data, length, frame.data() + kFrameHeaderSize, length - 1) : 0;
+
+    if (stored_length == 0) {
+        memcpy(frame.data() + kFrameHeaderSize, data, length);
+        stored_length = length;
+    }
+
+    memcpy(frame.data(), &source_length, sizeof(source_length));
+    memcpy(frame.data() + sizeof(source_length), &stored_length, sizeof(stored_length));
+    frame.resize(FrameSize(stored_length));
+    std::fill(frame.begin() + kFrameHeaderSize + stored_length, frame.end(), 0);
+
+    return stored_length;
+}
+
+uint32_t StoredLength(const std::vector<char>& frame) {
+    uint32_t stored_length;
+
+    memcpy(&stored_length, frame.data() + sizeof(uint32_t), sizeof(stored_length));
+
+    return stored_length;
+}
+
+std::vector<Frame> ReadFrames(const PositionalSource& archive, const ArchiveMember& member, const Manipulator& payload, CodecStats& stats) {
+    if (member.header.deduplicated) {
+        return RecipeFrames(archive, member, payload, stats);
+    }
+
+    std::vector<Frame> frames;
+    std::vector<char> encoded(payload.EncodedSize(kFrameHeaderSize));
+    char header[kFrameHeaderSize];
+    uint64_t file_size = member.header.file_size;
+    uint64_t offset = 0;
+    bool lost = false;
+
+    for (uint64_t source_offset = 0; source_offset < file_size; source_offset += kChecksumChunkSize) {
+        Frame frame;
+
+        frame.source_offset = source_offset;
+        frame.source_length = std::min<uint64_t>(file_size - source_offset, kChecksumChunkSize);
+
+        if (!lost) {
+            size_t bytes_read = archive.ReadAt(encoded.data(), encoded.size(), member.data_offset + payload.EncodedSize(offset));
+            uint32_t source_length;
+            uint32_t stored_length;
+
+            // A truncated archive reads as zeros, which no frame header is.
+            std::fill(encoded.begin() + bytes_read, encoded.end(), 0);
+
+            CodecStats header_stats = payload.DecodeBlock(encoded.data(), kFrameHeaderSize, header);
+
+            memcpy(&source_length, header, sizeof(source_length));
+            memcpy(&stored_length, header + sizeof(source_length), sizeof(stored_length));
+
+            stats.corrected += header_stats.corrected;
+            stats.damaged += header_stats.damaged;
+            lost = source_length != frame.source_length || stored_length == 0 || stored_length > source_length
+                || offset + FrameSize(stored_length) > member.header.stored_size;
+
+            if (lost) {
+                ++stats.damaged;
+            } else {
+                const uint32_t* checksum = FindChecksums(member, source_offset);
+
+                frame.position = member.data_offset + payload.EncodedSize(offset + kFrameHeaderSize);
+                frame.stored_length = stored_length;
+                frame.checksum = checksum == nullptr ? std::nullopt : std::optional<uint32_t>(*checksum);
+                offset += FrameSize(stored_length);
+            }
+        }
+
+        frames.push_back(frame);
+    }
+
+    return frames;
+}
+
+bool MeasureFrames(const PositionalSource& archive, uint64_t data_offset, const Manipulator& payload, HAFInfo& header) {
+    std::vector<char> encoded(payload.EncodedSize(kFrameHeaderSize));
+    char frame_header[kFrameHeaderSize];
+    bool sized = header.file_size != kUnknownSize;
+    uint64_t archive_size = archive.Size();
+    uint64_t file_size = 0;
+    uint64_t offset = 0;
+
+    while (!sized || file_size < header.file_size) {
+        size_t bytes_read = archive.ReadAt(encoded.data(), encoded.size(), data_offset + payload.EncodedSize(offset));
+        uint32_t source_length;
+        uint32_t stored_length;
+
+        if (bytes_read < encoded.size() || payload.DecodeBlock(encoded.data(), kFrameHeaderSize, frame_header).damaged > 0) {
+            break;
+        }
+
+        memcpy(&source_length, frame_header, sizeof(source_length));
+        memcpy(&stored_length, frame_header + sizeof(source_length), sizeof(stored_length));
+
+        if (!sized && source_length == 0 && stored_length == 0) {
+            header.file_size = file_size;
+            header.stored_size = offset + kFrameHeaderSize;
+
+            return true;
+        }
+
+        // Only whole frames count, a frame is decoded whole or not at all.
+        if (source_length == 0 || source_length > kChecksumChunkSize || stored_length == 0 || stored_length > source_length
+            || data_offset + payload.EncodedSize(offset + FrameSize(stored_length)) > archive_size) {
+            break;
+        }
+
+        file_size += source_length;
+        offset += FrameSize(stored_length);
+    }
+
+    header.stored_size = offset;
+
+    if (sized) {
+        return file_size == header.file_size;
+    }
+
+    header.file_size = file_size + 1;
+
+    return false;
+}
+
+// Frames of a deduplicated member may be anywhere before its recipe. A
+// recipe that cannot be read loses the whole member.
+std::vector<Frame> RecipeFrames(const PositionalSource& archive, const ArchiveMember& member, const Manipulator& payload, CodecStats& stats) {
+    std::vector<Frame> frames;
+    std::vector<ChunkRef> chunks;
+    uint64_t file_size = member.header.file_size;
+    uint64_t source_offset = 0;
+
+    if (!ReadRecipe(archive, member, payload, chunks, stats)) {
+        for (; source_offset < file_size; source_offset += kChecksumChunkSize) {
+            Frame frame;
+
+            frame.source_offset = source_offset;
+            frame.source_length = std::min<uint64_t>(file_size - source_offset, kChecksumChunkSize);
+            frames.push_back(frame);
+        }
+
+        ++stats.damaged;
+
+        return frames;
+    }
+
+    for (const ChunkRef& chunk: chunks) {
+        Frame frame;
+
+        frame.source_offset = source_offset;
+        frame.position = chunk.position + payload.EncodedSize(kFrameHeaderSize);
+        frame.source_length = chunk.source_length;
+        frame.stored_length = chunk.stored_length;
+        frame.checksum = chunk.checksum;
+        frame.hole = IsHole(chunk);
+        frames.push_back(frame);
+        source_offset += chunk.source_length;
+    }
+
+    return frames;
+}
+
+CodecStats DecodeFrame(const Manipulator& payload, const Frame& frame, const char* encoded, char* output, bool restore,
+                       std::vector<char>& scratch) {
+    CodecStats stats;
+
+    if (frame.stored_length == 0) {
+        std::fill(output, output + frame.source_length, 0);
+
+        return stats;
+    }
+
+    // A frame stored as it is keeps the checksum shortcut.
+    if (frame.stored_length == frame.source_length) {
+        return payload.DecodeBlock(encoded, frame.source_length, output, restore, frame.checksum ? &*frame.checksum : nullptr);
+    }
+
+    scratch.resize(frame.stored_length);
+    stats = payload.DecodeBlock(encoded, frame.stored_length, scratch.data(), restore);
+
+    if (!LzDecompress(scratch.data(), scratch.size(), output, frame.source_length)) {
+        std::fill(output, output + frame.source_length, 0);
+        ++stats.damaged;
+    } else if (frame.checksum && Crc32c(output, frame.source_length) != *frame.checksum) {
+        ++stats.damaged;
+    }
+
+    return stats;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "directory.h"
+#include "io/positional_source.h"
+#include "tools/tools.h"
+
+#include <cinttypes>
+#include <optional>
+#include <vector>
+
+// The data of a compressed member is a run of frames, one per
+// kChecksumChunkSize source bytes (the last one may be shorter):
+//
+//     frame: source length (u32), stored length (u32), stored bytes, zeros up to kFrameAlignment
+//
+// The stored bytes are the LZ-compressed source bytes (tools/lz.h), or the
+// source bytes themselves where compression would not make them shorter.
+// Frames go through the payload code like any other member data and start
+// on codeword boundaries, so each of them can be decoded on its own.
+//
+// A member streamed where its header cannot be rewritten (a pipe) has no
+// sizes there. It is written as frames, compressed or not, and ends with an
+// empty frame header (both lengths 0), so the frames tell where it ends.
+
+const size_t kFrameHeaderSize = 2 * sizeof(uint32_t);
+const size_t kFrameAlignment = 8; // data bytes of the largest codeword
+
+struct Frame {
+    uint64_t source_offset = 0;
+    uint64_t position = 0; // of the stored bytes, encoded bytes from the start of the archive
+    uint32_t source_length = 0;
+    uint32_t stored_length = 0; // 0 if the frame was lost to damage, it reads as zeros
+    std::optional<uint32_t> checksum; // CRC32C of the source bytes
+    bool hole = false; // zeros of a sparse member (dedup.h), may be longer than any frame
+};
+
+// Members whose data is read frame by frame: compressed and deduplicated
+// (dedup.h) ones.
+bool HasFrames(const HAFInfo& header);
+// Guesses from the first bytes of a member whether compressing it pays off.
+bool WorthCompressing(const char* data, size_t length);
+// Builds the frame of `length` source bytes, at most kChecksumChunkSize,
+// stored as they are unless `compress`. Returns its stored length.
+uint32_t MakeFrame(const char* data, size_t length, std::vector<char>& frame, bool compress = true);
+// Stored length of a frame made by MakeFrame.
+uint32_t StoredLength(const std::vector<char>& frame);
+// Bytes taken by a frame with `stored_length` stored bytes.
+uint64_t FrameSize(uint32_t stored_length);
+
+// Walks the frame headers of a compressed member, or reads the recipe of a
+// deduplicated one. A header that cannot be right (damage the code could
+// not correct, a truncated archive) loses the frames from there on, this is
+// counted as damage in `stats`.
+std::vector<Frame> ReadFrames(const PositionalSource& archive, const ArchiveMember& member, const Manipulator& payload, CodecStats& stats);
+// Sizes a compressed member whose header does not know its stored size (or
+// both sizes) by walking its frames from `data_offset`. Returns false if
+// they run into damage or the end of the archive before the member ends:
+// it is then sized up to there, with a lost byte that makes the loss show
+// as damage when it is read.
+bool MeasureFrames(const PositionalSource& archive, uint64_t data_offset, const Manipulator& payload, HAFInfo& header);
+// `encoded` holds the stored bytes of `frame` encoded, `output` gets its
+// source bytes. Source bytes that do not match their checksum count as
+// damage. Safe to call from several threads with their own `scratch`.
+CodecStats DecodeFrame(const Manipulator& payload, const Frame& frame, const char* encoded, char* output, bool restore,
+                       std::vector<char>& scratch);
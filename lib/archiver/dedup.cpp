@@ -0,0 +1,227 @@
+#include "dedup.h"
+#include "compression.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+const size_t kGearWindow = 64; // bytes the fingerprint depends on
+const size_t kBoundaryBits = 16; // chunks are 64 KiB longer than kMinDedupChunk on average
+
+constexpr std::array<uint64_t, 256> MakeGearTable();
+CodecStats ReadStored(const PositionalSource& archive, const Manipulator& payload, uint64_t position, char* output, size_t length);
+
+// Random values of every byte, from splitmix64: the same in every build.
+constexpr std::array<uint64_t, 256> MakeGearTable() {
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0;
+
+    for (uint64_t& value: table) {
+        state += 0x9E3779B97F4A7C15;
+        value = state;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+        value ^= value >> 31;
+    }
+
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> kGearTable = MakeGearTable();
+
+size_t NextChunkLength(const char* data, size_t length) {
+    size_t limit = std::min(length, kMaxDedupChunk);
+    uint64_t fingerprint = 0;
+
+    if (limit <= kMinDedupChunk) {
+        return limit;
+    }
+
+    // Every byte shifts the fingerprint by one bit, so its top bits depend
+    // on the last kGearWindow bytes only. A boundary is where they are all
+    // zero, wherever in the member the bytes before it are.
+    for (size_t i = kMinDedupChunk - kGearWindow; i < limit; ++i) {
+        fingerprint = (fingerprint << 1) + kGearTable[static_cast<uint8_t>(data[i])];
+
+        if (i >= kMinDedupChunk && (fingerprint >> (64 - kBoundaryBits)) == 0) {
+            return i + 1;
+        }
+    }
+
+    return limit;
+}
+
+size_t ZeroRunLength(const char* data, size_t length) {
+    size_t zeros = 0;
+
+    for (uint64_t word; zeros + sizeof(word) <= length; zeros += sizeof(word)) {
+        memcpy(&word, data + zeros, sizeof(word));
+
+        if (word != 0) {
+            break;
+        }
+    }
+
+    while (zeros < length && data[zeros] == 0) {
+        ++zeros;
+    }
+
+    return zeros;
+}
+
+size_t FindZeroRun(const char* data, size_t length) {
+    size_t run_begin = 0;
+
+    // Word by word: a run starts at the first zero word after a nonzero one.
+    for (size_t i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+
+        memcpy(&word, data + i, sizeof(word));
+
+        if (word != 0) {
+            run_begin = i + sizeof(word);
+        } else if (i + sizeof(word) - run_begin >= kMinZeroRun) {
+            return run_begin;
+        }
+    }
+
+    return length;
+}
+
+bool IsHole(const ChunkRef& chunk) {
+    return chunk.stored_length == 0;
+}
+
+std::vector<char> MakeRecipe(const std::vector<ChunkRef>& chunks) {
+    std::vector<char> recipe(chunks.size() * kRecipeEntrySize + sizeof(uint64_t), 0);
+    char* cursor = recipe.data();
+    uint64_t count = chunks.size();
+
+    for (const ChunkRef& chunk: chunks) {
+        memcpy(cursor, &chunk.position, sizeof(chunk.position));
+        memcpy(cursor + 8, &chunk.source_length, sizeof(chunk.source_length));
+        memcpy(cursor + 12, &chunk.stored_length, sizeof(chunk.stored_length));
+        memcpy(cursor + 16, &chunk.checksum, sizeof(chunk.checksum));
+        memcpy(cursor + 24, &chunk.hash, sizeof(chunk.hash));
+        cursor += kRecipeEntrySize;
+    }
+
+    memcpy(cursor, &count, sizeof(count));
+
+    return recipe;
+}
+
+CodecStats ReadStored(const PositionalSource& archive, const Manipulator& payload, uint64_t position, char* output, size_t length) {
+    std::vector<char> encoded(payload.EncodedSize(length));
+    size_t bytes_read = archive.ReadAt(encoded.data(), encoded.size(), position);
+
+    // The codewords a truncated archive lacks are lost, zeros only keep the
+    // decoded bytes defined.
+    std::fill(encoded.begin() + bytes_read, encoded.end(), 0);
+
+    CodecStats stats = payload.DecodeBlock(encoded.data(), length, output);
+
+    stats.damaged += payload.LostCodewords(length, bytes_read).damaged;
+
+    return stats;
+}
+
+bool ReadRecipe(const PositionalSource& archive, const ArchiveMember& member, const Manipulator& payload, std::vector<ChunkRef>& chunks,
+                CodecStats& stats) {
+    uint64_t stored_size = member.header.stored_size;
+    uint64_t count;
+
+    if (stored_size < sizeof(count) || stored_size % sizeof(count) != 0) {
+        return false;
+    }
+
+    CodecStats count_stats = ReadStored(archive, payload, member.data_offset + payload.EncodedSize(stored_size - sizeof(count)),
+                                        reinterpret_cast<char*>(&count), sizeof(count));
+
+    stats.corrected += count_stats.corrected;
+    stats.damaged += count_stats.damaged;
+
+    if (count > (stored_size - sizeof(count)) / kRecipeEntrySize) {
+        return false;
+    }
+
+    uint64_t recipe_offset = stored_size - sizeof(count) - count * kRecipeEntrySize;
+    uint64_t frames_end = member.data_offset + payload.EncodedSize(recipe_offset);
+    std::vector<char> recipe(count * kRecipeEntrySize);
+    CodecStats recipe_stats = ReadStored(archive, payload, frames_end, recipe.data(), recipe.size());
+    uint64_t source_size = 0;
+
+    stats.corrected += recipe_stats.corrected;
+    stats.damaged += recipe_stats.damaged;
+    chunks.resize(count);
+
+    // Frames of a member come before its recipe, its own ones or those of
+    // the members before it.
+    for (uint64_t i = 0; i < count; ++i) {
+        const char* cursor = recipe.data() + i * kRecipeEntrySize;
+        ChunkRef& chunk = chunks[i];
+
+        memcpy(&chunk.position, cursor, sizeof(chunk.position));
+        memcpy(&chunk.source_length, cursor + 8, sizeof(chunk.source_length));
+        memcpy(&chunk.stored_length, cursor + 12, sizeof(chunk.stored_length));
+        memcpy(&chunk.checksum, cursor + 16, sizeof(chunk.checksum));
+        memcpy(&chunk.hash, cursor + 24, sizeof(chunk.hash));
+
+        if (IsHole(chunk)) {
+            if (!member.header.sparse || chunk.position != 0 || chunk.source_length == 0 || chunk.source_length > kMaxHoleLength) {
+                return false;
+            }
+        } else if (chunk.stored_length > chunk.source_length || chunk.source_length > kMaxDedupChunk
+                   || chunk.position < kArchiveHeaderSize || chunk.position > frames_end
+                   || frames_end - chunk.position < payload.EncodedSize(FrameSize(chunk.stored_length))) {
+            return false;
+        }
+
+        source_size += chunk.source_length;
+    }
+
+    return source_size == member.header.file_size;
+}
+
+std::optional<size_t> ChunkIndex::Find(uint64_t hash, uint32_t source_length) const {
+    auto it = by_hash_.find(hash);
+
+    if (it == by_hash_.end() || chunks_[it->second].source_length != source_length) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+size_t ChunkIndex::Add(const ChunkRef& chunk) {
+    size_t index = chunks_.size();
+
+    chunks_.push_back(chunk);
+    by_hash_.emplace(chunk.hash, index);
+
+    return index;
+}
+
+ChunkRef& ChunkIndex::operator[](size_t index) {
+    return chunks_[index];
+}
+
+void ChunkIndex::Load(const PositionalFile& archive, const ArchiveDirectory& directory) {
+    Manipulator payload(directory.Format().code_rate);
+
+    // A chunk of a damaged recipe could be anything, nothing refers to it.
+    for (const ArchiveMember& member: directory.Members()) {
+        std::vector<ChunkRef> chunks;
+        CodecStats stats;
+
+        if (!member.header.deduplicated || !ReadRecipe(archive, member, payload, chunks, stats) || stats.damaged != 0) {
+            continue;
+        }
+
+        for (const ChunkRef& chunk: chunks) {
+            if (!IsHole(chunk) && !Find(chunk.hash, chunk.source_length).has_value()) {
+                Add(chunk);
+            }
+        }
+    }
+}
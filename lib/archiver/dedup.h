@@ -0,0 +1,77 @@
+#pragma once
+
+#include "directory.h"
+#include "io/positional_file.h"
+#include "tools/tools.h"
+#include "tools/xxhash.h"
+
+#include <cinttypes>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// The data of a deduplicated member is cut into chunks at content-defined
+// boundaries, so an insertion only changes the chunks around it. Every
+// chunk is stored once in the archive, as a frame (compression.h) in the
+// data of the first member that has it. A member keeps the frames of its
+// new chunks and, behind them, its recipe: the chunks it is made of.
+//
+//     recipe: count * (frame position (u64), source length (u32), stored length (u32), checksum (u32), 0 (u32), hash (u64)), count (u64)
+//
+// Positions are in encoded bytes from the start of the archive, the
+// checksum is the CRC32C and the hash the XXH64 of the source bytes. The
+// count ends the data of the member, so it is found through the stored size.
+//
+// Recipes of sparse members also have holes: entries with no position and
+// no stored bytes, source length zeros long. Holes of the file itself are
+// never read, zero runs of at least kMinZeroRun bytes are cut out of the data.
+
+const size_t kMinDedupChunk = 1 << 14; // 16 KiB
+const size_t kMaxDedupChunk = 1 << 18; // 256 KiB
+const size_t kRecipeEntrySize = 32;
+const size_t kMinZeroRun = 1 << 16; // 64 KiB
+const uint32_t kMaxHoleLength = uint32_t(1) << 31; // of one recipe entry, longer holes take several
+
+struct ChunkRef {
+    uint64_t position = 0; // of the frame, encoded bytes from the start of the archive
+    uint32_t source_length = 0;
+    uint32_t stored_length = 0;
+    uint32_t checksum = 0;
+    uint64_t hash = 0;
+};
+
+// Zeros of a sparse member, nothing is stored for them.
+bool IsHole(const ChunkRef& chunk);
+
+// Length of the first chunk of `data`, at most kMaxDedupChunk. `data`
+// holds the rest of the member or at least kMaxDedupChunk bytes of it.
+size_t NextChunkLength(const char* data, size_t length);
+// Number of zero bytes `data` starts with.
+size_t ZeroRunLength(const char* data, size_t length);
+// Offset of the first run of at least kMinZeroRun zeros in `data`, `length`
+// if there is none.
+size_t FindZeroRun(const char* data, size_t length);
+// Stored bytes of a recipe: its entries and the count, a multiple of every
+// codeword's data size.
+std::vector<char> MakeRecipe(const std::vector<ChunkRef>& chunks);
+// Returns false if the recipe is damaged or does not add up to the member.
+bool ReadRecipe(const PositionalSource& archive, const ArchiveMember& member, const Manipulator& payload, std::vector<ChunkRef>& chunks,
+                CodecStats& stats);
+
+// Chunks stored in an archive, by their contents.
+class ChunkIndex {
+public:
+    // Returns the index of a chunk with this hash and length, if there is one.
+    std::optional<size_t> Find(uint64_t hash, uint32_t source_length) const;
+    // A chunk found under its hash is the first one added with it.
+    size_t Add(const ChunkRef& chunk);
+    ChunkRef& operator[](size_t index);
+
+    // Adds the chunks of every member of `directory` with a clean recipe.
+    // Deleted members count too: their data stays until the archive is
+    // compacted, and compaction copies the chunks live members refer to.
+    void Load(const PositionalFile& archive, const ArchiveDirectory& directory);
+private:
+    std::vector<ChunkRef> chunks_;
+    std::unordered_map<uint64_t, size_t> by_hash_;
+};
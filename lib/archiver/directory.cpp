@@ -0,0 +1,519 @@
+#include "directory.h"
+#include "io/positional_file.h"
+#include "stats/stats.h"
+
+#include <cstring>
+#include <fcntl.h>
+
+bool ReadEncoded(const PositionalSource& archive, const Manipulator& manipulator, uint64_t offset, std::vector<char>& decoded);
+void AppendValue(std::string& bytes, uint64_t value);
+bool TakeValue(const std::vector<char>& bytes, size_t& cursor, uint64_t& value);
+
+uint64_t NameLengthField(const HAFInfo& header, bool deleted) {
+    return header.file_name_length | (deleted ? kDeletedFlag : 0) | (header.compressed ? kCompressedFlag : 0)
+        | (header.deduplicated ? kDeduplicatedFlag : 0) | (header.sparse ? kSparseFlag : 0) | (header.metadata ? kMetadataFlag : 0);
+}
+
+bool TakeNameLengthField(uint64_t field, HAFInfo& header, bool& deleted) {
+    deleted = (field & kDeletedFlag) != 0;
+    header.compressed = (field & kCompressedFlag) != 0;
+    header.deduplicated = (field & kDeduplicatedFlag) != 0;
+    header.sparse = (field & kSparseFlag) != 0;
+    header.metadata = (field & kMetadataFlag) != 0;
+    header.file_name_length = field & ~(kDeletedFlag | kCompressedFlag | kDeduplicatedFlag | kSparseFlag | kMetadataFlag);
+
+    // The length comes from the archive: a damaged one must not make it
+    // allocate whatever it says. Only recipes have holes.
+    return header.file_name_length <= kMaxFileNameLength && !(header.compressed && header.deduplicated)
+        && (!header.sparse || header.deduplicated);
+}
+
+bool HasStoredSize(const HAFInfo& header) {
+    return header.compressed || header.deduplicated;
+}
+
+uint64_t StoredSize(const HAFInfo& header) {
+    return HasStoredSize(header) ? header.stored_size : header.file_size;
+}
+
+uint64_t EncodedHeaderSize(const HAFInfo& header) {
+    uint64_t fields = (HasStoredSize(header) ? 2 : 1) + (header.metadata ? kMetadataFields : 0);
+
+    return kHammingByte * (sizeof(header.file_name_length) + header.file_name_length + fields * sizeof(header.file_size));
+}
+
+void MakeMetadataFields(const HAFInfo& header, uint64_t* fields) {
+    fields[0] = header.modified;
+    fields[1] = header.mode | (header.content_hash ? kContentHashFlag : 0);
+    fields[2] = header.content_hash.value_or(0);
+}
+
+void TakeMetadataFields(const uint64_t* fields, HAFInfo& header) {
+    header.modified = fields[0];
+    header.mode = fields[1] & UINT32_MAX;
+    header.content_hash = (fields[1] & kContentHashFlag) != 0 ? std::optional<uint64_t>(fields[2]) : std::nullopt;
+}
+
+void WriteMemberHeader(std::ostream& stream, Manipulator& manipulator, const HAFInfo& header) {
+    PhaseTimer timer(Phase::kHeader);
+    uint64_t name_length = NameLengthField(header);
+
+    manipulator.LoadData(stream, reinterpret_cast<const char*>(&name_length), sizeof(name_length));
+    manipulator.LoadData(stream, static_cast<const char*>(header.file_name.data()), header.file_name_length);
+    manipulator.LoadData(stream, reinterpret_cast<const char*>(&header.file_size), sizeof(header.file_size));
+
+    if (HasStoredSize(header)) {
+        manipulator.LoadData(stream, reinterpret_cast<const char*>(&header.stored_size), sizeof(header.stored_size));
+    }
+
+    if (header.metadata) {
+        uint64_t fields[kMetadataFields] = {};
+
+        MakeMetadataFields(header, fields);
+        manipulator.LoadData(stream, reinterpret_cast<const char*>(fields), sizeof(fields));
+    }
+}
+
+uint64_t ChecksumCount(uint64_t file_size) {
+    return (file_size + kChecksumChunkSize - 1) / kChecksumChunkSize;
+}
+
+const uint32_t* FindChecksums(const ArchiveMember& member, uint64_t offset) {
+    if (member.checksums.size() != ChecksumCount(member.header.file_size)) {
+        return nullptr;
+    }
+
+    return member.checksums.data() + offset / kChecksumChunkSize;
+}
+
+ArchiveFormat MakeArchiveFormat(CodeRate code_rate, bool checksums, bool compression, bool dedup, bool sparse, bool metadata) {
+    ArchiveFormat format;
+
+    format.features = (checksums ? kChecksumsFeature : 0) | (compression ? kCompressionFeature : 0) | (dedup ? kDedupFeature : 0)
+        | (sparse ? kSparseFeature : 0) | (metadata ? kMetadataFeature : 0);
+    format.version = kFeatureVersion;
+    format.code_rate = code_rate;
+
+    for (uint32_t version = kChecksumVersion - 1; version < kFeatureVersion; ++version) {
+        if (VersionFeatures(version) == format.features) {
+            format.version = version;
+
+            break;
+        }
+    }
+
+    return format;
+}
+
+uint32_t VersionFeatures(uint32_t version) {
+    const uint32_t kVersionFeatures[] = {
+        0, // legacy archives
+        0,
+        kChecksumsFeature,
+        kChecksumsFeature | kCompressionFeature,
+        kChecksumsFeature | kCompressionFeature | kDedupFeature,
+        kChecksumsFeature | kCompressionFeature | kDedupFeature | kSparseFeature,
+        kChecksumsFeature | kCompressionFeature | kDedupFeature | kSparseFeature | kMetadataFeature,
+    };
+
+    return kVersionFeatures[version];
+}
+
+bool ArchiveFormat::HasChecksums() const {
+    return (features & kChecksumsFeature) != 0;
+}
+
+bool ArchiveFormat::HasCompression() const {
+    return (features & kCompressionFeature) != 0;
+}
+
+bool ArchiveFormat::HasDedup() const {
+    return (features & kDedupFeature) != 0;
+}
+
+bool ArchiveFormat::HasSparse() const {
+    return (features & kSparseFeature) != 0;
+}
+
+bool ArchiveFormat::HasMetadata() const {
+    return (features & kMetadataFeature) != 0;
+}
+
+bool ReadArchiveFormat(const std::filesystem::path& path, const Manipulator& manipulator, ArchiveFormat& format) {
+    PositionalFile archive(path, O_RDONLY);
+
+    if (!archive.IsOpen()) {
+        return true;
+    }
+
+    return ReadArchiveFormat(archive, manipulator, format);
+}
+
+bool ReadArchiveFormat(const PositionalSource& archive, const Manipulator& manipulator, ArchiveFormat& format) {
+    if (archive.Size() == 0) {
+        return true;
+    }
+
+    std::vector<char> header(kArchiveHeaderSize / kHammingByte);
+    size_t cursor = 0;
+    uint64_t magic;
+    uint64_t fields;
+
+    format = ArchiveFormat();
+
+    // Anything that does not start with the magic is a legacy archive.
+    if (!ReadEncoded(archive, manipulator, 0, header)
+        || !TakeValue(header, cursor, magic)
+        || !TakeValue(header, cursor, fields)
+        || magic != kArchiveMagic) {
+        return true;
+    }
+
+    uint32_t version = fields & ((1 << kFeatureShift) - 1);
+    uint32_t features = (fields & UINT32_MAX) >> kFeatureShift;
+    uint32_t code_rate = fields >> 32;
+
+    // Only a feature mask may come with the version, and only known features.
+    if (version == 0 || version > kArchiveVersion || (version < kFeatureVersion && features != 0)
+        || (features & ~kKnownFeatures) != 0 || FindCodeParameters(code_rate) == nullptr) {
+        return false;
+    }
+
+    format.version = version;
+    format.features = version < kFeatureVersion ? VersionFeatures(version) : features;
+    format.code_rate = static_cast<CodeRate>(code_rate);
+
+    return true;
+}
+
+ArchiveDirectory::ArchiveDirectory(const ArchiveFormat& format)
+    : format_(format)
+    , data_end_(format.version == 0 ? 0 : kArchiveHeaderSize)
+    , dead_bytes_(0)
+{}
+
+const ArchiveFormat& ArchiveDirectory::Format() const {
+    return format_;
+}
+
+const std::vector<ArchiveMember>& ArchiveDirectory::Members() const {
+    return members_;
+}
+
+const ArchiveMember* ArchiveDirectory::Find(const std::string& file_name) const {
+    auto it = index_.find(file_name);
+
+    if (it == index_.end()) {
+        return nullptr;
+    }
+
+    return &members_[it->second];
+}
+
+std::optional<size_t> ArchiveDirectory::FindIndex(const std::string& file_name) const {
+    auto it = index_.find(file_name);
+
+    if (it == index_.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+uint64_t ArchiveDirectory::DataEnd() const {
+    return data_end_;
+}
+
+uint64_t ArchiveDirectory::DeadBytes() const {
+    return dead_bytes_;
+}
+
+const ArchiveMember& ArchiveDirectory::Add(const HAFInfo& header, bool deleted, std::vector<uint32_t> checksums) {
+    ArchiveMember member;
+
+    member.header = header;
+    member.header_offset = data_end_;
+    member.data_offset = data_end_ + EncodedHeaderSize(header);
+    member.deleted = deleted;
+    member.checksums = std::move(checksums);
+
+    data_end_ = member.data_offset + EncodedSize(format_.code_rate, StoredSize(header));
+
+    if (deleted) {
+        dead_bytes_ += data_end_ - member.header_offset;
+    } else {
+        index_[header.file_name] = members_.size();
+    }
+
+    members_.push_back(std::move(member));
+
+    return members_.back();
+}
+
+void ArchiveDirectory::AddChecksum(uint32_t checksum) {
+    members_.back().checksums.push_back(checksum);
+}
+
+void ArchiveDirectory::AddStored(uint64_t length) {
+    ArchiveMember& member = members_.back();
+
+    // Frames are multiples of every codeword's data size, so they are
+    // encoded into whole codewords.
+    member.header.stored_size += length;
+    data_end_ += EncodedSize(format_.code_rate, length);
+}
+
+void ArchiveDirectory::SetContentHash(uint64_t hash) {
+    members_.back().header.content_hash = hash;
+}
+
+const ArchiveMember* ArchiveDirectory::SetMetadata(const std::string& file_name, int64_t modified, uint32_t mode) {
+    auto it = index_.find(file_name);
+
+    if (it == index_.end()) {
+        return nullptr;
+    }
+
+    ArchiveMember& member = members_[it->second];
+
+    member.header.modified = modified;
+    member.header.mode = mode;
+
+    return &member;
+}
+
+const ArchiveMember* ArchiveDirectory::MarkDeleted(const std::string& file_name) {
+    std::optional<size_t> member_index = FindIndex(file_name);
+
+    if (!member_index.has_value()) {
+        return nullptr;
+    }
+
+    return &MarkDeleted(*member_index);
+}
+
+const ArchiveMember& ArchiveDirectory::MarkDeleted(size_t member_index) {
+    ArchiveMember& member = members_[member_index];
+    uint64_t member_end = member.data_offset + EncodedSize(format_.code_rate, StoredSize(member.header));
+    auto it = index_.find(member.header.file_name);
+
+    if (member.deleted) {
+        return member;
+    }
+
+    member.deleted = true;
+    dead_bytes_ += member_end - member.header_offset;
+
+    if (it != index_.end() && it->second == member_index) {
+        index_.erase(it);
+    }
+
+    return member;
+}
+
+void AppendValue(std::string& bytes, uint64_t value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void ArchiveDirectory::WriteHeader(std::ostream& stream, Manipulator& manipulator) const {
+    if (format_.version == 0) {
+        return;
+    }
+
+    PhaseTimer timer(Phase::kHeader);
+    std::string bytes;
+
+    AppendValue(bytes, kArchiveMagic);
+    uint64_t features = format_.version < kFeatureVersion ? 0 : format_.features;
+
+    AppendValue(bytes, format_.version | (features << kFeatureShift) | (static_cast<uint64_t>(format_.code_rate) << 32));
+
+    manipulator.LoadData(stream, bytes.data(), bytes.size());
+}
+
+void ArchiveDirectory::Write(std::ostream& stream, Manipulator& manipulator) const {
+    PhaseTimer timer(Phase::kHeader);
+    std::string bytes = DirectoryBytes();
+    std::string trailer;
+
+    AppendValue(trailer, kTrailerMagic);
+    AppendValue(trailer, data_end_);
+
+    manipulator.LoadData(stream, bytes.data(), bytes.size());
+    manipulator.LoadData(stream, trailer.data(), trailer.size());
+}
+
+uint64_t ArchiveDirectory::WrittenSize() const {
+    return kHammingByte * DirectoryBytes().size() + kTrailerSize;
+}
+
+std::string ArchiveDirectory::DirectoryBytes() const {
+    std::string bytes;
+
+    AppendValue(bytes, kDirectoryMarker);
+    AppendValue(bytes, members_.size());
+
+    for (const ArchiveMember& member: members_) {
+        AppendValue(bytes, NameLengthField(member.header, member.deleted));
+        bytes += member.header.file_name;
+        AppendValue(bytes, member.header.file_size);
+
+        if (HasStoredSize(member.header)) {
+            AppendValue(bytes, member.header.stored_size);
+        }
+
+        if (member.header.metadata) {
+            uint64_t fields[kMetadataFields] = {};
+
+            MakeMetadataFields(member.header, fields);
+
+            for (uint64_t field: fields) {
+                AppendValue(bytes, field);
+            }
+        }
+
+        AppendValue(bytes, member.header_offset);
+
+        if (!format_.HasChecksums()) {
+            continue;
+        }
+
+        // A member keeps either all of its checksums or none.
+        bool complete = member.checksums.size() == ChecksumCount(member.header.file_size);
+
+        AppendValue(bytes, complete ? member.checksums.size() : 0);
+
+        if (complete) {
+            bytes.append(reinterpret_cast<const char*>(member.checksums.data()), member.checksums.size() * sizeof(uint32_t));
+        }
+    }
+
+    return bytes;
+}
+
+bool ReadEncoded(const PositionalSource& archive, const Manipulator& manipulator, uint64_t offset, std::vector<char>& decoded) {
+    PhaseTimer timer(Phase::kHeader);
+    std::vector<char> encoded(kHammingByte * decoded.size());
+
+    if (archive.ReadAt(encoded.data(), encoded.size(), offset) != encoded.size()) {
+        return false;
+    }
+
+    CodecStats stats = manipulator.DecodeBlock(encoded.data(), decoded.size(), decoded.data());
+
+    return stats.damaged == 0;
+}
+
+bool TakeValue(const std::vector<char>& bytes, size_t& cursor, uint64_t& value) {
+    if (bytes.size() - cursor < sizeof(value)) {
+        return false;
+    }
+
+    memcpy(&value, bytes.data() + cursor, sizeof(value));
+    cursor += sizeof(value);
+
+    return true;
+}
+
+bool ArchiveDirectory::Load(const std::filesystem::path& path, const Manipulator& manipulator) {
+    PositionalFile archive(path, O_RDONLY);
+
+    return archive.IsOpen() && Load(archive, manipulator);
+}
+
+bool ArchiveDirectory::Load(const PositionalSource& archive, const Manipulator& manipulator) {
+    uint64_t archive_size = archive.Size();
+
+    if (archive_size < kTrailerSize) {
+        return false;
+    }
+
+    std::vector<char> trailer(kTrailerSize / kHammingByte);
+    size_t cursor = 0;
+    uint64_t magic;
+    uint64_t directory_offset;
+
+    if (!ReadEncoded(archive, manipulator, archive_size - kTrailerSize, trailer)
+        || !TakeValue(trailer, cursor, magic)
+        || !TakeValue(trailer, cursor, directory_offset)
+        || magic != kTrailerMagic
+        || directory_offset > archive_size - kTrailerSize
+        || (archive_size - kTrailerSize - directory_offset) % kHammingByte != 0) {
+        return false;
+    }
+
+    std::vector<char> bytes((archive_size - kTrailerSize - directory_offset) / kHammingByte);
+    uint64_t marker;
+    uint64_t count;
+
+    cursor = 0;
+
+    if (!ReadEncoded(archive, manipulator, directory_offset, bytes)
+        || !TakeValue(bytes, cursor, marker)
+        || !TakeValue(bytes, cursor, count)
+        || marker != kDirectoryMarker) {
+        return false;
+    }
+
+    ArchiveDirectory directory(format_);
+
+    for (uint64_t i = 0; i < count; ++i) {
+        HAFInfo header;
+        uint64_t name_length;
+        uint64_t header_offset;
+        bool deleted;
+
+        if (!TakeValue(bytes, cursor, name_length)
+            || !TakeNameLengthField(name_length, header, deleted)
+            || (header.compressed && !format_.HasCompression())
+            || (header.deduplicated && !format_.HasDedup())
+            || (header.sparse && !format_.HasSparse())
+            || (header.metadata && !format_.HasMetadata())
+            || bytes.size() - cursor < header.file_name_length) {
+            return false;
+        }
+
+        header.file_name.assign(bytes.data() + cursor, header.file_name_length);
+        cursor += header.file_name_length;
+
+        uint64_t fields[kMetadataFields] = {};
+
+        if (!TakeValue(bytes, cursor, header.file_size)
+            || (HasStoredSize(header) && !TakeValue(bytes, cursor, header.stored_size))
+            || (header.metadata
+                && (!TakeValue(bytes, cursor, fields[0]) || !TakeValue(bytes, cursor, fields[1]) || !TakeValue(bytes, cursor, fields[2])))
+            || !TakeValue(bytes, cursor, header_offset)
+            || header_offset != directory.DataEnd()) {
+            return false;
+        }
+
+        if (header.metadata) {
+            TakeMetadataFields(fields, header);
+        }
+
+        std::vector<uint32_t> checksums;
+        uint64_t checksum_count = 0;
+
+        if (format_.HasChecksums()) {
+            if (!TakeValue(bytes, cursor, checksum_count)
+                || (checksum_count != 0 && checksum_count != ChecksumCount(header.file_size))
+                || (bytes.size() - cursor) / sizeof(uint32_t) < checksum_count) {
+                return false;
+            }
+
+            checksums.resize(checksum_count);
+            memcpy(checksums.data(), bytes.data() + cursor, checksum_count * sizeof(uint32_t));
+            cursor += checksum_count * sizeof(uint32_t);
+        }
+
+        directory.Add(header, deleted, std::move(checksums));
+    }
+
+    if (cursor != bytes.size() || directory.DataEnd() != directory_offset) {
+        return false;
+    }
+
+    *this = std::move(directory);
+
+    return true;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "io/positional_source.h"
+#include "tools/tools.h"
+#include "../filemaker/filemaker.h"
+
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An archive is an archive header, a sequence of members, the central
+// directory and a fixed-size trailer pointing to it.
+//
+//     header:    kArchiveMagic, version (with features), payload code rate
+//     directory: kDirectoryMarker, count, count * (name length, name, size, header offset)
+//     trailer:   kTrailerMagic, directory offset
+//
+// Version 2 directory entries also carry chunk checksums: their count
+// (0 or one per kChecksumChunkSize source bytes) and the 32-bit CRC32C of
+// every chunk. They let extraction strip the parity off clean chunks
+// instead of decoding them.
+//
+// Version 3 members may be compressed (see compression.h). The name length
+// of such a member carries kCompressedFlag, both in the member header and
+// in the directory entry, and the size of its frames follows its size.
+//
+// Version 4 members may be deduplicated (see dedup.h). Their name length
+// carries kDeduplicatedFlag and their stored size follows their size, like
+// that of compressed members.
+//
+// Version 5 deduplicated members may be sparse: their name length carries
+// kSparseFlag and their recipes may hold holes, runs of zeros that take no
+// stored bytes.
+//
+// Version 6 members may keep metadata. Their name length carries
+// kMetadataFlag, and behind their sizes, in the member header and in the
+// directory entry, come the modification time, the mode (with
+// kContentHashFlag if the contents were hashed) and the content hash.
+//
+// Each of these versions has the features of the ones before it. Version 7
+// headers name their features instead, as a mask of k*Feature bits above
+// kFeatureShift in the version field, so an archive has only those it
+// needs. Archives whose features are those of an earlier version still get
+// that version, the versions that know them can read them.
+//
+// Member data is encoded with the payload code, everything else with the
+// (13, 8) code. Legacy archives (version 0) have no header and use the
+// (13, 8) code for data as well.
+//
+// The marker takes the place of a member header's name length, so a linear
+// scan stops on it even when the trailer is lost.
+//
+// Deleted members stay where they are until the archive is compacted. Their
+// name length carries kDeletedFlag both in the member header and in the
+// directory entry, so a scan skips them as well.
+
+const uint64_t kArchiveMagic = 0x0044414548464148;    // "HAFHEAD"
+const uint64_t kDirectoryMarker = 0x0000524944464148; // "HAFDIR"
+const uint64_t kTrailerMagic = 0x4C49415254464148;    // "HAFTRAIL"
+const uint32_t kArchiveVersion = 7;
+const uint32_t kChecksumVersion = 2; // first version with chunk checksums
+const uint32_t kCompressionVersion = 3; // first version with compressed members
+const uint32_t kDedupVersion = 4; // first version with deduplicated members
+const uint32_t kSparseVersion = 5; // first version with sparse members
+const uint32_t kMetadataVersion = 6; // first version with member metadata
+const uint32_t kFeatureVersion = 7; // first version with a feature mask
+const uint32_t kFeatureShift = 16; // of the feature mask in the version field
+const uint32_t kChecksumsFeature = 1 << 0;
+const uint32_t kCompressionFeature = 1 << 1;
+const uint32_t kDedupFeature = 1 << 2;
+const uint32_t kSparseFeature = 1 << 3;
+const uint32_t kMetadataFeature = 1 << 4;
+const uint32_t kKnownFeatures = (1 << 5) - 1;
+const uint64_t kArchiveHeaderSize = kHammingByte * (sizeof(uint64_t) + 2 * sizeof(uint32_t));
+const uint64_t kTrailerSize = kHammingByte * 2 * sizeof(uint64_t);
+const uint64_t kDeletedFlag = uint64_t(1) << 63;
+const uint64_t kCompressedFlag = uint64_t(1) << 62;
+const uint64_t kDeduplicatedFlag = uint64_t(1) << 61;
+const uint64_t kSparseFlag = uint64_t(1) << 60;
+const uint64_t kMetadataFlag = uint64_t(1) << 59;
+const uint64_t kContentHashFlag = uint64_t(1) << 32; // in the stored mode
+const size_t kMetadataFields = 3;
+const uint64_t kMaxFileNameLength = 4096;
+// File size in the header of a member streamed into a pipe, only the
+// directory knows the real one.
+const uint64_t kUnknownSize = UINT64_MAX;
+
+struct ArchiveFormat {
+    uint32_t version = 0;
+    uint32_t features = 0; // k*Feature bits
+    CodeRate code_rate = CodeRate::kHamming13_8;
+
+    bool HasChecksums() const;
+    bool HasCompression() const;
+    bool HasDedup() const;
+    bool HasSparse() const;
+    bool HasMetadata() const;
+};
+
+struct ArchiveMember {
+    HAFInfo header;
+    uint64_t header_offset = 0;
+    uint64_t data_offset = 0;
+    bool deleted = false;
+    // CRC32C of every kChecksumChunkSize source bytes, empty if not known.
+    std::vector<uint32_t> checksums;
+};
+
+// The name length as stored, with the flags of the member in its top bits.
+uint64_t NameLengthField(const HAFInfo& header, bool deleted = false);
+// Returns false if the length cannot be right: damage or flags this version
+// does not know.
+bool TakeNameLengthField(uint64_t field, HAFInfo& header, bool& deleted);
+// Whether the header carries a stored size besides the size.
+bool HasStoredSize(const HAFInfo& header);
+// Bytes behind the header that go through the payload code: the frames of
+// a compressed or deduplicated member, the data itself otherwise.
+uint64_t StoredSize(const HAFInfo& header);
+uint64_t EncodedHeaderSize(const HAFInfo& header);
+// The metadata of a member as stored: modification time, mode and content hash.
+void MakeMetadataFields(const HAFInfo& header, uint64_t* fields);
+void TakeMetadataFields(const uint64_t* fields, HAFInfo& header);
+void WriteMemberHeader(std::ostream& stream, Manipulator& manipulator, const HAFInfo& header);
+uint64_t ChecksumCount(uint64_t file_size);
+// Checksums of the chunks from `offset` (a chunk boundary) on, nullptr if
+// the member has none.
+const uint32_t* FindChecksums(const ArchiveMember& member, uint64_t offset);
+
+// The format of a new archive with just these features, independent of
+// each other. It gets the earliest version that can hold them.
+ArchiveFormat MakeArchiveFormat(CodeRate code_rate, bool checksums, bool compression = false, bool dedup = false, bool sparse = false,
+                                bool metadata = false);
+// The features every archive of `version` (before kFeatureVersion) has.
+uint32_t VersionFeatures(uint32_t version);
+// Leaves `format` as it is for a missing or empty archive. Returns false if
+// the archive header names a version or a code this build does not know.
+bool ReadArchiveFormat(const std::filesystem::path& path, const Manipulator& manipulator, ArchiveFormat& format);
+bool ReadArchiveFormat(const PositionalSource& archive, const Manipulator& manipulator, ArchiveFormat& format);
+
+class ArchiveDirectory {
+public:
+    explicit ArchiveDirectory(const ArchiveFormat& format = {});
+
+    const ArchiveFormat& Format() const;
+    const std::vector<ArchiveMember>& Members() const;
+    // Deleted members are never found.
+    const ArchiveMember* Find(const std::string& file_name) const;
+    std::optional<size_t> FindIndex(const std::string& file_name) const;
+    uint64_t DataEnd() const;
+    // Encoded bytes taken by deleted members.
+    uint64_t DeadBytes() const;
+
+    // Records a member written at DataEnd() and moves DataEnd() past it.
+    const ArchiveMember& Add(const HAFInfo& header, bool deleted = false, std::vector<uint32_t> checksums = {});
+    // Appends the checksum of the next chunk of the last added member.
+    void AddChecksum(uint32_t checksum);
+    // Appends `length` stored bytes (a frame) to the last added member.
+    void AddStored(uint64_t length);
+    void SetContentHash(uint64_t hash);
+    // Gives a live member the modification time and mode of its file.
+    // Returns nullptr if there is no such member.
+    const ArchiveMember* SetMetadata(const std::string& file_name, int64_t modified, uint32_t mode);
+    // Returns nullptr if there is no such live member.
+    const ArchiveMember* MarkDeleted(const std::string& file_name);
+    // Marks Members()[member_index] deleted even if a member added later
+    // took its name over.
+    const ArchiveMember& MarkDeleted(size_t member_index);
+
+    // Writes the archive header (nothing for legacy archives) into an empty stream.
+    void WriteHeader(std::ostream& stream, Manipulator& manipulator) const;
+    // Writes the directory and the trailer at DataEnd() of the stream.
+    void Write(std::ostream& stream, Manipulator& manipulator) const;
+    // Encoded bytes Write() takes.
+    uint64_t WrittenSize() const;
+
+    // Reads the directory through the trailer. Returns false if there is no
+    // trailer or anything in it does not add up.
+    bool Load(const std::filesystem::path& path, const Manipulator& manipulator);
+    bool Load(const PositionalSource& archive, const Manipulator& manipulator);
+private:
+    ArchiveFormat format_;
+    std::vector<ArchiveMember> members_;
+    std::unordered_map<std::string, size_t> index_;
+    uint64_t data_end_;
+    uint64_t dead_bytes_;
+
+    // The directory as written, without the trailer.
+    std::string DirectoryBytes() const;
+};
@@ -0,0 +1,368 @@
+#include "async_io.h"
+#include "../stats/stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct AsyncIo::Request {
+    const PositionalFile* file = nullptr;
+    char* buffer = nullptr;
+    size_t length = 0;
+    uint64_t offset = 0;
+    bool write = false;
+    uint64_t ticket = 0;
+    bool done = true;
+    size_t result = 0;
+};
+
+// The kernel side is shared memory: submissions go to the tail of the
+// submission ring, completions are taken from the head of the completion ring.
+struct AsyncIo::Ring {
+    int descriptor = -1;
+    void* rings = MAP_FAILED;
+    size_t rings_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    ~Ring();
+
+    bool Open(unsigned entries);
+    bool Submit(const io_uring_sqe& sqe);
+    // Waits for at least one completion and hands over all there are.
+    void Reap(AsyncIo& owner);
+};
+
+struct AsyncIo::Workers {
+    std::mutex mutex;
+    std::condition_variable request_added;
+    std::condition_variable request_done;
+    std::queue<Request*> pending;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    Workers(size_t count);
+    ~Workers();
+};
+
+void FreeAligned(void* data);
+
+void FreeAligned(void* data) {
+    free(data);
+}
+
+std::unique_ptr<PositionalFile> OpenDirect(const std::filesystem::path& path, int flags, bool direct) {
+    if (direct) {
+        std::unique_ptr<PositionalFile> file = std::make_unique<PositionalFile>(path, flags | O_DIRECT);
+
+        if (file->IsOpen()) {
+            return file;
+        }
+    }
+
+    return std::make_unique<PositionalFile>(path, flags);
+}
+
+bool IsDirect(const PositionalFile& file) {
+    int flags = fcntl(file.Descriptor(), F_GETFL);
+
+    return flags >= 0 && (flags & O_DIRECT) != 0;
+}
+
+uint64_t AlignUp(uint64_t value) {
+    return (value + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+}
+
+AlignedBuffer::AlignedBuffer(size_t size)
+    : data_(static_cast<char*>(std::aligned_alloc(kDirectAlignment, AlignUp(size))), FreeAligned)
+    , size_(size)
+{}
+
+char* AlignedBuffer::Data() const {
+    return data_.get();
+}
+
+size_t AlignedBuffer::Size() const {
+    return size_;
+}
+
+AsyncIo::Ring::~Ring() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqes_size);
+    }
+
+    if (rings != MAP_FAILED) {
+        munmap(rings, rings_size);
+    }
+
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+}
+
+bool AsyncIo::Ring::Open(unsigned entries) {
+    io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    descriptor = syscall(__NR_io_uring_setup, entries, &params);
+
+    // Both rings in one mapping keeps this simple, every kernel since 5.4 does it.
+    if (descriptor < 0 || (params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+        return false;
+    }
+
+    rings_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                          params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           descriptor, IORING_OFF_SQES));
+
+    if (rings == MAP_FAILED || sqes == MAP_FAILED) {
+        return false;
+    }
+
+    char* base = static_cast<char*>(rings);
+
+    sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    return true;
+}
+
+bool AsyncIo::Ring::Submit(const io_uring_sqe& sqe) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+
+    sqes[index] = sqe;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (true) {
+        CountSyscalls();
+
+        if (syscall(__NR_io_uring_enter, descriptor, 1, 0, 0, nullptr, 0) == 1) {
+            return true;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return false;
+        }
+    }
+}
+
+void AsyncIo::Ring::Reap(AsyncIo& owner) {
+    unsigned head = *cq_head;
+
+    while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        CountSyscalls();
+        syscall(__NR_io_uring_enter, descriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+
+    for (; head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE); ++head) {
+        const io_uring_cqe& cqe = cqes[head & *cq_mask];
+        Request& request = owner.requests_[cqe.user_data % owner.depth_];
+
+        // A request the ring failed to take was done without it.
+        if (request.ticket == cqe.user_data && !request.done) {
+            Complete(request, cqe.res);
+        }
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void AsyncIo::Complete(Request& request, int result) {
+    size_t done = result > 0 ? result : 0;
+
+    if (request.write) {
+        CountWritten(done);
+    } else {
+        CountRead(done);
+    }
+
+    // A short transfer (or a failed one, e.g. interrupted) is finished the
+    // ordinary way. A read that got nothing at all hit the end of file.
+    if (done < request.length && (result < 0 || request.write || done != 0)) {
+        if (request.write) {
+            done = request.file->WriteAt(request.buffer + done, request.length - done, request.offset + done) ? request.length : done;
+        } else {
+            done += request.file->ReadAt(request.buffer + done, request.length - done, request.offset + done);
+        }
+    }
+
+    request.result = done;
+    request.done = true;
+}
+
+AsyncIo::Workers::Workers(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        threads.emplace_back([this]() {
+            while (true) {
+                Request* request;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    request_added.wait(lock, [&]() { return !pending.empty() || stopping; });
+
+                    if (pending.empty()) {
+                        return;
+                    }
+
+                    request = pending.front();
+                    pending.pop();
+                }
+
+                size_t done = request->write
+                    ? (request->file->WriteAt(request->buffer, request->length, request->offset) ? request->length : 0)
+                    : request->file->ReadAt(request->buffer, request->length, request->offset);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    request->result = done;
+                    request->done = true;
+                }
+
+                request_done.notify_all();
+            }
+        });
+    }
+}
+
+AsyncIo::Workers::~Workers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        stopping = true;
+    }
+
+    request_added.notify_all();
+
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+}
+
+AsyncIo::AsyncIo(size_t depth)
+    : ring_(std::make_unique<Ring>())
+    , requests_(std::make_unique<Request[]>(depth))
+    , depth_(depth)
+    , next_ticket_(0)
+{
+    if (!ring_->Open(depth)) {
+        ring_.reset();
+        workers_ = std::make_unique<Workers>(depth);
+    }
+}
+
+AsyncIo::~AsyncIo() {
+    // The kernel must not write into buffers that are about to be freed.
+    for (size_t i = 0; i < depth_; ++i) {
+        Wait(requests_[i].ticket);
+    }
+}
+
+bool AsyncIo::UsesUring() const {
+    return ring_ != nullptr;
+}
+
+uint64_t AsyncIo::Read(const PositionalFile& file, char* buffer, size_t length, uint64_t offset) {
+    return Submit(file, buffer, length, offset, false);
+}
+
+uint64_t AsyncIo::Write(const PositionalFile& file, const char* buffer, size_t length, uint64_t offset) {
+    return Submit(file, const_cast<char*>(buffer), length, offset, true);
+}
+
+uint64_t AsyncIo::Submit(const PositionalFile& file, char* buffer, size_t length, uint64_t offset, bool write) {
+    uint64_t ticket = next_ticket_++;
+    Request& request = requests_[ticket % depth_];
+
+    // Only happens if the caller keeps more than `depth` requests pending.
+    Wait(request.ticket);
+
+    request.file = &file;
+    request.buffer = buffer;
+    request.length = length;
+    request.offset = offset;
+    request.write = write;
+    request.ticket = ticket;
+    request.done = false;
+
+    if (ring_ != nullptr) {
+        io_uring_sqe sqe;
+
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = file.Descriptor();
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.user_data = ticket;
+
+        if (!ring_->Submit(sqe)) {
+            Complete(request, -1);
+        }
+
+        return ticket;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(workers_->mutex);
+
+        workers_->pending.push(&request);
+    }
+
+    workers_->request_added.notify_one();
+
+    return ticket;
+}
+
+size_t AsyncIo::Wait(uint64_t ticket) {
+    Request& request = requests_[ticket % depth_];
+
+    if (request.ticket != ticket) {
+        return 0;
+    }
+
+    PhaseTimer timer(request.write ? Phase::kWrite : Phase::kRead);
+
+    if (ring_ != nullptr) {
+        while (!request.done) {
+            ring_->Reap(*this);
+        }
+
+        return request.result;
+    }
+
+    std::unique_lock<std::mutex> lock(workers_->mutex);
+
+    workers_->request_done.wait(lock, [&]() { return request.done; });
+
+    return request.result;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "positional_file.h"
+
+#include <cinttypes>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+// Buffers and offsets of files opened with O_DIRECT are multiples of this.
+const size_t kDirectAlignment = 4096;
+
+// Memory aligned to kDirectAlignment, as O_DIRECT transfers need it.
+class AlignedBuffer {
+public:
+    AlignedBuffer(size_t size = 0);
+
+    char* Data() const;
+    size_t Size() const;
+private:
+    std::unique_ptr<char, void (*)(void*)> data_;
+    size_t size_;
+};
+
+// Opens with O_DIRECT (past the page cache) if `direct` and the file system
+// supports it, the ordinary way otherwise.
+std::unique_ptr<PositionalFile> OpenDirect(const std::filesystem::path& path, int flags, bool direct);
+bool IsDirect(const PositionalFile& file);
+uint64_t AlignUp(uint64_t value);
+
+// Positional reads and writes kept in flight while the caller works on
+// something else. Requests go through io_uring where the kernel allows it,
+// otherwise through a few threads doing pread/pwrite. A queue belongs to
+// one thread, at most `depth` requests can be pending at once.
+class AsyncIo {
+public:
+    explicit AsyncIo(size_t depth);
+    AsyncIo(const AsyncIo&) = delete;
+    AsyncIo& operator=(const AsyncIo&) = delete;
+    ~AsyncIo();
+
+    bool UsesUring() const;
+
+    // Return a ticket for Wait(). Buffers must stay untouched until then.
+    uint64_t Read(const PositionalFile& file, char* buffer, size_t length, uint64_t offset);
+    uint64_t Write(const PositionalFile& file, const char* buffer, size_t length, uint64_t offset);
+    // Returns the number of bytes transferred, less than requested only at
+    // the end of file (reads) or on failure.
+    size_t Wait(uint64_t ticket);
+private:
+    struct Request;
+    struct Ring;
+    struct Workers;
+
+    std::unique_ptr<Ring> ring_;
+    std::unique_ptr<Workers> workers_;
+    std::unique_ptr<Request[]> requests_; // indexed by ticket % depth
+    size_t depth_;
+    uint64_t next_ticket_;
+
+    uint64_t Submit(const PositionalFile& file, char* buffer, size_t length, uint64_t offset, bool write);
+    // Finishes a transfer the kernel (`result` bytes or -errno) left short.
+    static void Complete(Request& request, int result);
+};
@@ -0,0 +1,78 @@
+#include "mapped_region.h"
+#include "../stats/stats.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool UseMappings(IoBackend backend, const std::filesystem::path& path) {
+    if (backend == IoBackend::kStream || backend == IoBackend::kAsync) {
+        return false;
+    }
+
+    // Pipes and character devices cannot be mapped, they always go through streams.
+    return std::filesystem::is_regular_file(path);
+}
+
+MappedRegion::MappedRegion(const PositionalFile& file, uint64_t offset, size_t length, bool writable)
+    : base_(MAP_FAILED)
+    , mapped_length_(0)
+    , data_(nullptr)
+    , length_(length)
+{
+    static const uint64_t kPageSize = sysconf(_SC_PAGESIZE);
+
+    if (length == 0) {
+        return;
+    }
+
+    uint64_t aligned_offset = offset - offset % kPageSize;
+
+    mapped_length_ = length + (offset - aligned_offset);
+    base_ = mmap(
+        nullptr,
+        mapped_length_,
+        writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED,
+        file.Descriptor(),
+        aligned_offset
+    );
+
+    CountSyscalls();
+
+    if (base_ != MAP_FAILED) {
+        data_ = static_cast<char*>(base_) + (offset - aligned_offset);
+
+        // Mapped bytes are counted as moved once the mapping is made.
+        if (writable) {
+            CountWritten(length);
+        } else {
+            CountRead(length);
+        }
+    }
+}
+
+MappedRegion::~MappedRegion() {
+    if (base_ != MAP_FAILED) {
+        munmap(base_, mapped_length_);
+        CountSyscalls();
+    }
+}
+
+bool MappedRegion::IsMapped() const {
+    return length_ == 0 || base_ != MAP_FAILED;
+}
+
+char* MappedRegion::Data() const {
+    return data_;
+}
+
+size_t MappedRegion::Size() const {
+    return length_;
+}
+
+void MappedRegion::Advise(int advice) const {
+    if (base_ != MAP_FAILED) {
+        madvise(base_, mapped_length_, advice);
+        CountSyscalls();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "positional_file.h"
+
+#include <cinttypes>
+#include <cstddef>
+#include <filesystem>
+
+enum class IoBackend {
+    kAuto,   // mmap for regular files, streams for everything else
+    kStream,
+    kMmap,
+    kAsync,  // positional reads and writes kept in flight (io_uring or threads)
+};
+
+// Whether `path` should be accessed through mappings.
+bool UseMappings(IoBackend backend, const std::filesystem::path& path);
+
+// A window [offset, offset + length) of a file mapped into memory. The
+// offset does not have to be page-aligned. Archives larger than memory are
+// processed by moving such windows over them, so only the windows currently
+// in use occupy address space.
+class MappedRegion {
+public:
+    MappedRegion(const PositionalFile& file, uint64_t offset, size_t length, bool writable);
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+    ~MappedRegion();
+
+    bool IsMapped() const;
+    char* Data() const;
+    size_t Size() const;
+
+    // madvise() over the window, e.g. MADV_SEQUENTIAL or MADV_WILLNEED.
+    void Advise(int advice) const;
+private:
+    void* base_;
+    size_t mapped_length_;
+    char* data_;
+    size_t length_;
+};
@@ -0,0 +1,9 @@
+#include "null_buffer.h"
+
+int NullBuffer::overflow(int character) {
+    return character == traits_type::eof() ? traits_type::not_eof(character) : character;
+}
+
+std::streamsize NullBuffer::xsputn(const char*, std::streamsize count) {
+    return count;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <streambuf>
+
+// A stream buffer that drops everything written to it, for output that is
+// produced only to be timed or that nobody reads.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int character) override;
+    std::streamsize xsputn(const char* data, std::streamsize count) override;
+};
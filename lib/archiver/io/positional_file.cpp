@@ -0,0 +1,179 @@
+#include "positional_file.h"
+#include "../stats/stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+const size_t kCopyBufferSize = 1 << 20;
+
+PositionalFile::PositionalFile(const std::filesystem::path& _path, int _flags, uint32_t _mode)
+    : descriptor_(open(_path.c_str(), _flags | O_CLOEXEC, _mode))
+{}
+
+PositionalFile::~PositionalFile() {
+    if (IsOpen()) {
+        close(descriptor_);
+    }
+}
+
+bool PositionalFile::IsOpen() const {
+    return descriptor_ >= 0;
+}
+
+int PositionalFile::Descriptor() const {
+    return descriptor_;
+}
+
+uint64_t PositionalFile::Size() const {
+    struct stat info;
+
+    if (fstat(descriptor_, &info) != 0) {
+        return 0;
+    }
+
+    return info.st_size;
+}
+
+size_t PositionalFile::ReadAt(char* buffer, size_t length, uint64_t offset) const {
+    PhaseTimer timer(Phase::kRead);
+    size_t done = 0;
+
+    while (done < length) {
+        ssize_t result = pread(descriptor_, buffer + done, length - done, offset + done);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result <= 0) {
+            break;
+        }
+
+        done += result;
+    }
+
+    CountRead(done);
+
+    return done;
+}
+
+bool PositionalFile::WriteAt(const char* buffer, size_t length, uint64_t offset) const {
+    PhaseTimer timer(Phase::kWrite);
+    size_t done = 0;
+
+    while (done < length) {
+        ssize_t result = pwrite(descriptor_, buffer + done, length - done, offset + done);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result <= 0) {
+            return false;
+        }
+
+        done += result;
+    }
+
+    CountWritten(done);
+
+    return true;
+}
+
+bool PositionalFile::Resize(uint64_t size) const {
+    return ftruncate(descriptor_, size) == 0;
+}
+
+bool PositionalFile::Allocate(uint64_t size) const {
+    if (size <= Size()) {
+        return true;
+    }
+
+    int result = posix_fallocate(descriptor_, 0, size);
+
+    CountSyscalls();
+
+    if (result == EINVAL || result == EOPNOTSUPP) {
+        return Resize(size);
+    }
+
+    return result == 0;
+}
+
+uint64_t PositionalFile::NextData(uint64_t offset) const {
+    off_t result = lseek(descriptor_, offset, SEEK_DATA);
+
+    CountSyscalls();
+
+    if (result < 0) {
+        return errno == ENXIO ? UINT64_MAX : offset;
+    }
+
+    return result;
+}
+
+uint64_t PositionalFile::NextHole(uint64_t offset) const {
+    off_t result = lseek(descriptor_, offset, SEEK_HOLE);
+
+    CountSyscalls();
+
+    return result < 0 ? UINT64_MAX : result;
+}
+
+void PositionalFile::Advise(int advice) const {
+    if (IsOpen()) {
+        posix_fadvise(descriptor_, 0, 0, advice);
+        CountSyscalls();
+    }
+}
+
+bool CopyRange(const PositionalFile& source, uint64_t source_offset, const PositionalFile& target, uint64_t target_offset, uint64_t length) {
+    PhaseTimer timer(Phase::kWrite);
+
+    while (length > 0) {
+        loff_t input_offset = source_offset;
+        loff_t output_offset = target_offset;
+        ssize_t result = copy_file_range(source.Descriptor(), &input_offset, target.Descriptor(), &output_offset, length, 0);
+
+        CountSyscalls();
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // Unsupported across these files (or the end of the source): the rest goes through the buffer.
+        if (result <= 0) {
+            break;
+        }
+
+        CountRead(result);
+        CountWritten(result);
+
+        source_offset += result;
+        target_offset += result;
+        length -= result;
+    }
+
+    std::vector<char> buffer(std::min<uint64_t>(length, kCopyBufferSize));
+
+    while (length > 0) {
+        size_t block = std::min<uint64_t>(length, buffer.size());
+        size_t bytes_read = source.ReadAt(buffer.data(), block, source_offset);
+
+        std::fill(buffer.begin() + bytes_read, buffer.begin() + block, 0);
+
+        if (!target.WriteAt(buffer.data(), block, target_offset)) {
+            return false;
+        }
+
+        source_offset += block;
+        target_offset += block;
+        length -= block;
+    }
+
+    return true;
+}
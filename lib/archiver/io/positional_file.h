@@ -0,0 +1,45 @@
+#pragma once
+
+#include "positional_source.h"
+
+#include <cinttypes>
+#include <filesystem>
+
+// Thin wrapper over a POSIX descriptor. Reads and writes take an explicit
+// offset (pread/pwrite), so one file can be shared by several threads.
+class PositionalFile : public PositionalSource {
+public:
+    PositionalFile(const std::filesystem::path& _path, int _flags, uint32_t _mode = 0644);
+    PositionalFile(const PositionalFile&) = delete;
+    PositionalFile& operator=(const PositionalFile&) = delete;
+    ~PositionalFile();
+
+    bool IsOpen() const;
+    int Descriptor() const;
+    uint64_t Size() const override;
+
+    // Returns the number of bytes read, less than `length` only at the end of file.
+    size_t ReadAt(char* buffer, size_t length, uint64_t offset) const override;
+    bool WriteAt(const char* buffer, size_t length, uint64_t offset) const;
+    bool Resize(uint64_t size) const;
+    // Reserves disk blocks up to `size` (growing the file) where the file
+    // system supports it, otherwise just resizes.
+    bool Allocate(uint64_t size) const;
+    // Offset of the first data byte at or after `offset` (SEEK_DATA):
+    // UINT64_MAX if there is none, `offset` itself where the file system
+    // does not keep holes.
+    uint64_t NextData(uint64_t offset) const;
+    // Offset of the first hole at or after `offset` (SEEK_HOLE), the end of
+    // the file is one. UINT64_MAX where it cannot be told.
+    uint64_t NextHole(uint64_t offset) const;
+    // posix_fadvise() over the whole file, e.g. POSIX_FADV_WILLNEED.
+    void Advise(int advice) const;
+private:
+    int descriptor_;
+};
+
+// Copies `length` bytes without passing them through user space where the
+// kernel can (copy_file_range, which also reflinks on file systems that
+// support it), otherwise through a buffer. Bytes past the end of `source`
+// are written as zeros, so `target` always grows by exactly `length`.
+bool CopyRange(const PositionalFile& source, uint64_t source_offset, const PositionalFile& target, uint64_t target_offset, uint64_t length);
@@ -0,0 +1,54 @@
+#include "positional_source.h"
+#include "../stats/stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+MemorySource::MemorySource(const char* data, size_t size)
+    : data_(data)
+    , size_(size)
+{}
+
+uint64_t MemorySource::Size() const {
+    return size_;
+}
+
+size_t MemorySource::ReadAt(char* buffer, size_t length, uint64_t offset) const {
+    if (offset >= size_) {
+        return 0;
+    }
+
+    length = std::min<uint64_t>(length, size_ - offset);
+    memcpy(buffer, data_ + offset, length);
+
+    return length;
+}
+
+StreamSource::StreamSource(std::istream& stream)
+    : stream_(stream)
+    , size_(0)
+{
+    // A stream that cannot seek has no size either.
+    std::streampos end = stream_.seekg(0, std::ios::end).tellg();
+
+    size_ = end < 0 ? 0 : static_cast<uint64_t>(end);
+    stream_.clear();
+}
+
+uint64_t StreamSource::Size() const {
+    return size_;
+}
+
+size_t StreamSource::ReadAt(char* buffer, size_t length, uint64_t offset) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (offset >= size_) {
+        return 0;
+    }
+
+    // A short read leaves the stream failed, the next one starts afresh.
+    stream_.clear();
+    stream_.seekg(offset);
+
+    return ReadCounted(stream_, buffer, std::min<uint64_t>(length, size_ - offset));
+}
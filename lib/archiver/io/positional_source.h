@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <istream>
+#include <mutex>
+
+// Anything an archive is read from at explicit offsets: a file, or a buffer
+// or a stream of the caller. Reads are safe to make from several threads.
+class PositionalSource {
+public:
+    virtual ~PositionalSource() = default;
+
+    virtual uint64_t Size() const = 0;
+    // Returns the number of bytes read, less than `length` only at the end.
+    virtual size_t ReadAt(char* buffer, size_t length, uint64_t offset) const = 0;
+};
+
+// A buffer of the caller, which has to outlive it.
+class MemorySource : public PositionalSource {
+public:
+    MemorySource(const char* data, size_t size);
+
+    uint64_t Size() const override;
+    size_t ReadAt(char* buffer, size_t length, uint64_t offset) const override;
+private:
+    const char* data_;
+    size_t size_;
+};
+
+// A seekable stream of the caller, which has to outlive it. Reads take
+// turns: each one seeks the stream.
+class StreamSource : public PositionalSource {
+public:
+    explicit StreamSource(std::istream& stream);
+
+    uint64_t Size() const override;
+    size_t ReadAt(char* buffer, size_t length, uint64_t offset) const override;
+private:
+    std::istream& stream_;
+    uint64_t size_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,201 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+const size_t kChunksPerThread = 2;
+
+size_t ResolveThreadCount(size_t threads) {
+    if (threads != 0) {
+        return threads;
+    }
+
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+ChunkPipeline::ChunkPipeline(size_t _threads)
+    : threads_(ResolveThreadCount(_threads))
+{}
+
+void ChunkPipeline::Run(const Reader& reader, const Worker& worker, const Writer& writer) {
+    if (threads_ == 1) {
+        Chunk chunk;
+
+        for (; reader(chunk); ++chunk.sequence) {
+            worker(chunk);
+            writer(chunk);
+        }
+
+        return;
+    }
+
+    std::vector<Chunk> chunks(kChunksPerThread * threads_);
+    std::queue<Chunk*> free_chunks;
+    std::queue<Chunk*> pending;
+    std::map<uint64_t, Chunk*> processed;
+    bool reading_done = false;
+    uint64_t chunks_read = 0;
+    std::exception_ptr failure;
+
+    std::mutex mutex;
+    std::condition_variable chunk_freed;
+    std::condition_variable chunk_read;
+    std::condition_variable chunk_processed;
+
+    // Everybody waiting wakes up and leaves, the first failure is kept.
+    auto fail = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+
+        chunk_freed.notify_all();
+        chunk_read.notify_all();
+        chunk_processed.notify_all();
+    };
+
+    for (Chunk& chunk: chunks) {
+        free_chunks.push(&chunk);
+    }
+
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads_; ++i) {
+        workers.emplace_back([&]() {
+            while (true) {
+                Chunk* chunk;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    chunk_read.wait(lock, [&]() { return !pending.empty() || reading_done || failure; });
+
+                    if (pending.empty() || failure) {
+                        return;
+                    }
+
+                    chunk = pending.front();
+                    pending.pop();
+                }
+
+                try {
+                    worker(*chunk);
+                } catch (...) {
+                    fail();
+
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    processed[chunk->sequence] = chunk;
+                }
+
+                chunk_processed.notify_one();
+            }
+        });
+    }
+
+    std::thread writing_thread([&]() {
+        for (uint64_t next = 0;; ++next) {
+            Chunk* chunk;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                chunk_processed.wait(lock, [&]() {
+                    return processed.count(next) != 0 || (reading_done && next == chunks_read) || failure;
+                });
+
+                if (processed.count(next) == 0 || failure) {
+                    return;
+                }
+
+                chunk = processed[next];
+                processed.erase(next);
+            }
+
+            try {
+                writer(*chunk);
+            } catch (...) {
+                fail();
+
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                free_chunks.push(chunk);
+            }
+
+            chunk_freed.notify_one();
+        }
+    });
+
+    while (true) {
+        Chunk* chunk;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            chunk_freed.wait(lock, [&]() { return !free_chunks.empty() || failure; });
+
+            if (failure) {
+                break;
+            }
+
+            chunk = free_chunks.front();
+            free_chunks.pop();
+        }
+
+        chunk->sequence = chunks_read;
+
+        try {
+            if (!reader(*chunk)) {
+                break;
+            }
+        } catch (...) {
+            fail();
+
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            pending.push(chunk);
+            ++chunks_read;
+        }
+
+        chunk_read.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        reading_done = true;
+    }
+
+    chunk_read.notify_all();
+    chunk_processed.notify_all();
+
+    for (std::thread& thread: workers) {
+        thread.join();
+    }
+
+    writing_thread.join();
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cinttypes>
+#include <functional>
+#include <vector>
+
+struct Chunk {
+    uint64_t sequence = 0;
+    size_t source = 0; // set by the reader, e.g. the file the chunk comes from
+    std::vector<char> input;
+    std::vector<char> output;
+    std::vector<char> frame; // set by workers that compress the chunk, `output` is then the frame encoded
+    uint32_t checksum = 0; // set by workers that checksum the chunk
+    // Set by readers that deduplicate chunks: the XXH64 of `input`, its entry
+    // in the chunk index and whether the entry was there before, so the
+    // chunk is not stored again.
+    uint64_t hash = 0;
+    size_t reference = 0;
+    bool duplicate = false;
+    // Set by readers that leave zeros out: how many the chunk stands for,
+    // `input` is empty then.
+    uint64_t hole = 0;
+};
+
+// Reader -> N workers -> ordered writer.
+//
+// The reader fills `input` of a free chunk and returns false once there is
+// nothing left, workers turn `input` into `output` concurrently, the writer
+// receives chunks strictly in the order they were read. At most
+// kChunksPerThread * threads chunks are alive at any moment, so memory does
+// not depend on the amount of data passed through. The first exception
+// thrown by any of the three stops the pipeline and is rethrown by Run().
+class ChunkPipeline {
+public:
+    using Reader = std::function<bool(Chunk& chunk)>;
+    using Worker = std::function<void(Chunk& chunk)>;
+    using Writer = std::function<void(Chunk& chunk)>;
+
+    ChunkPipeline(size_t _threads = 1);
+
+    void Run(const Reader& reader, const Worker& worker, const Writer& writer);
+private:
+    size_t threads_;
+};
+
+size_t ResolveThreadCount(size_t threads);
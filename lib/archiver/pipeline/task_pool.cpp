@@ -0,0 +1,125 @@
+#include "pipeline.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TaskRange {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+bool TakeTask(TaskRange& range, size_t& task_index);
+bool StealTasks(std::vector<TaskRange>& ranges, size_t thief);
+
+TaskPool::TaskPool(size_t _threads)
+    : threads_(ResolveThreadCount(_threads))
+{}
+
+size_t TaskPool::Threads() const {
+    return threads_;
+}
+
+bool TakeTask(TaskRange& range, size_t& task_index) {
+    std::lock_guard<std::mutex> lock(range.mutex);
+
+    if (range.begin == range.end) {
+        return false;
+    }
+
+    task_index = range.begin++;
+
+    return true;
+}
+
+bool StealTasks(std::vector<TaskRange>& ranges, size_t thief) {
+    size_t victim = thief;
+    size_t most_left = 0;
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::lock_guard<std::mutex> lock(ranges[i].mutex);
+
+        if (ranges[i].end - ranges[i].begin > most_left) {
+            most_left = ranges[i].end - ranges[i].begin;
+            victim = i;
+        }
+    }
+
+    if (victim == thief) {
+        return false;
+    }
+
+    std::scoped_lock lock(ranges[victim].mutex, ranges[thief].mutex);
+    size_t left = ranges[victim].end - ranges[victim].begin;
+
+    if (left == 0) {
+        // Someone was faster, let the caller look again.
+        return true;
+    }
+
+    size_t stolen = (left + 1) / 2;
+
+    ranges[thief].begin = ranges[victim].end - stolen;
+    ranges[thief].end = ranges[victim].end;
+    ranges[victim].end -= stolen;
+
+    return true;
+}
+
+void TaskPool::Run(size_t count, const Task& task) {
+    size_t workers_count = std::min(threads_, count);
+
+    if (workers_count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i, 0);
+        }
+
+        return;
+    }
+
+    std::vector<TaskRange> ranges(workers_count);
+
+    for (size_t i = 0; i < workers_count; ++i) {
+        ranges[i].begin = count * i / workers_count;
+        ranges[i].end = count * (i + 1) / workers_count;
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex failure_mutex;
+    std::exception_ptr failure;
+    std::atomic<bool> failed = false;
+
+    for (size_t worker = 0; worker < workers_count; ++worker) {
+        workers.emplace_back([&, worker]() {
+            size_t task_index;
+
+            try {
+                do {
+                    while (!failed && TakeTask(ranges[worker], task_index)) {
+                        task(task_index, worker);
+                    }
+                } while (!failed && StealTasks(ranges, worker));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failure_mutex);
+
+                if (!failed) {
+                    failure = std::current_exception();
+                    failed = true;
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread: workers) {
+        thread.join();
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cinttypes>
+#include <functional>
+
+// Runs tasks 0..count-1 on N threads. Every worker starts with its own
+// contiguous share of indices and, once it runs dry, steals half of the
+// remaining share of the busiest worker. The first exception thrown by a
+// task stops the others from starting new tasks and is rethrown by Run().
+class TaskPool {
+public:
+    using Task = std::function<void(size_t task_index, size_t worker_index)>;
+
+    TaskPool(size_t _threads = 1);
+
+    size_t Threads() const;
+    void Run(size_t count, const Task& task);
+private:
+    size_t threads_;
+};
@@ -0,0 +1,29 @@
+#include "policy.h"
+
+Resolution ResolveExisting(const ExistingPolicy& policy, Existing what, const std::string& name) {
+    if (!policy) {
+        return Resolution::kReplace;
+    }
+
+    return policy(what, name);
+}
+
+DamageHandler::DamageHandler(const DamagePolicy& policy)
+    : policy_(policy)
+{}
+
+const DamagePolicy& DamageHandler::Policy() const {
+    return policy_;
+}
+
+void DamageHandler::Check(const CodecStats& stats, const std::string& name) const {
+    if (stats.damaged == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!policy_ || !policy_(name)) {
+        throw ArchiveError("Data of " + name + " is damaged and cannot be restored.");
+    }
+}
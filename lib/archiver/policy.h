@@ -0,0 +1,49 @@
+#pragma once
+
+#include "tools/tools.h"
+
+#include <cinttypes>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Decisions the archiver cannot make on its own are left to the caller: a
+// command line asks the user, a service answers from its configuration.
+
+// What already exists where the archiver is about to write.
+enum class Existing : uint8_t {
+    kArchive, // Create() over an existing archive
+    kMember,  // Append() of a name the archive already has
+    kFile,    // Extract() over an existing file
+};
+
+enum class Resolution : uint8_t {
+    kReplace,
+    kSkip,
+    kCopy, // Extract() only, writes the file under the first free name_N
+};
+
+// Unset: everything is replaced.
+using ExistingPolicy = std::function<Resolution(Existing what, const std::string& name)>;
+// Whether to go on with data of `name` (a member or an archive) that could
+// not be restored. Unset: never.
+using DamagePolicy = std::function<bool(const std::string& name)>;
+// Told what the archiver skipped on its own and why. Unset: nothing is told.
+using WarningPolicy = std::function<void(const std::string& message)>;
+
+Resolution ResolveExisting(const ExistingPolicy& policy, Existing what, const std::string& name);
+
+// The damage policy of one archiver or reader, with the lock its calls take
+// turns on: calls from several threads reach the policy one at a time.
+class DamageHandler {
+public:
+    explicit DamageHandler(const DamagePolicy& policy = {});
+
+    const DamagePolicy& Policy() const;
+    // Does nothing for undamaged data, otherwise asks the policy and throws
+    // an ArchiveError if it does not accept the damage.
+    void Check(const CodecStats& stats, const std::string& name) const;
+private:
+    DamagePolicy policy_;
+    mutable std::mutex mutex_;
+};
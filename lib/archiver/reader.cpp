@@ -0,0 +1,190 @@
+#include "reader.h"
+#include "stats/stats.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <vector>
+
+HafReader::HafReader(const std::filesystem::path& archive_path, const ArchiveDirectory& directory, bool restore,
+                     const DamagePolicy& on_damage)
+    : archive_(std::make_unique<PositionalFile>(archive_path, O_RDONLY))
+    , directory_(directory)
+    , payload_(directory.Format().code_rate)
+    , restore_(restore)
+    , on_damage_(on_damage)
+{
+    if (!static_cast<PositionalFile&>(*archive_).IsOpen()) {
+        throw ArchiveError("Cannot read " + archive_path.filename().string() + ".");
+    }
+}
+
+HafReader::HafReader(std::istream& stream, bool restore, const DamagePolicy& on_damage)
+    : HafReader(std::make_unique<StreamSource>(stream), restore, on_damage)
+{}
+
+HafReader::HafReader(const char* data, size_t size, bool restore, const DamagePolicy& on_damage)
+    : HafReader(std::make_unique<MemorySource>(data, size), restore, on_damage)
+{}
+
+HafReader::HafReader(std::unique_ptr<PositionalSource> archive, bool restore, const DamagePolicy& on_damage)
+    : archive_(std::move(archive))
+    , restore_(restore)
+    , on_damage_(on_damage)
+{
+    Manipulator manipulator;
+    ArchiveFormat format;
+
+    if (!ReadArchiveFormat(*archive_, manipulator, format)) {
+        throw ArchiveError("The archive was written in a format this version cannot read.");
+    }
+
+    directory_ = ArchiveDirectory(format);
+
+    if (!directory_.Load(*archive_, manipulator)) {
+        throw ArchiveError("The directory of the archive is missing or damaged.");
+    }
+
+    payload_ = Manipulator(format.code_rate);
+}
+
+const ArchiveDirectory& HafReader::Directory() const {
+    return directory_;
+}
+
+size_t HafReader::ReadAt(const std::string& member, uint64_t offset, char* buffer, size_t length) const {
+    const ArchiveMember* found = directory_.Find(member);
+
+    if (found == nullptr) {
+        throw ArchiveError("There is no file " + member + " in the archive.");
+    }
+
+    uint64_t file_size = found->header.file_size;
+
+    if (offset >= file_size) {
+        return 0;
+    }
+
+    length = std::min<uint64_t>(length, file_size - offset);
+
+    if (HasFrames(found->header)) {
+        return ReadFramed(*found, offset, buffer, length);
+    }
+
+    // Codewords are decoded whole: the range grows to codeword boundaries.
+    uint64_t data_bytes = GetCodeParameters(payload_.Rate()).data_bytes;
+    uint64_t begin = offset / data_bytes * data_bytes;
+    uint64_t end = std::min(file_size, (offset + length + data_bytes - 1) / data_bytes * data_bytes);
+    std::vector<char> encoded;
+    std::vector<char> decoded;
+
+    // Pieces end on checksum chunk boundaries, a piece covering a whole
+    // chunk is checked against its checksum instead of being decoded.
+    while (begin < end) {
+        uint64_t chunk_end = std::min(file_size, (begin / kChecksumChunkSize + 1) * kChecksumChunkSize);
+        uint64_t piece_end = std::min(end, chunk_end);
+        size_t piece = piece_end - begin;
+        bool whole_chunk = begin % kChecksumChunkSize == 0 && piece_end == chunk_end;
+
+        encoded.resize(payload_.EncodedSize(piece));
+        decoded.resize(piece);
+
+        size_t bytes_read = archive_->ReadAt(encoded.data(), encoded.size(), found->data_offset + payload_.EncodedSize(begin));
+        size_t readable = payload_.ReadableLength(piece, bytes_read);
+        CodecStats stats = payload_.DecodeBlock(encoded.data(), readable, decoded.data(), restore_,
+                                                whole_chunk ? FindChecksums(*found, begin) : nullptr);
+
+        stats.damaged += payload_.LostCodewords(piece, bytes_read).damaged;
+        on_damage_.Check(stats, member);
+
+        uint64_t copy_from = std::max(begin, offset);
+        uint64_t copy_to = std::min(begin + readable, offset + length);
+
+        // Data a truncated archive lost ends the read.
+        if (copy_from >= copy_to) {
+            return copy_from - offset;
+        }
+
+        std::copy(decoded.begin() + (copy_from - begin), decoded.begin() + (copy_to - begin), buffer + (copy_from - offset));
+
+        if (readable < piece) {
+            return copy_to - offset;
+        }
+
+        begin = piece_end;
+    }
+
+    return length;
+}
+
+const std::vector<Frame>& HafReader::Frames(const ArchiveMember& member) const {
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    auto it = frames_.find(member.header.file_name);
+
+    if (it != frames_.end()) {
+        return it->second;
+    }
+
+    CodecStats stats;
+    std::vector<Frame> frames = ReadFrames(*archive_, member, payload_, stats);
+
+    on_damage_.Check(stats, member.header.file_name);
+
+    return frames_.emplace(member.header.file_name, std::move(frames)).first->second;
+}
+
+size_t HafReader::ReadFramed(const ArchiveMember& member, uint64_t offset, char* buffer, size_t length) const {
+    const std::vector<Frame>& frames = Frames(member);
+    std::vector<char> encoded;
+    std::vector<char> decoded;
+    std::vector<char> scratch;
+
+    // Frames of deduplicated members differ in length: the first one in the
+    // range is the last one starting at or before its offset.
+    auto first = std::upper_bound(frames.begin(), frames.end(), offset, [](uint64_t value, const Frame& frame) {
+        return value < frame.source_offset;
+    });
+
+    // Frames are decoded whole, only the part in the range is copied.
+    for (auto it = first - 1; it != frames.end() && it->source_offset < offset + length; ++it) {
+        const Frame& frame = *it;
+        uint64_t copy_from = std::max(frame.source_offset, offset);
+        uint64_t copy_to = std::min(frame.source_offset + frame.source_length, offset + length);
+
+        // A hole is only zeros, however long.
+        if (frame.hole) {
+            std::fill(buffer + (copy_from - offset), buffer + (copy_to - offset), 0);
+
+            continue;
+        }
+
+        encoded.resize(payload_.EncodedSize(frame.stored_length));
+        decoded.resize(frame.source_length);
+
+        size_t bytes_read = archive_->ReadAt(encoded.data(), encoded.size(), frame.position);
+
+        // A frame a truncated archive lost, or whose header was lost (already
+        // counted), ends the read.
+        if (bytes_read < encoded.size() || frame.stored_length == 0) {
+            on_damage_.Check(payload_.LostCodewords(frame.stored_length, bytes_read), member.header.file_name);
+
+            return copy_from - offset;
+        }
+
+        on_damage_.Check(DecodeFrame(payload_, frame, encoded.data(), decoded.data(), restore_, scratch), member.header.file_name);
+
+        std::copy(decoded.begin() + (copy_from - frame.source_offset), decoded.begin() + (copy_to - frame.source_offset),
+                  buffer + (copy_from - offset));
+    }
+
+    return length;
+}
+
+void HafReader::Extract(const std::string& member, std::ostream& stream) const {
+    std::vector<char> buffer(kChecksumChunkSize);
+    uint64_t offset = 0;
+
+    // Whole chunks, so clean ones are only checked against their checksums.
+    for (size_t bytes_read; (bytes_read = ReadAt(member, offset, buffer.data(), buffer.size())) != 0; offset += bytes_read) {
+        WriteCounted(stream, buffer.data(), bytes_read);
+    }
+}
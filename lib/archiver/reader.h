@@ -0,0 +1,56 @@
+#pragma once
+
+#include "compression.h"
+#include "directory.h"
+#include "io/positional_file.h"
+#include "policy.h"
+#include "tools/tools.h"
+
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Random access to member data. Every source byte sits at a known offset of
+// the encoded data, so a range of a member is read with one positional read
+// of just the codewords holding it, however large the member is. Compressed
+// and deduplicated members are read frame by frame, their frame headers are
+// walked (or their recipe read) once on first access.
+class HafReader {
+public:
+    HafReader(const std::filesystem::path& archive_path, const ArchiveDirectory& directory, bool restore = true,
+              const DamagePolicy& on_damage = {});
+    // An archive the caller holds: a seekable stream (e.g. one HafWriter
+    // wrote into) or a buffer, which has to outlive the reader. Reads from a
+    // stream take turns. The directory is read through the trailer, it is not
+    // rebuilt from member headers like that of an archive file.
+    explicit HafReader(std::istream& stream, bool restore = true, const DamagePolicy& on_damage = {});
+    HafReader(const char* data, size_t size, bool restore = true, const DamagePolicy& on_damage = {});
+
+    const ArchiveDirectory& Directory() const;
+
+    // Reads bytes [offset, offset + length) of the live member `member`.
+    // Returns the number of bytes read, less than `length` only past the end
+    // of the member or, once the damage policy took the loss, where a
+    // truncated archive lost its data. Safe to call from several threads at once.
+    size_t ReadAt(const std::string& member, uint64_t offset, char* buffer, size_t length) const;
+    // The whole member into `stream`.
+    void Extract(const std::string& member, std::ostream& stream) const;
+private:
+    std::unique_ptr<PositionalSource> archive_;
+    ArchiveDirectory directory_;
+    Manipulator payload_;
+    bool restore_;
+    DamageHandler on_damage_;
+    mutable std::mutex frames_mutex_;
+    mutable std::unordered_map<std::string, std::vector<Frame>> frames_;
+
+    HafReader(std::unique_ptr<PositionalSource> archive, bool restore, const DamagePolicy& on_damage);
+
+    const std::vector<Frame>& Frames(const ArchiveMember& member) const;
+    size_t ReadFramed(const ArchiveMember& member, uint64_t offset, char* buffer, size_t length) const;
+};
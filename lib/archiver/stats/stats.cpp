@@ -0,0 +1,246 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum Counter : size_t {
+    kBytesRead = kPhaseCount,
+    kBytesWritten,
+    kCodewordsChecked,
+    kCodewordsCorrected,
+    kCodewordsDamaged,
+    kOtherSyscalls,
+    kCounterCount,
+};
+
+const char* kPhaseNames[kPhaseCount] = {"header", "read", "decode", "encode", "write"};
+
+// Written only by the owning thread, atomics just make reading them from
+// CollectStats() well-defined. Relaxed load + store costs as much as a plain add.
+struct ThreadCounters {
+    std::atomic<uint64_t> values[kCounterCount] = {};
+    bool in_phase = false;
+
+    ThreadCounters();
+    ~ThreadCounters();
+};
+
+struct CounterRegistry {
+    std::mutex mutex;
+    std::vector<ThreadCounters*> live;
+    uint64_t finished[kCounterCount] = {};
+    uint64_t read_syscalls_base = 0;
+    uint64_t write_syscalls_base = 0;
+};
+
+CounterRegistry& GetRegistry();
+ThreadCounters& LocalCounters();
+void Add(size_t counter, uint64_t value);
+uint64_t Now();
+void ReadProcessSyscalls(uint64_t& reads, uint64_t& writes);
+
+CounterRegistry& GetRegistry() {
+    // Never destroyed: threads may still finish during static destruction.
+    static CounterRegistry* registry = new CounterRegistry;
+
+    return *registry;
+}
+
+ThreadCounters::ThreadCounters() {
+    CounterRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    registry.live.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters() {
+    CounterRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    for (size_t i = 0; i < kCounterCount; ++i) {
+        registry.finished[i] += values[i].load(std::memory_order_relaxed);
+    }
+
+    registry.live.erase(std::find(registry.live.begin(), registry.live.end(), this));
+}
+
+ThreadCounters& LocalCounters() {
+    thread_local ThreadCounters counters;
+
+    return counters;
+}
+
+void Add(size_t counter, uint64_t value) {
+    std::atomic<uint64_t>& target = LocalCounters().values[counter];
+
+    target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ReadProcessSyscalls(uint64_t& reads, uint64_t& writes) {
+    std::ifstream stream("/proc/self/io");
+
+    reads = 0;
+    writes = 0;
+
+    for (std::string key; stream >> key;) {
+        uint64_t value = 0;
+
+        stream >> value;
+
+        if (key == "syscr:") {
+            reads = value;
+        } else if (key == "syscw:") {
+            writes = value;
+        }
+    }
+}
+
+const char* PhaseName(Phase phase) {
+    return kPhaseNames[static_cast<size_t>(phase)];
+}
+
+void CountRead(uint64_t bytes) {
+    Add(kBytesRead, bytes);
+}
+
+void CountWritten(uint64_t bytes) {
+    Add(kBytesWritten, bytes);
+}
+
+void CountCodewords(uint64_t checked, uint64_t corrected, uint64_t damaged) {
+    Add(kCodewordsChecked, checked);
+
+    if (corrected != 0 || damaged != 0) {
+        Add(kCodewordsCorrected, corrected);
+        Add(kCodewordsDamaged, damaged);
+    }
+}
+
+void CountSyscalls(uint64_t count) {
+    Add(kOtherSyscalls, count);
+}
+
+size_t ReadCounted(std::istream& stream, char* buffer, size_t length) {
+    PhaseTimer timer(Phase::kRead);
+
+    stream.read(buffer, length);
+    CountRead(stream.gcount());
+
+    return stream.gcount();
+}
+
+void WriteCounted(std::ostream& stream, const char* buffer, size_t length) {
+    PhaseTimer timer(Phase::kWrite);
+
+    stream.write(buffer, length);
+    CountWritten(length);
+}
+
+PhaseTimer::PhaseTimer(Phase phase)
+    : phase_(phase)
+    , outermost_(!LocalCounters().in_phase)
+    , start_(0)
+{
+    if (outermost_) {
+        LocalCounters().in_phase = true;
+        start_ = Now();
+    }
+}
+
+PhaseTimer::~PhaseTimer() {
+    if (outermost_) {
+        Add(static_cast<size_t>(phase_), Now() - start_);
+        LocalCounters().in_phase = false;
+    }
+}
+
+OperationStats CollectStats() {
+    CounterRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    uint64_t totals[kCounterCount];
+    OperationStats stats;
+
+    std::copy(registry.finished, registry.finished + kCounterCount, totals);
+
+    for (ThreadCounters* counters: registry.live) {
+        for (size_t i = 0; i < kCounterCount; ++i) {
+            totals[i] += counters->values[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::copy(totals, totals + kPhaseCount, stats.phase_nanoseconds);
+    stats.bytes_read = totals[kBytesRead];
+    stats.bytes_written = totals[kBytesWritten];
+    stats.codewords_checked = totals[kCodewordsChecked];
+    stats.codewords_corrected = totals[kCodewordsCorrected];
+    stats.codewords_damaged = totals[kCodewordsDamaged];
+    stats.other_syscalls = totals[kOtherSyscalls];
+
+    ReadProcessSyscalls(stats.read_syscalls, stats.write_syscalls);
+    stats.read_syscalls -= std::min(stats.read_syscalls, registry.read_syscalls_base);
+    stats.write_syscalls -= std::min(stats.write_syscalls, registry.write_syscalls_base);
+
+    return stats;
+}
+
+void ResetStats() {
+    CounterRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    std::fill(registry.finished, registry.finished + kCounterCount, 0);
+
+    for (ThreadCounters* counters: registry.live) {
+        for (std::atomic<uint64_t>& value: counters->values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ReadProcessSyscalls(registry.read_syscalls_base, registry.write_syscalls_base);
+}
+
+void PrintStats(std::ostream& stream, const OperationStats& stats, double seconds, bool json) {
+    double read_rate = seconds > 0 ? stats.bytes_read / seconds : 0;
+    double write_rate = seconds > 0 ? stats.bytes_written / seconds : 0;
+
+    if (json) {
+        stream << "{\"seconds\": " << seconds << ", \"phases\": {";
+
+        for (size_t i = 0; i < kPhaseCount; ++i) {
+            stream << (i == 0 ? "" : ", ") << "\"" << kPhaseNames[i] << "\": " << stats.phase_nanoseconds[i] / 1e9;
+        }
+
+        stream << "}, \"bytes_read\": " << stats.bytes_read << ", \"bytes_written\": " << stats.bytes_written;
+        stream << ", \"read_bytes_per_second\": " << static_cast<uint64_t>(read_rate);
+        stream << ", \"write_bytes_per_second\": " << static_cast<uint64_t>(write_rate);
+        stream << ", \"codewords_checked\": " << stats.codewords_checked;
+        stream << ", \"codewords_corrected\": " << stats.codewords_corrected;
+        stream << ", \"codewords_uncorrectable\": " << stats.codewords_damaged;
+        stream << ", \"read_syscalls\": " << stats.read_syscalls << ", \"write_syscalls\": " << stats.write_syscalls;
+        stream << ", \"other_syscalls\": " << stats.other_syscalls << "}" << std::endl;
+
+        return;
+    }
+
+    stream << "Time: " << seconds << " s (";
+
+    for (size_t i = 0; i < kPhaseCount; ++i) {
+        stream << (i == 0 ? "" : ", ") << kPhaseNames[i] << " " << stats.phase_nanoseconds[i] / 1e9 << " s";
+    }
+
+    stream << ")" << std::endl;
+    stream << "Read: " << stats.bytes_read << " B (" << static_cast<uint64_t>(read_rate) << " B/s)" << std::endl;
+    stream << "Written: " << stats.bytes_written << " B (" << static_cast<uint64_t>(write_rate) << " B/s)" << std::endl;
+    stream << "Codewords checked: " << stats.codewords_checked << ", corrected: " << stats.codewords_corrected;
+    stream << ", uncorrectable: " << stats.codewords_damaged << std::endl;
+    stream << "Syscalls: " << stats.read_syscalls << " read, " << stats.write_syscalls << " write, ";
+    stream << stats.other_syscalls << " other" << std::endl;
+}
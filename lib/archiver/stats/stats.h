@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <iostream>
+
+// Operation counters. Always on: every thread updates only its own
+// counters (no locks, no shared cache lines), they are summed up when
+// somebody asks for them.
+
+enum class Phase : uint8_t {
+    kHeader, // archive, member and directory headers, including their I/O and decoding
+    kRead,
+    kDecode,
+    kEncode,
+    kWrite,
+};
+
+const size_t kPhaseCount = 5;
+
+struct OperationStats {
+    // Summed over threads, so several threads can spend more than the wall time.
+    uint64_t phase_nanoseconds[kPhaseCount] = {};
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t codewords_checked = 0;
+    uint64_t codewords_corrected = 0;
+    uint64_t codewords_damaged = 0;
+    // read/write-like calls as the kernel counts them for the process.
+    uint64_t read_syscalls = 0;
+    uint64_t write_syscalls = 0;
+    // mmap, munmap, madvise, fadvise, fallocate and copy_file_range calls.
+    uint64_t other_syscalls = 0;
+};
+
+const char* PhaseName(Phase phase);
+
+void CountRead(uint64_t bytes);
+void CountWritten(uint64_t bytes);
+void CountCodewords(uint64_t checked, uint64_t corrected, uint64_t damaged);
+void CountSyscalls(uint64_t count = 1);
+
+// Stream I/O that is counted and timed as kRead/kWrite.
+size_t ReadCounted(std::istream& stream, char* buffer, size_t length);
+void WriteCounted(std::ostream& stream, const char* buffer, size_t length);
+
+// Charges the time until its destruction to `phase`. Only the outermost
+// timer of a thread counts, so e.g. reading a header is all kHeader.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase);
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+    ~PhaseTimer();
+private:
+    Phase phase_;
+    bool outermost_;
+    uint64_t start_;
+};
+
+// Counters of all threads, running and finished, since the start of the
+// process or the last ResetStats(). Neither is meant to be called while an
+// operation is running.
+OperationStats CollectStats();
+void ResetStats();
+
+void PrintStats(std::ostream& stream, const OperationStats& stats, double seconds, bool json);
@@ -0,0 +1,85 @@
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#define HAMARC_X86_CRC32C
+#include <immintrin.h>
+#endif
+
+const uint32_t kCastagnoliPolynomial = 0x82F63B78; // reflected
+
+using Crc32cKernel = uint32_t (*)(const char* data, size_t length, uint32_t crc);
+
+uint32_t Crc32cScalar(const char* data, size_t length, uint32_t crc);
+Crc32cKernel SelectCrc32cKernel();
+
+constexpr std::array<uint32_t, 256> MakeCrc32cTable() {
+    std::array<uint32_t, 256> table{};
+
+    for (uint32_t byte = 0; byte < table.size(); ++byte) {
+        uint32_t crc = byte;
+
+        for (size_t bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (crc & 1 ? kCastagnoliPolynomial : 0);
+        }
+
+        table[byte] = crc;
+    }
+
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> kCrc32cTable = MakeCrc32cTable();
+
+uint32_t Crc32cScalar(const char* data, size_t length, uint32_t crc) {
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; ++i) {
+        crc = (crc >> 8) ^ kCrc32cTable[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+#ifdef HAMARC_X86_CRC32C
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSse42(const char* data, size_t length, uint32_t crc) {
+    uint64_t value = ~crc & 0xFFFFFFFF;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+
+        memcpy(&word, data + i, sizeof(word));
+        value = _mm_crc32_u64(value, word);
+    }
+
+    for (; i < length; ++i) {
+        value = _mm_crc32_u8(value, data[i]);
+    }
+
+    return ~static_cast<uint32_t>(value);
+}
+
+#endif
+
+Crc32cKernel SelectCrc32cKernel() {
+#ifdef HAMARC_X86_CRC32C
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.2")) {
+        return Crc32cSse42;
+    }
+#endif
+
+    return Crc32cScalar;
+}
+
+uint32_t Crc32c(const char* data, size_t length, uint32_t crc) {
+    static const Crc32cKernel kernel = SelectCrc32cKernel();
+
+    return kernel(data, length, crc);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+// CRC32C (Castagnoli), through the SSE4.2 crc32 instruction where the CPU
+// has it. `crc` continues an earlier value, 0 starts a new one.
+uint32_t Crc32c(const char* data, size_t length, uint32_t crc = 0);
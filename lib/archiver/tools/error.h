@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdexcept>
+
+// Thrown by the archiver libraries for anything they cannot go on with:
+// unreadable or unwritable files, unknown formats, damaged data the caller
+// chose not to accept. The message is meant for the user.
+class ArchiveError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
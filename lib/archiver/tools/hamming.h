@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+
+// Extended Hamming(13, 8) code used for every byte of an archive.
+//
+// Codeword layout (bit i of the 16-bit little-endian word is position i + 1):
+//     bits 0, 1, 3, 7        - parity bits
+//     bits 2, 4, 5, 6, 8..11 - data bits (least significant data bit first)
+//     bit 12                 - overall parity of bits 0..11
+//     bits 13..15            - always zero, ignored on decode
+
+const uint8_t kBitsInBytes = 8;
+const uint8_t kHammingByte = 2;
+const size_t kHammingPositions = 12;
+const size_t kCodewordBits = kHammingPositions + 1;
+const uint16_t kCodewordMask = (1 << kCodewordBits) - 1;
+
+enum class CodewordState : uint8_t {
+    kClean,
+    kCorrected,
+    kDamaged,
+};
+
+struct DecodedCodeword {
+    uint8_t raw = 0;      // data bits as they are stored
+    uint8_t restored = 0; // data bits after single-error correction
+    CodewordState state = CodewordState::kClean;
+};
+
+constexpr bool IsParityPosition(size_t index) {
+    return (index & (index + 1)) == 0;
+}
+
+constexpr uint8_t ExtractByte(uint16_t codeword) {
+    uint8_t byte = 0;
+    size_t data_bit = 0;
+
+    for (size_t index = 0; index < kHammingPositions; ++index) {
+        if (IsParityPosition(index)) {
+            continue;
+        }
+
+        byte |= ((codeword >> index) & 1) << data_bit;
+        ++data_bit;
+    }
+
+    return byte;
+}
+
+constexpr uint16_t EncodeByte(uint8_t byte) {
+    uint16_t codeword = 0;
+    size_t syndrome = 0;
+    size_t data_bit = 0;
+
+    for (size_t index = 0; index < kHammingPositions; ++index) {
+        if (IsParityPosition(index)) {
+            continue;
+        }
+
+        if ((byte >> data_bit) & 1) {
+            codeword |= 1 << index;
+            syndrome ^= index + 1;
+        }
+
+        ++data_bit;
+    }
+
+    for (size_t redundant = 1; redundant <= kHammingPositions; redundant <<= 1) {
+        if (syndrome & redundant) {
+            codeword |= 1 << (redundant - 1);
+        }
+    }
+
+    uint16_t total_xor = 0;
+
+    for (size_t index = 0; index < kHammingPositions; ++index) {
+        total_xor ^= (codeword >> index) & 1;
+    }
+
+    return codeword | (total_xor << kHammingPositions);
+}
+
+constexpr DecodedCodeword DecodeCodeword(uint16_t codeword) {
+    size_t syndrome = 0;
+    uint8_t total_xor = (codeword >> kHammingPositions) & 1;
+
+    for (size_t index = 0; index < kHammingPositions; ++index) {
+        if ((codeword >> index) & 1) {
+            syndrome ^= index + 1;
+            total_xor ^= 1;
+        }
+    }
+
+    DecodedCodeword result;
+
+    result.raw = ExtractByte(codeword);
+    result.restored = result.raw;
+
+    if (syndrome == 0 && total_xor == 0) {
+        return result;
+    }
+
+    if (total_xor == 0 || syndrome > kCodewordBits) {
+        // Even number of flipped bits (or a position outside of the codeword).
+        result.state = CodewordState::kDamaged;
+
+        return result;
+    }
+
+    if (syndrome != 0 && syndrome <= kHammingPositions) {
+        result.restored = ExtractByte(codeword ^ (1 << (syndrome - 1)));
+    }
+
+    result.state = CodewordState::kCorrected;
+
+    return result;
+}
+
+constexpr std::array<uint16_t, 1 << kBitsInBytes> MakeEncodeTable() {
+    std::array<uint16_t, 1 << kBitsInBytes> table{};
+
+    for (size_t byte = 0; byte < table.size(); ++byte) {
+        table[byte] = EncodeByte(byte);
+    }
+
+    return table;
+}
+
+constexpr std::array<DecodedCodeword, 1 << kCodewordBits> MakeDecodeTable() {
+    std::array<DecodedCodeword, 1 << kCodewordBits> table{};
+
+    for (size_t codeword = 0; codeword < table.size(); ++codeword) {
+        table[codeword] = DecodeCodeword(codeword);
+    }
+
+    return table;
+}
+
+// Bits 13..15 never take part in decoding, so the correction table is indexed
+// by the 13 significant bits only.
+inline constexpr std::array<uint16_t, 1 << kBitsInBytes> kEncodeTable = MakeEncodeTable();
+inline constexpr std::array<DecodedCodeword, 1 << kCodewordBits> kDecodeTable = MakeDecodeTable();
@@ -0,0 +1,581 @@
+#include "kernels.h"
+#include "hamming.h"
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAMARC_X86_KERNELS
+// GCC 12 takes the self-initialized _mm512_undefined_*() of its own
+// headers for uninitialized reads once they are inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+void EncodeScalar(const uint8_t* byte_seq, size_t length, uint8_t* encoded);
+void DecodeScalar(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats);
+void StripScalar(const uint8_t* encoded, size_t length, uint8_t* byte_seq);
+
+void EncodeScalar(const uint8_t* byte_seq, size_t length, uint8_t* encoded) {
+    for (size_t i = 0; i < length; ++i) {
+        uint16_t codeword = kEncodeTable[byte_seq[i]];
+
+        encoded[kHammingByte * i] = codeword & 0xFF;
+        encoded[kHammingByte * i + 1] = codeword >> kBitsInBytes;
+    }
+}
+
+void DecodeScalar(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats) {
+    for (size_t i = 0; i < length; ++i) {
+        uint16_t codeword = encoded[kHammingByte * i] | (encoded[kHammingByte * i + 1] << kBitsInBytes);
+        const DecodedCodeword& decoded = kDecodeTable[codeword & kCodewordMask];
+
+        stats.corrected += decoded.state == CodewordState::kCorrected;
+        stats.damaged += decoded.state == CodewordState::kDamaged;
+
+        byte_seq[i] = restore ? decoded.restored : decoded.raw;
+    }
+}
+
+// Data bits 0-3 are bits 2, 4, 5, 6 of the low byte, data bits 4-7 the low
+// nibble of the high byte (see hamming.h).
+void StripScalar(const uint8_t* encoded, size_t length, uint8_t* byte_seq) {
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t low = encoded[kHammingByte * i];
+        uint8_t high = encoded[kHammingByte * i + 1];
+
+        byte_seq[i] = ((low >> 2) & 0x01) | ((low >> 3) & 0x0E) | (high << 4);
+    }
+}
+
+const CodecKernels kScalarKernels = {"scalar", EncodeScalar, DecodeScalar, StripScalar};
+
+#ifdef HAMARC_X86_KERNELS
+
+// Both the code and the syndrome are linear over GF(2), so every table below
+// is indexed by a single nibble and the partial results are combined by XOR.
+// That fits pshufb, which performs 16 (32, 64) nibble lookups at once.
+
+using NibbleTable = std::array<uint8_t, 16>;
+
+const uint8_t kParityFlag = 0x10;
+
+constexpr NibbleTable MakeEncodeNibbles(size_t shift, size_t byte) {
+    NibbleTable table{};
+
+    for (size_t nibble = 0; nibble < table.size(); ++nibble) {
+        table[nibble] = EncodeByte(nibble << shift) >> (kBitsInBytes * byte);
+    }
+
+    return table;
+}
+
+// Low four bits - syndrome contribution, kParityFlag - overall parity contribution.
+constexpr NibbleTable MakeSyndromeNibbles(size_t nibble_index) {
+    NibbleTable table{};
+
+    for (size_t nibble = 0; nibble < table.size(); ++nibble) {
+        uint8_t value = 0;
+
+        for (size_t bit = 0; bit < 4; ++bit) {
+            size_t index = 4 * nibble_index + bit;
+
+            if (!((nibble >> bit) & 1) || index > kHammingPositions) {
+                continue;
+            }
+
+            if (index < kHammingPositions) {
+                value ^= index + 1;
+            }
+
+            value ^= kParityFlag;
+        }
+
+        table[nibble] = value;
+    }
+
+    return table;
+}
+
+constexpr NibbleTable MakeDataNibbles(size_t nibble_index) {
+    NibbleTable table{};
+
+    for (size_t nibble = 0; nibble < table.size(); ++nibble) {
+        table[nibble] = ExtractByte(nibble << (4 * nibble_index));
+    }
+
+    return table;
+}
+
+// Data bits flipped by a correction, indexed by syndrome.
+constexpr NibbleTable MakeFixNibbles() {
+    NibbleTable table{};
+
+    for (size_t syndrome = 1; syndrome <= kHammingPositions; ++syndrome) {
+        table[syndrome] = ExtractByte(1 << (syndrome - 1));
+    }
+
+    return table;
+}
+
+// Syndromes which cannot come from a single flipped bit even with odd parity.
+constexpr NibbleTable MakeOutOfRangeNibbles() {
+    NibbleTable table{};
+
+    for (size_t syndrome = kCodewordBits + 1; syndrome < table.size(); ++syndrome) {
+        table[syndrome] = 0xFF;
+    }
+
+    return table;
+}
+
+alignas(16) constexpr NibbleTable kEncodeLowLow = MakeEncodeNibbles(0, 0);
+alignas(16) constexpr NibbleTable kEncodeLowHigh = MakeEncodeNibbles(0, 1);
+alignas(16) constexpr NibbleTable kEncodeHighLow = MakeEncodeNibbles(4, 0);
+alignas(16) constexpr NibbleTable kEncodeHighHigh = MakeEncodeNibbles(4, 1);
+alignas(16) constexpr std::array<NibbleTable, 4> kSyndromeNibbles = {
+    MakeSyndromeNibbles(0), MakeSyndromeNibbles(1), MakeSyndromeNibbles(2), MakeSyndromeNibbles(3),
+};
+alignas(16) constexpr std::array<NibbleTable, 3> kDataNibbles = {
+    MakeDataNibbles(0), MakeDataNibbles(1), MakeDataNibbles(2),
+};
+alignas(16) constexpr NibbleTable kFixNibbles = MakeFixNibbles();
+alignas(16) constexpr NibbleTable kOutOfRangeNibbles = MakeOutOfRangeNibbles();
+alignas(16) constexpr uint8_t kSplitCodewords[16] = {0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15};
+
+// ---------------------------------SSE4.2---------------------------------
+
+__attribute__((target("sse4.2,popcnt")))
+inline __m128i LoadTable128(const uint8_t* table) {
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(table));
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void EncodeSse42(const uint8_t* byte_seq, size_t length, uint8_t* encoded) {
+    const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    const __m128i low_low = LoadTable128(kEncodeLowLow.data());
+    const __m128i low_high = LoadTable128(kEncodeLowHigh.data());
+    const __m128i high_low = LoadTable128(kEncodeHighLow.data());
+    const __m128i high_high = LoadTable128(kEncodeHighHigh.data());
+
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(byte_seq + i));
+        __m128i low = _mm_and_si128(bytes, nibble_mask);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask);
+
+        __m128i first = _mm_xor_si128(_mm_shuffle_epi8(low_low, low), _mm_shuffle_epi8(high_low, high));
+        __m128i second = _mm_xor_si128(_mm_shuffle_epi8(low_high, low), _mm_shuffle_epi8(high_high, high));
+
+        __m128i* output = reinterpret_cast<__m128i*>(encoded + kHammingByte * i);
+
+        _mm_storeu_si128(output, _mm_unpacklo_epi8(first, second));
+        _mm_storeu_si128(output + 1, _mm_unpackhi_epi8(first, second));
+    }
+
+    EncodeScalar(byte_seq + i, length - i, encoded + kHammingByte * i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void DecodeSse42(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats) {
+    const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    const __m128i parity_flag = _mm_set1_epi8(kParityFlag);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i split = LoadTable128(kSplitCodewords);
+    const __m128i syndrome_0 = LoadTable128(kSyndromeNibbles[0].data());
+    const __m128i syndrome_1 = LoadTable128(kSyndromeNibbles[1].data());
+    const __m128i syndrome_2 = LoadTable128(kSyndromeNibbles[2].data());
+    const __m128i syndrome_3 = LoadTable128(kSyndromeNibbles[3].data());
+    const __m128i data_0 = LoadTable128(kDataNibbles[0].data());
+    const __m128i data_1 = LoadTable128(kDataNibbles[1].data());
+    const __m128i data_2 = LoadTable128(kDataNibbles[2].data());
+    const __m128i fix = LoadTable128(kFixNibbles.data());
+    const __m128i out_of_range = LoadTable128(kOutOfRangeNibbles.data());
+
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        const __m128i* input = reinterpret_cast<const __m128i*>(encoded + kHammingByte * i);
+        __m128i first = _mm_shuffle_epi8(_mm_loadu_si128(input), split);
+        __m128i second = _mm_shuffle_epi8(_mm_loadu_si128(input + 1), split);
+        __m128i low = _mm_unpacklo_epi64(first, second);
+        __m128i high = _mm_unpackhi_epi64(first, second);
+
+        __m128i nibble_0 = _mm_and_si128(low, nibble_mask);
+        __m128i nibble_1 = _mm_and_si128(_mm_srli_epi16(low, 4), nibble_mask);
+        __m128i nibble_2 = _mm_and_si128(high, nibble_mask);
+        __m128i nibble_3 = _mm_and_si128(_mm_srli_epi16(high, 4), nibble_mask);
+
+        __m128i syndrome = _mm_xor_si128(
+            _mm_xor_si128(_mm_shuffle_epi8(syndrome_0, nibble_0), _mm_shuffle_epi8(syndrome_1, nibble_1)),
+            _mm_xor_si128(_mm_shuffle_epi8(syndrome_2, nibble_2), _mm_shuffle_epi8(syndrome_3, nibble_3))
+        );
+        __m128i raw = _mm_xor_si128(
+            _mm_xor_si128(_mm_shuffle_epi8(data_0, nibble_0), _mm_shuffle_epi8(data_1, nibble_1)),
+            _mm_shuffle_epi8(data_2, nibble_2)
+        );
+
+        __m128i odd = _mm_cmpeq_epi8(_mm_and_si128(syndrome, parity_flag), parity_flag);
+        __m128i unlocated = _mm_cmpeq_epi8(_mm_and_si128(syndrome, nibble_mask), zero);
+        __m128i damaged = _mm_or_si128(
+            _mm_andnot_si128(_mm_or_si128(odd, unlocated), _mm_set1_epi8(-1)),
+            _mm_and_si128(odd, _mm_shuffle_epi8(out_of_range, syndrome))
+        );
+        __m128i clean = _mm_cmpeq_epi8(syndrome, zero);
+
+        uint32_t damaged_bits = _mm_movemask_epi8(damaged);
+        uint32_t touched_bits = ~_mm_movemask_epi8(clean) & 0xFFFF;
+
+        stats.damaged += _mm_popcnt_u32(damaged_bits);
+        stats.corrected += _mm_popcnt_u32(touched_bits & ~damaged_bits);
+
+        if (restore) {
+            raw = _mm_xor_si128(raw, _mm_and_si128(odd, _mm_shuffle_epi8(fix, syndrome)));
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(byte_seq + i), raw);
+    }
+
+    DecodeScalar(encoded + kHammingByte * i, length - i, byte_seq + i, restore, stats);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+void StripSse42(const uint8_t* encoded, size_t length, uint8_t* byte_seq) {
+    const __m128i split = LoadTable128(kSplitCodewords);
+    const __m128i bit_0 = _mm_set1_epi8(0x01);
+    const __m128i bits_1_3 = _mm_set1_epi8(0x0E);
+    const __m128i bits_4_7 = _mm_set1_epi8(static_cast<char>(0xF0));
+
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        const __m128i* input = reinterpret_cast<const __m128i*>(encoded + kHammingByte * i);
+        __m128i first = _mm_shuffle_epi8(_mm_loadu_si128(input), split);
+        __m128i second = _mm_shuffle_epi8(_mm_loadu_si128(input + 1), split);
+        __m128i low = _mm_unpacklo_epi64(first, second);
+        __m128i high = _mm_unpackhi_epi64(first, second);
+
+        __m128i raw = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi16(low, 2), bit_0), _mm_and_si128(_mm_srli_epi16(low, 3), bits_1_3)),
+            _mm_and_si128(_mm_slli_epi16(high, 4), bits_4_7)
+        );
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(byte_seq + i), raw);
+    }
+
+    StripScalar(encoded + kHammingByte * i, length - i, byte_seq + i);
+}
+
+// ----------------------------------AVX2----------------------------------
+
+__attribute__((target("avx2,popcnt")))
+inline __m256i LoadTable256(const uint8_t* table) {
+    return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+__attribute__((target("avx2,popcnt")))
+void EncodeAvx2(const uint8_t* byte_seq, size_t length, uint8_t* encoded) {
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    const __m256i low_low = LoadTable256(kEncodeLowLow.data());
+    const __m256i low_high = LoadTable256(kEncodeLowHigh.data());
+    const __m256i high_low = LoadTable256(kEncodeHighLow.data());
+    const __m256i high_high = LoadTable256(kEncodeHighHigh.data());
+
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(byte_seq + i));
+        __m256i low = _mm256_and_si256(bytes, nibble_mask);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask);
+
+        __m256i first = _mm256_xor_si256(_mm256_shuffle_epi8(low_low, low), _mm256_shuffle_epi8(high_low, high));
+        __m256i second = _mm256_xor_si256(_mm256_shuffle_epi8(low_high, low), _mm256_shuffle_epi8(high_high, high));
+
+        // Unpacking works per 128-bit lane, so the halves have to be regrouped.
+        __m256i lower = _mm256_unpacklo_epi8(first, second);
+        __m256i upper = _mm256_unpackhi_epi8(first, second);
+
+        __m256i* output = reinterpret_cast<__m256i*>(encoded + kHammingByte * i);
+
+        _mm256_storeu_si256(output, _mm256_permute2x128_si256(lower, upper, 0x20));
+        _mm256_storeu_si256(output + 1, _mm256_permute2x128_si256(lower, upper, 0x31));
+    }
+
+    EncodeSse42(byte_seq + i, length - i, encoded + kHammingByte * i);
+}
+
+__attribute__((target("avx2,popcnt")))
+void DecodeAvx2(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats) {
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    const __m256i parity_flag = _mm256_set1_epi8(kParityFlag);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i split = LoadTable256(kSplitCodewords);
+    const __m256i syndrome_0 = LoadTable256(kSyndromeNibbles[0].data());
+    const __m256i syndrome_1 = LoadTable256(kSyndromeNibbles[1].data());
+    const __m256i syndrome_2 = LoadTable256(kSyndromeNibbles[2].data());
+    const __m256i syndrome_3 = LoadTable256(kSyndromeNibbles[3].data());
+    const __m256i data_0 = LoadTable256(kDataNibbles[0].data());
+    const __m256i data_1 = LoadTable256(kDataNibbles[1].data());
+    const __m256i data_2 = LoadTable256(kDataNibbles[2].data());
+    const __m256i fix = LoadTable256(kFixNibbles.data());
+    const __m256i out_of_range = LoadTable256(kOutOfRangeNibbles.data());
+
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        const __m256i* input = reinterpret_cast<const __m256i*>(encoded + kHammingByte * i);
+        __m256i first = _mm256_shuffle_epi8(_mm256_loadu_si256(input), split);
+        __m256i second = _mm256_shuffle_epi8(_mm256_loadu_si256(input + 1), split);
+
+        // Quadwords hold codewords 0-7, 16-23, 8-15, 24-31 from here on.
+        __m256i low = _mm256_unpacklo_epi64(first, second);
+        __m256i high = _mm256_unpackhi_epi64(first, second);
+
+        __m256i nibble_0 = _mm256_and_si256(low, nibble_mask);
+        __m256i nibble_1 = _mm256_and_si256(_mm256_srli_epi16(low, 4), nibble_mask);
+        __m256i nibble_2 = _mm256_and_si256(high, nibble_mask);
+        __m256i nibble_3 = _mm256_and_si256(_mm256_srli_epi16(high, 4), nibble_mask);
+
+        __m256i syndrome = _mm256_xor_si256(
+            _mm256_xor_si256(_mm256_shuffle_epi8(syndrome_0, nibble_0), _mm256_shuffle_epi8(syndrome_1, nibble_1)),
+            _mm256_xor_si256(_mm256_shuffle_epi8(syndrome_2, nibble_2), _mm256_shuffle_epi8(syndrome_3, nibble_3))
+        );
+        __m256i raw = _mm256_xor_si256(
+            _mm256_xor_si256(_mm256_shuffle_epi8(data_0, nibble_0), _mm256_shuffle_epi8(data_1, nibble_1)),
+            _mm256_shuffle_epi8(data_2, nibble_2)
+        );
+
+        __m256i odd = _mm256_cmpeq_epi8(_mm256_and_si256(syndrome, parity_flag), parity_flag);
+        __m256i unlocated = _mm256_cmpeq_epi8(_mm256_and_si256(syndrome, nibble_mask), zero);
+        __m256i damaged = _mm256_or_si256(
+            _mm256_andnot_si256(_mm256_or_si256(odd, unlocated), _mm256_set1_epi8(-1)),
+            _mm256_and_si256(odd, _mm256_shuffle_epi8(out_of_range, syndrome))
+        );
+        __m256i clean = _mm256_cmpeq_epi8(syndrome, zero);
+
+        uint32_t damaged_bits = _mm256_movemask_epi8(damaged);
+        uint32_t touched_bits = ~_mm256_movemask_epi8(clean);
+
+        stats.damaged += _mm_popcnt_u32(damaged_bits);
+        stats.corrected += _mm_popcnt_u32(touched_bits & ~damaged_bits);
+
+        if (restore) {
+            raw = _mm256_xor_si256(raw, _mm256_and_si256(odd, _mm256_shuffle_epi8(fix, syndrome)));
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(byte_seq + i), _mm256_permute4x64_epi64(raw, 0xD8));
+    }
+
+    DecodeSse42(encoded + kHammingByte * i, length - i, byte_seq + i, restore, stats);
+}
+
+__attribute__((target("avx2,popcnt")))
+void StripAvx2(const uint8_t* encoded, size_t length, uint8_t* byte_seq) {
+    const __m256i split = LoadTable256(kSplitCodewords);
+    const __m256i bit_0 = _mm256_set1_epi8(0x01);
+    const __m256i bits_1_3 = _mm256_set1_epi8(0x0E);
+    const __m256i bits_4_7 = _mm256_set1_epi8(static_cast<char>(0xF0));
+
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        const __m256i* input = reinterpret_cast<const __m256i*>(encoded + kHammingByte * i);
+        __m256i first = _mm256_shuffle_epi8(_mm256_loadu_si256(input), split);
+        __m256i second = _mm256_shuffle_epi8(_mm256_loadu_si256(input + 1), split);
+        __m256i low = _mm256_unpacklo_epi64(first, second);
+        __m256i high = _mm256_unpackhi_epi64(first, second);
+
+        __m256i raw = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(low, 2), bit_0), _mm256_and_si256(_mm256_srli_epi16(low, 3), bits_1_3)),
+            _mm256_and_si256(_mm256_slli_epi16(high, 4), bits_4_7)
+        );
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(byte_seq + i), _mm256_permute4x64_epi64(raw, 0xD8));
+    }
+
+    StripSse42(encoded + kHammingByte * i, length - i, byte_seq + i);
+}
+
+// --------------------------------AVX-512---------------------------------
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+inline __m512i LoadTable512(const uint8_t* table) {
+    return _mm512_broadcast_i32x4(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+void EncodeAvx512(const uint8_t* byte_seq, size_t length, uint8_t* encoded) {
+    const __m512i nibble_mask = _mm512_set1_epi8(0x0F);
+    const __m512i low_low = LoadTable512(kEncodeLowLow.data());
+    const __m512i low_high = LoadTable512(kEncodeLowHigh.data());
+    const __m512i high_low = LoadTable512(kEncodeHighLow.data());
+    const __m512i high_high = LoadTable512(kEncodeHighHigh.data());
+    const __m512i lower_order = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i upper_order = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+
+    size_t i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        __m512i bytes = _mm512_loadu_si512(byte_seq + i);
+        __m512i low = _mm512_and_si512(bytes, nibble_mask);
+        __m512i high = _mm512_and_si512(_mm512_srli_epi16(bytes, 4), nibble_mask);
+
+        __m512i first = _mm512_xor_si512(_mm512_shuffle_epi8(low_low, low), _mm512_shuffle_epi8(high_low, high));
+        __m512i second = _mm512_xor_si512(_mm512_shuffle_epi8(low_high, low), _mm512_shuffle_epi8(high_high, high));
+
+        __m512i lower = _mm512_unpacklo_epi8(first, second);
+        __m512i upper = _mm512_unpackhi_epi8(first, second);
+
+        uint8_t* output = encoded + kHammingByte * i;
+
+        _mm512_storeu_si512(output, _mm512_permutex2var_epi64(lower, lower_order, upper));
+        _mm512_storeu_si512(output + 64, _mm512_permutex2var_epi64(lower, upper_order, upper));
+    }
+
+    EncodeAvx2(byte_seq + i, length - i, encoded + kHammingByte * i);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+void DecodeAvx512(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats) {
+    const __m512i nibble_mask = _mm512_set1_epi8(0x0F);
+    const __m512i parity_flag = _mm512_set1_epi8(kParityFlag);
+    const __m512i split = LoadTable512(kSplitCodewords);
+    const __m512i syndrome_0 = LoadTable512(kSyndromeNibbles[0].data());
+    const __m512i syndrome_1 = LoadTable512(kSyndromeNibbles[1].data());
+    const __m512i syndrome_2 = LoadTable512(kSyndromeNibbles[2].data());
+    const __m512i syndrome_3 = LoadTable512(kSyndromeNibbles[3].data());
+    const __m512i data_0 = LoadTable512(kDataNibbles[0].data());
+    const __m512i data_1 = LoadTable512(kDataNibbles[1].data());
+    const __m512i data_2 = LoadTable512(kDataNibbles[2].data());
+    const __m512i fix = LoadTable512(kFixNibbles.data());
+    const __m512i out_of_range = LoadTable512(kOutOfRangeNibbles.data());
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+    size_t i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        const uint8_t* input = encoded + kHammingByte * i;
+        __m512i first = _mm512_shuffle_epi8(_mm512_loadu_si512(input), split);
+        __m512i second = _mm512_shuffle_epi8(_mm512_loadu_si512(input + 64), split);
+        __m512i low = _mm512_unpacklo_epi64(first, second);
+        __m512i high = _mm512_unpackhi_epi64(first, second);
+
+        __m512i nibble_0 = _mm512_and_si512(low, nibble_mask);
+        __m512i nibble_1 = _mm512_and_si512(_mm512_srli_epi16(low, 4), nibble_mask);
+        __m512i nibble_2 = _mm512_and_si512(high, nibble_mask);
+        __m512i nibble_3 = _mm512_and_si512(_mm512_srli_epi16(high, 4), nibble_mask);
+
+        __m512i syndrome = _mm512_xor_si512(
+            _mm512_xor_si512(_mm512_shuffle_epi8(syndrome_0, nibble_0), _mm512_shuffle_epi8(syndrome_1, nibble_1)),
+            _mm512_xor_si512(_mm512_shuffle_epi8(syndrome_2, nibble_2), _mm512_shuffle_epi8(syndrome_3, nibble_3))
+        );
+        __m512i raw = _mm512_xor_si512(
+            _mm512_xor_si512(_mm512_shuffle_epi8(data_0, nibble_0), _mm512_shuffle_epi8(data_1, nibble_1)),
+            _mm512_shuffle_epi8(data_2, nibble_2)
+        );
+
+        __mmask64 odd = _mm512_test_epi8_mask(syndrome, parity_flag);
+        __mmask64 located = _mm512_test_epi8_mask(syndrome, nibble_mask);
+        __m512i far_syndrome = _mm512_shuffle_epi8(out_of_range, syndrome);
+        __mmask64 far = _mm512_test_epi8_mask(far_syndrome, far_syndrome);
+        __mmask64 damaged = (~odd & located) | (odd & far);
+        __mmask64 touched = odd | located;
+
+        stats.damaged += _mm_popcnt_u64(damaged);
+        stats.corrected += _mm_popcnt_u64(touched & ~damaged);
+
+        if (restore) {
+            raw = _mm512_xor_si512(raw, _mm512_maskz_shuffle_epi8(odd, fix, syndrome));
+        }
+
+        _mm512_storeu_si512(byte_seq + i, _mm512_permutexvar_epi64(order, raw));
+    }
+
+    DecodeAvx2(encoded + kHammingByte * i, length - i, byte_seq + i, restore, stats);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+void StripAvx512(const uint8_t* encoded, size_t length, uint8_t* byte_seq) {
+    const __m512i split = LoadTable512(kSplitCodewords);
+    const __m512i bit_0 = _mm512_set1_epi8(0x01);
+    const __m512i bits_1_3 = _mm512_set1_epi8(0x0E);
+    const __m512i bits_4_7 = _mm512_set1_epi8(static_cast<char>(0xF0));
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+    size_t i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        const uint8_t* input = encoded + kHammingByte * i;
+        __m512i first = _mm512_shuffle_epi8(_mm512_loadu_si512(input), split);
+        __m512i second = _mm512_shuffle_epi8(_mm512_loadu_si512(input + 64), split);
+        __m512i low = _mm512_unpacklo_epi64(first, second);
+        __m512i high = _mm512_unpackhi_epi64(first, second);
+
+        __m512i raw = _mm512_or_si512(
+            _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(low, 2), bit_0), _mm512_and_si512(_mm512_srli_epi16(low, 3), bits_1_3)),
+            _mm512_and_si512(_mm512_slli_epi16(high, 4), bits_4_7)
+        );
+
+        _mm512_storeu_si512(byte_seq + i, _mm512_permutexvar_epi64(order, raw));
+    }
+
+    StripAvx2(encoded + kHammingByte * i, length - i, byte_seq + i);
+}
+
+const CodecKernels kSse42Kernels = {"sse4.2", EncodeSse42, DecodeSse42, StripSse42};
+const CodecKernels kAvx2Kernels = {"avx2", EncodeAvx2, DecodeAvx2, StripAvx2};
+const CodecKernels kAvx512Kernels = {"avx512", EncodeAvx512, DecodeAvx512, StripAvx512};
+
+#endif
+
+const CodecKernels& SelectCodecKernels() {
+    const char* forced = std::getenv("HAMARC_KERNEL");
+    const CodecKernels* best = &kScalarKernels;
+
+#ifdef HAMARC_X86_KERNELS
+    __builtin_cpu_init();
+
+    const CodecKernels* supported[] = {
+        __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt") ? &kSse42Kernels : nullptr,
+        __builtin_cpu_supports("avx2") ? &kAvx2Kernels : nullptr,
+        __builtin_cpu_supports("avx512bw") ? &kAvx512Kernels : nullptr,
+    };
+
+    for (const CodecKernels* kernels: supported) {
+        if (kernels == nullptr) {
+            break;
+        }
+
+        if (forced != nullptr && strcmp(forced, kernels->name) == 0) {
+            return *kernels;
+        }
+
+        best = kernels;
+    }
+#endif
+
+    if (forced != nullptr && strcmp(forced, kScalarKernels.name) == 0) {
+        return kScalarKernels;
+    }
+
+    return *best;
+}
+
+const CodecKernels& GetCodecKernels() {
+    static const CodecKernels& kernels = SelectCodecKernels();
+
+    return kernels;
+}
+
+const CodecKernels& GetScalarKernels() {
+    return kScalarKernels;
+}
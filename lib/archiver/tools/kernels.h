@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+// Payload codes an archive can be written with. Headers and the directory
+// always use the (13, 8) code.
+enum class CodeRate : uint8_t {
+    kHamming13_8 = 0,
+    kSecded39_32 = 1,
+    kSecded72_64 = 2,
+};
+
+struct CodeParameters {
+    const char* name;
+    size_t data_bytes;     // source bytes per codeword
+    size_t codeword_bytes; // encoded bytes per codeword
+};
+
+struct CodecStats {
+    uint64_t corrected = 0;
+    uint64_t damaged = 0;
+};
+
+// `encoded` holds EncodedSize(rate, length) bytes, `length` is always the
+// number of source bytes. A partial last codeword is padded with zeros.
+using EncodeKernel = void (*)(const uint8_t* byte_seq, size_t length, uint8_t* encoded);
+using DecodeKernel = void (*)(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats);
+// Takes the data bits out as they are, without computing any syndrome.
+using StripKernel = void (*)(const uint8_t* encoded, size_t length, uint8_t* byte_seq);
+
+struct CodecKernels {
+    const char* name;
+    EncodeKernel encode;
+    DecodeKernel decode;
+    StripKernel strip;
+};
+
+// Best kernels supported by the running CPU, picked once on first use.
+// HAMARC_KERNEL=scalar|sse4.2|avx2|avx512 forces a particular (supported) one.
+const CodecKernels& GetCodecKernels();
+const CodecKernels& GetScalarKernels();
+
+// Kernels of the given payload code, (13, 8) goes through GetCodecKernels().
+const CodecKernels& GetCodecKernels(CodeRate rate);
+
+// Returns nullptr for values that are not a known CodeRate.
+const CodeParameters* FindCodeParameters(uint32_t rate);
+const CodeParameters& GetCodeParameters(CodeRate rate);
+uint64_t EncodedSize(CodeRate rate, uint64_t length);
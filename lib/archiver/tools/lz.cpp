@@ -0,0 +1,207 @@
+#include "lz.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+const size_t kMinMatch = 4;
+const size_t kMaxOffset = UINT16_MAX;
+const size_t kHashBits = 14;
+const uint8_t kLengthMask = 15; // lengths kept in a token nibble
+const size_t kSkipShift = 6; // misses in a row before the search starts skipping bytes
+
+uint32_t LoadWord(const uint8_t* data);
+size_t HashWord(uint32_t word);
+bool PutLength(uint8_t*& cursor, const uint8_t* end, size_t length);
+bool TakeLength(const uint8_t*& cursor, const uint8_t* end, size_t& length, size_t limit);
+bool PutSequence(uint8_t*& cursor, const uint8_t* end, const uint8_t* literals, size_t literal_length, size_t offset,
+                 size_t match_length);
+
+uint32_t LoadWord(const uint8_t* data) {
+    uint32_t word;
+
+    memcpy(&word, data, sizeof(word));
+
+    return word;
+}
+
+size_t HashWord(uint32_t word) {
+    return (word * 2654435761u) >> (32 - kHashBits);
+}
+
+bool PutLength(uint8_t*& cursor, const uint8_t* end, size_t length) {
+    for (; length >= UINT8_MAX; length -= UINT8_MAX) {
+        if (cursor == end) {
+            return false;
+        }
+
+        *cursor++ = UINT8_MAX;
+    }
+
+    if (cursor == end) {
+        return false;
+    }
+
+    *cursor++ = length;
+
+    return true;
+}
+
+bool TakeLength(const uint8_t*& cursor, const uint8_t* end, size_t& length, size_t limit) {
+    uint8_t byte;
+
+    do {
+        // Anything longer than `limit` is damage, it would not fit anyway.
+        if (cursor == end || length > limit) {
+            return false;
+        }
+
+        byte = *cursor++;
+        length += byte;
+    } while (byte == UINT8_MAX);
+
+    return true;
+}
+
+// A match length of 0 ends the block: literals only.
+bool PutSequence(uint8_t*& cursor, const uint8_t* end, const uint8_t* literals, size_t literal_length, size_t offset,
+                 size_t match_length) {
+    size_t match_code = match_length == 0 ? 0 : match_length - kMinMatch;
+
+    if (cursor == end) {
+        return false;
+    }
+
+    *cursor++ = (std::min<size_t>(literal_length, kLengthMask) << 4) | std::min<size_t>(match_code, kLengthMask);
+
+    if (literal_length >= kLengthMask && !PutLength(cursor, end, literal_length - kLengthMask)) {
+        return false;
+    }
+
+    if (static_cast<size_t>(end - cursor) < literal_length) {
+        return false;
+    }
+
+    memcpy(cursor, literals, literal_length);
+    cursor += literal_length;
+
+    if (match_length == 0) {
+        return true;
+    }
+
+    if (end - cursor < 2) {
+        return false;
+    }
+
+    *cursor++ = offset & UINT8_MAX;
+    *cursor++ = offset >> 8;
+
+    return match_code < kLengthMask || PutLength(cursor, end, match_code - kLengthMask);
+}
+
+size_t LzCompress(const char* source, size_t length, char* compressed, size_t capacity) {
+    const uint8_t* input = reinterpret_cast<const uint8_t*>(source);
+    uint8_t* output = reinterpret_cast<uint8_t*>(compressed);
+    uint8_t* cursor = output;
+    const uint8_t* end = output + capacity;
+    std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+    size_t anchor = 0;
+    size_t position = 0;
+
+    // Positions in the table are only candidates, a match is checked byte by byte.
+    while (position + kMinMatch <= length) {
+        uint32_t word = LoadWord(input + position);
+        uint32_t& slot = table[HashWord(word)];
+        size_t candidate = slot;
+
+        slot = position;
+
+        if (candidate >= position || position - candidate > kMaxOffset || LoadWord(input + candidate) != word) {
+            // Incompressible stretches are skipped faster and faster.
+            position += 1 + ((position - anchor) >> kSkipShift);
+
+            continue;
+        }
+
+        size_t match_length = kMinMatch;
+
+        while (position + match_length < length && input[candidate + match_length] == input[position + match_length]) {
+            ++match_length;
+        }
+
+        if (!PutSequence(cursor, end, input + anchor, position - anchor, position - candidate, match_length)) {
+            return 0;
+        }
+
+        position += match_length;
+        anchor = position;
+    }
+
+    if (!PutSequence(cursor, end, input + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return cursor - output;
+}
+
+bool LzDecompress(const char* compressed, size_t compressed_length, char* output, size_t length) {
+    const uint8_t* cursor = reinterpret_cast<const uint8_t*>(compressed);
+    const uint8_t* end = cursor + compressed_length;
+    uint8_t* target = reinterpret_cast<uint8_t*>(output);
+    uint8_t* target_end = target + length;
+
+    while (cursor != end) {
+        uint8_t token = *cursor++;
+        size_t literal_length = token >> 4;
+        size_t match_length = token & kLengthMask;
+
+        if (literal_length == kLengthMask && !TakeLength(cursor, end, literal_length, length)) {
+            return false;
+        }
+
+        if (literal_length > static_cast<size_t>(end - cursor) || literal_length > static_cast<size_t>(target_end - target)) {
+            return false;
+        }
+
+        memcpy(target, cursor, literal_length);
+        cursor += literal_length;
+        target += literal_length;
+
+        if (cursor == end) {
+            break;
+        }
+
+        if (end - cursor < 2) {
+            return false;
+        }
+
+        size_t offset = cursor[0] | (cursor[1] << 8);
+
+        cursor += 2;
+
+        if (match_length == kLengthMask && !TakeLength(cursor, end, match_length, length)) {
+            return false;
+        }
+
+        match_length += kMinMatch;
+
+        if (offset == 0 || offset > static_cast<size_t>(target - reinterpret_cast<uint8_t*>(output))
+            || match_length > static_cast<size_t>(target_end - target)) {
+            return false;
+        }
+
+        // Overlapping matches repeat the last `offset` bytes.
+        const uint8_t* match = target - offset;
+
+        if (offset >= match_length) {
+            memcpy(target, match, match_length);
+            target += match_length;
+        } else {
+            for (size_t i = 0; i < match_length; ++i) {
+                *target++ = match[i];
+            }
+        }
+    }
+
+    return target == target_end;
+}
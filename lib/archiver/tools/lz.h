@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+// A small LZ77 codec in the spirit of LZ4: a token with the lengths of a
+// literal run and of the match after it, the literals, a 16-bit backward
+// offset. Lengths that do not fit into the token's 4 bits go on in bytes
+// of 255. The last sequence has literals only.
+//
+// Fast rather than tight, it is meant for logs, text and other data that
+// repeats itself within a few kilobytes. Blocks are at most 4 GiB.
+
+// Returns the compressed size, or 0 if it would take more than `capacity` bytes.
+size_t LzCompress(const char* source, size_t length, char* compressed, size_t capacity);
+// Returns false unless `compressed` expands to exactly `length` bytes. Never
+// reads or writes out of bounds, whatever `compressed` holds.
+bool LzDecompress(const char* compressed, size_t compressed_length, char* output, size_t length);
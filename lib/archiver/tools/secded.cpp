@@ -0,0 +1,110 @@
+#include "secded.h"
+
+#include <cstring>
+
+template <size_t kDataBytes>
+void EncodeSecded(const uint8_t* byte_seq, size_t length, uint8_t* encoded);
+template <size_t kDataBytes>
+void DecodeSecded(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats);
+template <size_t kDataBytes>
+void StripSecded(const uint8_t* encoded, size_t length, uint8_t* byte_seq);
+void CountState(CodewordState state, CodecStats& stats);
+
+const CodeParameters kCodeParameters[] = {
+    {"13/8", 1, kHammingByte},
+    {"39/32", 4, SecdedCode<4>::kCodewordBytes},
+    {"72/64", 8, SecdedCode<8>::kCodewordBytes},
+};
+
+void CountState(CodewordState state, CodecStats& stats) {
+    if (state == CodewordState::kCorrected) {
+        ++stats.corrected;
+    } else if (state == CodewordState::kDamaged) {
+        ++stats.damaged;
+    }
+}
+
+template <size_t kDataBytes>
+void EncodeSecded(const uint8_t* byte_seq, size_t length, uint8_t* encoded) {
+    using Code = SecdedCode<kDataBytes>;
+
+    for (; length >= kDataBytes; length -= kDataBytes) {
+        Code::EncodeCodeword(byte_seq, encoded);
+
+        byte_seq += kDataBytes;
+        encoded += Code::kCodewordBytes;
+    }
+
+    if (length > 0) {
+        uint8_t padded[kDataBytes] = {};
+
+        memcpy(padded, byte_seq, length);
+        Code::EncodeCodeword(padded, encoded);
+    }
+}
+
+template <size_t kDataBytes>
+void DecodeSecded(const uint8_t* encoded, size_t length, uint8_t* byte_seq, bool restore, CodecStats& stats) {
+    using Code = SecdedCode<kDataBytes>;
+
+    for (; length >= kDataBytes; length -= kDataBytes) {
+        CountState(Code::DecodeCodeword(encoded, byte_seq, restore), stats);
+
+        byte_seq += kDataBytes;
+        encoded += Code::kCodewordBytes;
+    }
+
+    if (length > 0) {
+        uint8_t padded[kDataBytes];
+
+        CountState(Code::DecodeCodeword(encoded, padded, restore), stats);
+        memcpy(byte_seq, padded, length);
+    }
+}
+
+// Systematic codes: the data bytes are stored as they are.
+template <size_t kDataBytes>
+void StripSecded(const uint8_t* encoded, size_t length, uint8_t* byte_seq) {
+    using Code = SecdedCode<kDataBytes>;
+
+    for (; length >= kDataBytes; length -= kDataBytes) {
+        memcpy(byte_seq, encoded, kDataBytes);
+
+        byte_seq += kDataBytes;
+        encoded += Code::kCodewordBytes;
+    }
+
+    memcpy(byte_seq, encoded, length);
+}
+
+const CodecKernels kSecded39Kernels = {"secded39", EncodeSecded<4>, DecodeSecded<4>, StripSecded<4>};
+const CodecKernels kSecded72Kernels = {"secded72", EncodeSecded<8>, DecodeSecded<8>, StripSecded<8>};
+
+const CodecKernels& GetCodecKernels(CodeRate rate) {
+    switch (rate) {
+        case CodeRate::kSecded39_32:
+            return kSecded39Kernels;
+        case CodeRate::kSecded72_64:
+            return kSecded72Kernels;
+        default:
+            return GetCodecKernels();
+    }
+}
+
+const CodeParameters* FindCodeParameters(uint32_t rate) {
+    if (rate >= sizeof(kCodeParameters) / sizeof(kCodeParameters[0])) {
+        return nullptr;
+    }
+
+    return &kCodeParameters[rate];
+}
+
+const CodeParameters& GetCodeParameters(CodeRate rate) {
+    return kCodeParameters[static_cast<size_t>(rate)];
+}
+
+uint64_t EncodedSize(CodeRate rate, uint64_t length) {
+    const CodeParameters& code = GetCodeParameters(rate);
+
+    return (length + code.data_bytes - 1) / code.data_bytes * code.codeword_bytes;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "hamming.h"
+#include "kernels.h"
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+
+// Wide extended Hamming (SECDED) codes in systematic form: a codeword is
+// kDataBytes data bytes stored as they are, followed by one check byte.
+//
+//     check byte bits 0..kCheckBits-1 - Hamming check bits
+//     check byte bit 7                - overall parity of data and check bits
+//
+// Data bit i sits at the i-th position of the Hamming codeword that is not a
+// power of two, exactly as in the (13, 8) code; only the storage order of the
+// bits differs. Clean codewords therefore decode to a plain copy.
+
+constexpr size_t CountCheckBits(size_t data_bits) {
+    size_t check_bits = 0;
+
+    while ((size_t(1) << check_bits) < data_bits + check_bits + 1) {
+        ++check_bits;
+    }
+
+    return check_bits;
+}
+
+template <size_t kDataBytes>
+struct SecdedCode {
+    static constexpr size_t kDataBits = kDataBytes * kBitsInBytes;
+    static constexpr size_t kCheckBits = CountCheckBits(kDataBits);
+    static constexpr size_t kCodewordBytes = kDataBytes + 1;
+    static constexpr uint8_t kSyndromeMask = (1 << kCheckBits) - 1;
+    static constexpr uint8_t kOverallBit = 0x80;
+    static constexpr int16_t kNotData = -1;
+    static constexpr int16_t kOutOfRange = -2;
+
+    static_assert(kCheckBits < kBitsInBytes, "check bits and the overall parity must fit one byte");
+
+    using ByteSyndromes = std::array<std::array<uint8_t, 1 << kBitsInBytes>, kDataBytes>;
+    using SyndromePositions = std::array<int16_t, 1 << kCheckBits>;
+
+    // Syndrome contribution of every value of every data byte, kOverallBit
+    // holds the parity of the byte.
+    static constexpr ByteSyndromes MakeByteSyndromes() {
+        ByteSyndromes table{};
+        size_t position = 1;
+
+        for (size_t data_bit = 0; data_bit < kDataBits; ++data_bit) {
+            do {
+                ++position;
+            } while ((position & (position - 1)) == 0);
+
+            size_t byte = data_bit / kBitsInBytes;
+            size_t bit = data_bit % kBitsInBytes;
+
+            for (size_t value = 0; value < table[byte].size(); ++value) {
+                if ((value >> bit) & 1) {
+                    table[byte][value] ^= position | kOverallBit;
+                }
+            }
+        }
+
+        return table;
+    }
+
+    // Data bit located by a syndrome (or kNotData for check bit positions).
+    static constexpr SyndromePositions MakeSyndromePositions() {
+        SyndromePositions table{};
+        size_t position = 1;
+
+        for (size_t syndrome = 0; syndrome < table.size(); ++syndrome) {
+            table[syndrome] = kOutOfRange;
+        }
+
+        for (size_t check_bit = 0; check_bit < kCheckBits; ++check_bit) {
+            table[size_t(1) << check_bit] = kNotData;
+        }
+
+        table[0] = kNotData;
+
+        for (size_t data_bit = 0; data_bit < kDataBits; ++data_bit) {
+            do {
+                ++position;
+            } while ((position & (position - 1)) == 0);
+
+            table[position] = data_bit;
+        }
+
+        return table;
+    }
+
+    static constexpr ByteSyndromes kByteSyndromes = MakeByteSyndromes();
+    static constexpr SyndromePositions kSyndromePositions = MakeSyndromePositions();
+
+    static uint8_t CheckByte(const uint8_t* data) {
+        uint8_t check = 0;
+
+        for (size_t byte = 0; byte < kDataBytes; ++byte) {
+            check ^= kByteSyndromes[byte][data[byte]];
+        }
+
+        uint8_t syndrome = check & kSyndromeMask;
+        uint8_t overall = ((check >> 7) ^ __builtin_parity(syndrome)) & 1;
+
+        return syndrome | (overall << 7);
+    }
+
+    static void EncodeCodeword(const uint8_t* data, uint8_t* codeword) {
+        for (size_t byte = 0; byte < kDataBytes; ++byte) {
+            codeword[byte] = data[byte];
+        }
+
+        codeword[kDataBytes] = CheckByte(data);
+    }
+
+    // Copies the data bytes of `codeword` into `data` and fixes a single
+    // flipped bit there if `restore` is set.
+    static CodewordState DecodeCodeword(const uint8_t* codeword, uint8_t* data, bool restore) {
+        for (size_t byte = 0; byte < kDataBytes; ++byte) {
+            data[byte] = codeword[byte];
+        }
+
+        uint8_t difference = (codeword[kDataBytes] ^ CheckByte(codeword)) & (kSyndromeMask | kOverallBit);
+
+        if (difference == 0) {
+            return CodewordState::kClean;
+        }
+
+        uint8_t syndrome = difference & kSyndromeMask;
+        bool odd = ((difference >> 7) ^ __builtin_parity(syndrome)) & 1;
+
+        if (!odd || kSyndromePositions[syndrome] == kOutOfRange) {
+            return CodewordState::kDamaged;
+        }
+
+        int16_t data_bit = kSyndromePositions[syndrome];
+
+        if (restore && data_bit != kNotData) {
+            data[data_bit / kBitsInBytes] ^= 1 << (data_bit % kBitsInBytes);
+        }
+
+        return CodewordState::kCorrected;
+    }
+};
+
+extern const CodecKernels kSecded39Kernels;
+extern const CodecKernels kSecded72Kernels;
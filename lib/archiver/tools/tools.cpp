@@ -1,240 +1,108 @@
 #include "tools.h"
+#include "../stats/stats.h"
 
-#include <iostream>
-#include <vector>
+#include <algorithm>
 
-const uint8_t kBitsInBytes = 8;
+const size_t kCodecBlockSize = 1 << 20; // source bytes encoded per stream write
 
-uint8_t MakeByte(const std::vector<uint8_t>& bits);
-std::vector<size_t> GetRedundants(size_t index);
-void Flip(uint8_t& bit);
-
-char GetUserInput() {
-    char answer;
-        
-    do {
-        std::cin >> answer;
-
-        if (answer != 'y' && answer != 'n') {
-            std::cout << "Please, use 'y' or 'n'. ";
-        }
-    } while (answer != 'y' && answer != 'n');
-
-    return answer;
-}
-
-Manipulator::Manipulator()
-    : block_size_(kBitsInBytes)
+Manipulator::Manipulator(CodeRate rate)
+    : rate_(rate)
+    , kernels_(&GetCodecKernels(rate))
 {}
 
-void Manipulator::SaveBits(uint8_t byte) {
-    for (size_t bit = 0; bit < kBitsInBytes; ++bit) {
-        buffer_in_.push_back((byte >> bit) & 1);
-    }
-}
-
-uint8_t MakeByte(const std::vector<uint8_t>& bits) {
-    uint8_t byte = 0;
-
-    for (size_t i = 0; i < kBitsInBytes; ++i) {
-        byte ^= (bits[i] << i);
-    }
-
-    return byte;
-}
-
-void Manipulator::WriteByte(std::ofstream& stream) {
-    std::vector<uint8_t> bits(kBitsInBytes);
-
-    for (size_t i = 0; i < kBitsInBytes && !buffer_out_.empty(); ++i) {
-        bits[i] = buffer_out_.front();
-        buffer_out_.pop_front();
-    }
-
-    uint8_t byte = MakeByte(bits);
-
-    stream.write(reinterpret_cast<const char*>(&byte), sizeof(byte));
+CodeRate Manipulator::Rate() const {
+    return rate_;
 }
 
-void Manipulator::WriteData(std::ofstream& stream) {
-    WriteByte(stream);
-    WriteByte(stream);
+uint64_t Manipulator::EncodedSize(uint64_t length) const {
+    return ::EncodedSize(rate_, length);
 }
 
-void Manipulator::LoadData(std::ofstream& stream, const char* byte_seq, size_t length) {
-    for (size_t i = 0; i < length; ++i) {
-        SaveBits(byte_seq[i]);
-
-        std::vector<uint8_t> data(block_size_);
-
-        for (size_t j = 0; j < block_size_; ++j) {
-            data[j] = buffer_in_.front();
-            buffer_in_.pop_front();
-        }
-
-        std::vector<uint8_t> hamming_code = Encode(data);
+void Manipulator::EncodeBlock(const char* byte_seq, size_t length, char* encoded) const {
+    PhaseTimer timer(Phase::kEncode);
 
-        for (auto& bit: hamming_code) {
-            buffer_out_.push_back(bit);
-        }
-
-        WriteData(stream);
-    }
+    kernels_->encode(reinterpret_cast<const uint8_t*>(byte_seq), length, reinterpret_cast<uint8_t*>(encoded));
 }
 
-std::vector<size_t> GetRedundants(size_t index) {
-    std::vector<size_t> result;
-
-    for (size_t bit_number = 0; bit_number < kBitsInBytes * sizeof(index); ++bit_number) {
-        if ((index >> bit_number) & 1) {
-            result.push_back(bit_number);
-        }
-    }
-
-    return result;
-}
-
-void Flip(uint8_t& bit) {
-    bit ^= 1;
-}
-
-std::vector<uint8_t> Manipulator::Encode(const std::vector<uint8_t>& data) {
-    size_t redundants = 0;
-
-    while ((1 << redundants) < data.size() + redundants + 1) {
-        ++redundants;
-    }
-
-    size_t current_power = 1;
-    size_t added_redundants = 0;
-    uint8_t total_xor = 0;
-    std::vector<uint8_t> hamming;
-
-    for (size_t i = 0; i < data.size(); ++i) {
-        while (hamming.size() == current_power - 1) {
-            hamming.push_back(0);
-            current_power <<= 1;
-            ++added_redundants;
-        }
-
-        uint8_t bit = data[i];
-        std::vector<size_t> correlating = GetRedundants(hamming.size() + 1);
-
-        if (bit) {
-            for (auto& redundant_number: correlating) {
-                Flip(hamming[(1 << redundant_number) - 1]);
-            }
-
-            if (correlating.size() % 2 == 1) {
-                Flip(total_xor);
+CodecStats Manipulator::DecodeBlock(const char* encoded, size_t length, char* byte_seq, bool restore,
+                                    const uint32_t* checksums) const {
+    PhaseTimer timer(Phase::kDecode);
+    size_t data_bytes = GetCodeParameters(rate_).data_bytes;
+    const uint8_t* input = reinterpret_cast<const uint8_t*>(encoded);
+    uint8_t* output = reinterpret_cast<uint8_t*>(byte_seq);
+    CodecStats stats;
+
+    if (checksums == nullptr) {
+        kernels_->decode(input, length, output, restore, stats);
+    } else {
+        for (size_t offset = 0; offset < length; offset += kChecksumChunkSize) {
+            size_t block = std::min(length - offset, kChecksumChunkSize);
+            // Chunk boundaries are multiples of every codeword's data size.
+            const uint8_t* chunk = input + EncodedSize(offset);
+
+            kernels_->strip(chunk, block, output + offset);
+
+            if (Crc32c(byte_seq + offset, block) != checksums[offset / kChecksumChunkSize]) {
+                kernels_->decode(chunk, block, output + offset, restore, stats);
             }
         }
-
-        total_xor ^= bit;
-        hamming.push_back(bit);
     }
 
-    hamming.push_back(total_xor);
+    CountCodewords((length + data_bytes - 1) / data_bytes, stats.corrected, stats.damaged);
 
-    return hamming;
+    return stats;
 }
 
-std::vector<uint8_t> GetBits(std::ifstream& stream) {
-    uint16_t bytes;
-    std::vector<uint8_t> bits(2 * kBitsInBytes);
+CodecStats Manipulator::LostCodewords(uint64_t length, uint64_t bytes_read) const {
+    uint64_t codeword_bytes = GetCodeParameters(rate_).codeword_bytes;
+    uint64_t codewords = EncodedSize(length) / codeword_bytes;
+    CodecStats stats;
 
-    stream.read(reinterpret_cast<char*>(&bytes), sizeof(bytes));
+    stats.damaged = codewords - std::min(codewords, bytes_read / codeword_bytes);
+    CountCodewords(stats.damaged, 0, stats.damaged);
 
-    for (size_t bit = 0; bit < 2 * kBitsInBytes; ++bit) {
-        bits[bit] = (bytes >> bit) & 1;
-    }
-
-    return bits;
+    return stats;
 }
 
-std::pair<size_t, size_t> GetDamagedIndex(const std::vector<uint8_t>& data) {
-    size_t current_power = 1;
-    uint8_t total_xor = 0;
-    std::vector<uint8_t> reds;
-
-    for (size_t i = 0; i < data.size() - 1; ++i) {
-        if (i == current_power - 1) {
-            reds.push_back(data[i]);
-            total_xor ^= data[i];
-            current_power <<= 1;
-
-            continue;
-        }
-
-        uint8_t bit = data[i];
-        std::vector<size_t> correlating = GetRedundants(i + 1);
-
-        if (bit) {
-            for (auto& redundant_number: correlating) {
-                Flip(reds[redundant_number]);
-            }
-        }
-
-        total_xor ^= bit;
-    }
+uint64_t Manipulator::ReadableLength(uint64_t length, uint64_t bytes_read) const {
+    const CodeParameters& code = GetCodeParameters(rate_);
 
-    size_t error_place = 0;
-
-    for (size_t i = 0; i < reds.size(); ++i) {
-        error_place ^= (reds[i] << i);
-    }
-
-    return {error_place, total_xor ^ data.back()};
+    return std::min(length, bytes_read / code.codeword_bytes * code.data_bytes);
 }
 
-std::vector<uint8_t> ExtractOriginalBits(const std::vector<uint8_t>& data) {
-    size_t current_power = 1;
-    std::vector<uint8_t> result;
-
-    for (size_t i = 0; i < data.size() - 1; ++i) {
-        if (i == current_power - 1) {
-            current_power <<= 1;
+void Manipulator::LoadData(std::ostream& stream, const char* byte_seq, size_t length) {
+    while (length > 0) {
+        size_t block = std::min(length, kCodecBlockSize);
 
-            continue;
-        }
+        buffer_.resize(EncodedSize(block));
+        EncodeBlock(byte_seq, block, buffer_.data());
+        WriteCounted(stream, buffer_.data(), buffer_.size());
 
-        result.push_back(data[i]);
+        byte_seq += block;
+        length -= block;
     }
-
-    return result;
 }
 
-std::vector<uint8_t> Manipulator::Decode(std::vector<uint8_t>& data, bool restore) {
-    auto [error_place, extra_bit] = GetDamagedIndex(data);
+CodecStats Manipulator::UnloadData(std::istream& stream, char* byte_seq, size_t length, bool restore) {
+    CodecStats stats;
 
-    if (error_place != 0) {
-        if (!extra_bit) {
-            std::cout << "Data is damaged and cannot be restored." << std::endl;
-            std::cout << "Do you still want to extract it? (could be impossible) [y/n] ";
+    while (length > 0) {
+        size_t block = std::min(length, kCodecBlockSize);
 
-            if (GetUserInput() == 'n') {
-                exit(0);
-            }
-        } else {
-            if (restore) {
-                Flip(data[error_place - 1]);
-            }
-        }
-    }
+        buffer_.resize(EncodedSize(block));
+        size_t bytes_read = ReadCounted(stream, buffer_.data(), buffer_.size());
 
-    return ExtractOriginalBits(data);
-}
-
-void Manipulator::UnloadData(std::ifstream& stream, char* byte_seq, size_t length, bool restore) {
-    for (size_t i = 0; i < length; ++i) {
-        std::vector<uint8_t> encoded = GetBits(stream);
+        // The codewords a truncated archive lacks are lost, zeros only keep
+        // the decoded bytes defined.
+        std::fill(buffer_.begin() + bytes_read, buffer_.end(), 0);
 
-        while (encoded.size() > 13) {
-            encoded.pop_back();
-        }
+        CodecStats block_stats = DecodeBlock(buffer_.data(), block, byte_seq, restore);
 
-        std::vector<uint8_t> decoded = Decode(encoded, restore);
-        
-        byte_seq[i] = MakeByte(decoded);
+        stats.corrected += block_stats.corrected;
+        stats.damaged += block_stats.damaged + LostCodewords(block, bytes_read).damaged;
+        byte_seq += block;
+        length -= block;
     }
+
+    return stats;
 }
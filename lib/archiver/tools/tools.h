@@ -1,29 +1,50 @@
 #pragma once
 
+#include "crc32c.h"
+#include "error.h"
+#include "hamming.h"
+#include "kernels.h"
+
 #include <cinttypes>
-#include <deque>
 #include <fstream>
-#include <utility>
 #include <vector>
 
+// Source bytes covered by one chunk checksum (CRC32C).
+const size_t kChecksumChunkSize = 1 << 20;
+
 class Manipulator {
 public:
-    Manipulator();
+    explicit Manipulator(CodeRate rate = CodeRate::kHamming13_8);
 
-    void LoadData(std::ofstream& stream, const char* byte_seq, size_t length);
-    void UnloadData(std::ifstream& stream, char* byte_seq, size_t length, bool restore);
-private:
-    size_t block_size_;
-    std::deque<uint8_t> buffer_in_;
-    std::deque<uint8_t> buffer_out_;
+    CodeRate Rate() const;
+    // Encoded size of `length` source bytes.
+    uint64_t EncodedSize(uint64_t length) const;
 
-    void WriteByte(std::ofstream& stream);
-    void WriteData(std::ofstream& stream);
-    void SaveBits(uint8_t byte);
-    void FinalCheck(std::ofstream& stream);
+    // Block API. `encoded` holds EncodedSize(length) bytes.
+    // Safe to call from several threads at once.
+    //
+    // With `checksums` (CRC32C of every kChecksumChunkSize source bytes of
+    // the block, which must start at a chunk boundary) a chunk is only
+    // stripped of its parity while it matches its checksum. Only chunks that
+    // do not match are decoded for real.
+    //
+    // Decoding never stops on damage, it reports it and the caller decides.
+    void EncodeBlock(const char* byte_seq, size_t length, char* encoded) const;
+    CodecStats DecodeBlock(const char* encoded, size_t length, char* byte_seq, bool restore = true,
+                           const uint32_t* checksums = nullptr) const;
 
-    std::vector<uint8_t> Encode(const std::vector<uint8_t>& data);
-    std::vector<uint8_t> Decode(std::vector<uint8_t>& data, bool restore);
-};
+    // A read of the codewords of `length` source bytes that got only
+    // `bytes_read` encoded bytes: the archive is cut short. The codewords it
+    // lacks, whole or in part, are lost, which is damage beyond repair.
+    // LostCodewords() counts them, ReadableLength() gives the source bytes
+    // held by the whole codewords that were read.
+    CodecStats LostCodewords(uint64_t length, uint64_t bytes_read) const;
+    uint64_t ReadableLength(uint64_t length, uint64_t bytes_read) const;
 
-char GetUserInput();
+    void LoadData(std::ostream& stream, const char* byte_seq, size_t length);
+    CodecStats UnloadData(std::istream& stream, char* byte_seq, size_t length, bool restore = true);
+private:
+    CodeRate rate_;
+    const CodecKernels* kernels_;
+    std::vector<char> buffer_;
+};
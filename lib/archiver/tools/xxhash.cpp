@@ -0,0 +1,151 @@
+#include "xxhash.h"
+
+#include <algorithm>
+#include <cstring>
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4F;
+const uint64_t kPrime3 = 0x165667B19E3779F9;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5;
+const size_t kStripeSize = 4 * sizeof(uint64_t);
+
+uint64_t RotateLeft(uint64_t value, int bits);
+uint64_t Load64(const char* data);
+uint32_t Load32(const char* data);
+uint64_t Round(uint64_t accumulator, uint64_t input);
+uint64_t MergeRound(uint64_t hash, uint64_t accumulator);
+void Consume(uint64_t* accumulators, const char* stripe);
+uint64_t Converge(const uint64_t* accumulators);
+// Mixes in the last bytes, fewer than a stripe, and the length.
+uint64_t Finish(uint64_t hash, uint64_t length, const char* data, const char* end);
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t Load64(const char* data) {
+    uint64_t value;
+
+    memcpy(&value, data, sizeof(value));
+
+    return value;
+}
+
+uint32_t Load32(const char* data) {
+    uint32_t value;
+
+    memcpy(&value, data, sizeof(value));
+
+    return value;
+}
+
+uint64_t Round(uint64_t accumulator, uint64_t input) {
+    return RotateLeft(accumulator + input * kPrime2, 31) * kPrime1;
+}
+
+uint64_t MergeRound(uint64_t hash, uint64_t accumulator) {
+    return (hash ^ Round(0, accumulator)) * kPrime1 + kPrime4;
+}
+
+void Consume(uint64_t* accumulators, const char* stripe) {
+    for (size_t lane = 0; lane < 4; ++lane) {
+        accumulators[lane] = Round(accumulators[lane], Load64(stripe + lane * sizeof(uint64_t)));
+    }
+}
+
+uint64_t Converge(const uint64_t* accumulators) {
+    uint64_t hash = RotateLeft(accumulators[0], 1) + RotateLeft(accumulators[1], 7) + RotateLeft(accumulators[2], 12)
+        + RotateLeft(accumulators[3], 18);
+
+    for (size_t lane = 0; lane < 4; ++lane) {
+        hash = MergeRound(hash, accumulators[lane]);
+    }
+
+    return hash;
+}
+
+uint64_t Finish(uint64_t hash, uint64_t length, const char* data, const char* end) {
+    hash += length;
+
+    for (; end - data >= 8; data += 8) {
+        hash = RotateLeft(hash ^ Round(0, Load64(data)), 27) * kPrime1 + kPrime4;
+    }
+
+    if (end - data >= 4) {
+        hash = RotateLeft(hash ^ (Load32(data) * kPrime1), 23) * kPrime2 + kPrime3;
+        data += 4;
+    }
+
+    for (; data != end; ++data) {
+        hash = RotateLeft(hash ^ (static_cast<uint8_t>(*data) * kPrime5), 11) * kPrime1;
+    }
+
+    // Avalanche.
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+uint64_t XxHash64(const char* data, size_t length, uint64_t seed) {
+    const char* end = data + length;
+    uint64_t hash = seed + kPrime5;
+
+    if (length >= kStripeSize) {
+        uint64_t accumulators[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1};
+
+        for (; end - data >= static_cast<ptrdiff_t>(kStripeSize); data += kStripeSize) {
+            Consume(accumulators, data);
+        }
+
+        hash = Converge(accumulators);
+    }
+
+    return Finish(hash, length, data, end);
+}
+
+XxHasher::XxHasher(uint64_t seed)
+    : seed_(seed)
+    , accumulators_{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1}
+    , length_(0)
+    , buffered_(0)
+{}
+
+void XxHasher::Update(const char* data, size_t length) {
+    const char* end = data + length;
+
+    length_ += length;
+
+    // A stripe started by the previous piece is completed first.
+    if (buffered_ != 0) {
+        size_t taken = std::min(length, kStripeSize - buffered_);
+
+        memcpy(stripe_ + buffered_, data, taken);
+        buffered_ += taken;
+        data += taken;
+
+        if (buffered_ < kStripeSize) {
+            return;
+        }
+
+        Consume(accumulators_, stripe_);
+        buffered_ = 0;
+    }
+
+    for (; end - data >= static_cast<ptrdiff_t>(kStripeSize); data += kStripeSize) {
+        Consume(accumulators_, data);
+    }
+
+    memcpy(stripe_, data, end - data);
+    buffered_ = end - data;
+}
+
+uint64_t XxHasher::Digest() const {
+    uint64_t hash = length_ >= kStripeSize ? Converge(accumulators_) : seed_ + kPrime5;
+
+    return Finish(hash, length_, stripe_, stripe_ + buffered_);
+}
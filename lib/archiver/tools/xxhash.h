@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+// XXH64 as specified by xxHash: a fast non-cryptographic 64-bit hash, good
+// enough to tell chunks of data apart when they are also compared by length
+// and CRC32C.
+uint64_t XxHash64(const char* data, size_t length, uint64_t seed = 0);
+
+// XXH64 of data that comes piece by piece, the same as XxHash64() of all of it.
+class XxHasher {
+public:
+    explicit XxHasher(uint64_t seed = 0);
+
+    void Update(const char* data, size_t length);
+    uint64_t Digest() const;
+private:
+    static const size_t kStripeSize = 32;
+
+    uint64_t seed_;
+    uint64_t accumulators_[4];
+    uint64_t length_;
+    char stripe_[kStripeSize];
+    size_t buffered_;
+};
@@ -0,0 +1,97 @@
+#include "writer.h"
+
+#include <algorithm>
+
+HafWriter::HafWriter(std::ostream& stream, const ArchiverOptions& options)
+    : stream_(stream)
+    , payload_(options.code_rate.value_or(CodeRate::kHamming13_8))
+    , directory_(MakeArchiveFormat(payload_.Rate(), true, true))
+    , compress_(options.compress)
+{
+    directory_.WriteHeader(stream_, manipulator_);
+}
+
+HAFInfo HafWriter::MakeHeader(const std::string& name, uint64_t file_size, const char* sample, size_t sample_length) const {
+    if (name.empty() || name.size() > kMaxFileNameLength) {
+        throw ArchiveError("File name " + name + " is empty or too long.");
+    }
+
+    if (directory_.Find(name) != nullptr) {
+        throw ArchiveError("Archive already contains file with name " + name + ".");
+    }
+
+    HAFInfo header(name.size(), name, file_size);
+
+    header.compressed = compress_ && WorthCompressing(sample, sample_length);
+    header.stored_size = header.compressed ? kUnknownSize : 0;
+
+    return header;
+}
+
+uint32_t HafWriter::WriteChunk(const char* data, size_t length, HAFInfo& header, bool compress) {
+    const char* stored = data;
+    size_t stored_length = length;
+
+    if (header.compressed) {
+        MakeFrame(data, length, frame_, compress);
+        stored = frame_.data();
+        stored_length = frame_.size();
+        header.stored_size += stored_length;
+    }
+
+    encoded_.resize(payload_.EncodedSize(stored_length));
+    payload_.EncodeBlock(stored, stored_length, encoded_.data());
+    WriteCounted(stream_, encoded_.data(), encoded_.size());
+
+    return Crc32c(data, length);
+}
+
+void HafWriter::Add(const std::string& name, const char* data, size_t length) {
+    HAFInfo header = MakeHeader(name, length, data, std::min(length, kChecksumChunkSize));
+    std::vector<uint32_t> checksums;
+
+    WriteMemberHeader(stream_, manipulator_, header);
+    header.stored_size = 0;
+
+    for (size_t offset = 0; offset < length; offset += kChecksumChunkSize) {
+        checksums.push_back(WriteChunk(data + offset, std::min(length - offset, kChecksumChunkSize), header));
+    }
+
+    directory_.Add(header, false, std::move(checksums));
+}
+
+void HafWriter::Add(const std::string& name, std::istream& data) {
+    std::vector<char> buffer(kChecksumChunkSize);
+    size_t bytes_read = ReadCounted(data, buffer.data(), buffer.size());
+    HAFInfo header = MakeHeader(name, kUnknownSize, buffer.data(), bytes_read);
+    bool compress = header.compressed;
+    std::vector<uint32_t> checksums;
+    char end[kFrameHeaderSize] = {};
+
+    // Framed whatever the data, the empty frame header ends it (see compression.h).
+    header.compressed = true;
+    header.stored_size = kUnknownSize;
+    WriteMemberHeader(stream_, manipulator_, header);
+    header.file_size = 0;
+    header.stored_size = 0;
+
+    for (; bytes_read != 0; bytes_read = ReadCounted(data, buffer.data(), buffer.size())) {
+        checksums.push_back(WriteChunk(buffer.data(), bytes_read, header, compress));
+        header.file_size += bytes_read;
+    }
+
+    encoded_.resize(payload_.EncodedSize(sizeof(end)));
+    payload_.EncodeBlock(end, sizeof(end), encoded_.data());
+    WriteCounted(stream_, encoded_.data(), encoded_.size());
+    header.stored_size += sizeof(end);
+    directory_.Add(header, false, std::move(checksums));
+}
+
+void HafWriter::Finish() {
+    directory_.Write(stream_, manipulator_);
+    stream_.flush();
+
+    if (!stream_) {
+        throw ArchiveError("Cannot write the archive.");
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "archiver.h"
+#include "directory.h"
+#include "tools/tools.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Writes a new archive into a stream of the caller, e.g. a socket or a
+// buffer, member by member. The stream is never seeked, so members added
+// from streams and compressed members are only sized in the directory and
+// by their frames, like in archives written to a pipe. The archive always
+// has checksums and frames for this, of the options only the code and
+// compression matter.
+class HafWriter {
+public:
+    explicit HafWriter(std::ostream& stream, const ArchiverOptions& options = {});
+
+    // Names have to be unique.
+    void Add(const std::string& name, const char* data, size_t length);
+    void Add(const std::string& name, std::istream& data);
+    // Writes the directory and the trailer, nothing can be added afterwards.
+    void Finish();
+private:
+    std::ostream& stream_;
+    Manipulator manipulator_;
+    Manipulator payload_;
+    ArchiveDirectory directory_;
+    bool compress_;
+    std::vector<char> encoded_;
+    std::vector<char> frame_;
+
+    // Compressed if the archive allows it and `sample` (the first chunk) is worth it.
+    HAFInfo MakeHeader(const std::string& name, uint64_t file_size, const char* sample, size_t sample_length) const;
+    // Encodes and writes one chunk of member data, returns its checksum.
+    // Chunks of a compressed member are frames, LZ-compressed if `compress`.
+    uint32_t WriteChunk(const char* data, size_t length, HAFInfo& header, bool compress = true);
+};
@@ -1,10 +1,11 @@
 #include "filemaker.h"
 
 #include <iostream>
+#include <sys/stat.h>
 
 HAFInfo::HAFInfo() {}
 
-HAFInfo::HAFInfo(size_t _file_name_length, const std::string& _file_name, uint64_t _file_size) 
+HAFInfo::HAFInfo(uint64_t _file_name_length, const std::string& _file_name, uint64_t _file_size) 
     : file_name_length(_file_name_length)
     , file_name(_file_name)
     , file_size(_file_size)
@@ -12,12 +13,20 @@ HAFInfo::HAFInfo(size_t _file_name_length, const std::string& _file_name, uint64
 
 HAFInfo File::ExportIntoHAF() {
     std::string file_name = GetName();
-
-    return HAFInfo(
+    HAFInfo header(
         file_name.size(),
         file_name,
         GetSize()
     );
+
+    struct stat info;
+
+    if (stat(file_path_.c_str(), &info) == 0) {
+        header.modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        header.mode = info.st_mode & 07777;
+    }
+
+    return header;
 }
 
 File::File(const std::filesystem::path& _file_path)
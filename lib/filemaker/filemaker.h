@@ -2,15 +2,30 @@
 
 #include <cinttypes>
 #include <filesystem>
+#include <optional>
 #include <string>
 
 struct HAFInfo {
-    size_t file_name_length;
+    uint64_t file_name_length;
     std::string file_name;
     uint64_t file_size;
+    // A compressed member stores `stored_size` bytes of frames in place of
+    // its data, a deduplicated one its new frames and its recipe. The recipe
+    // of a sparse one may leave runs of zeros out.
+    bool compressed = false;
+    bool deduplicated = false;
+    bool sparse = false;
+    uint64_t stored_size = 0;
+    // Kept by members of archives with metadata: when the file was last
+    // modified (nanoseconds since the epoch), its permission bits and, if
+    // it was taken, the XXH64 of its contents.
+    bool metadata = false;
+    int64_t modified = 0;
+    uint32_t mode = 0;
+    std::optional<uint64_t> content_hash;
 
     HAFInfo();
-    HAFInfo(size_t _file_name_length, const std::string& _file_name, uint64_t _file_size);
+    HAFInfo(uint64_t _file_name_length, const std::string& _file_name, uint64_t _file_size);
 };
 
 class File {
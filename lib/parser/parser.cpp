@@ -1,6 +1,7 @@
-#include "../archiver/archiver.h"
 #include "parser.h"
 
+#include <cctype>
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
@@ -8,40 +9,74 @@
 
 // --------------------CONSOLE COMMAND BITMASKS--------------------
 
-const uint8_t kCreateCommandMask = (1 << 1);
-const uint8_t kListCommandMask = (1 << 2);
-const uint8_t kExtractCommandMask = (1 << 3);
-const uint8_t kAppendCommandMask = (1 << 4);
-const uint8_t kDeleteCommandMask = (1 << 5);
-const uint8_t kMergeCommandMask = (1 << 6);
+const uint16_t kCreateCommandMask = (1 << 1);
+const uint16_t kListCommandMask = (1 << 2);
+const uint16_t kExtractCommandMask = (1 << 3);
+const uint16_t kAppendCommandMask = (1 << 4);
+const uint16_t kDeleteCommandMask = (1 << 5);
+const uint16_t kMergeCommandMask = (1 << 6);
+const uint16_t kCompactCommandMask = (1 << 7);
+const uint16_t kScrubCommandMask = (1 << 8);
+const uint16_t kUpdateCommandMask = (1 << 9);
 
 // ----------------------------------------------------------------
 
 void PrintHelpList();
 std::vector<std::string> ParseMonoOption(char* arg);
 void PrintUnknownArgumentInformation(std::string arg);
+// The whole of `value`, or a usage error about `arg` that ends the process.
+uint64_t ParseUnsigned(const std::string& value, const char* arg);
+double ParseShare(const std::string& value, const char* arg);
+char GetUserInput();
+Resolution AskAboutExisting(Existing what, const std::string& name);
+bool AskAboutDamage(const std::string& name);
+bool ReportDamage(const std::string& name);
+void PrintWarning(const std::string& message);
+std::string BeautifySize(uint64_t file_size);
+void PrintFileData(const HAFInfo& header);
+void PrintListing(const std::filesystem::path& archive_path, const ArchiveListing& listing);
+void PrintScrubReport(const std::filesystem::path& archive_path, const ScrubReport& report);
 
 Parser::Parser(int argc, char** argv)
     : argc_(argc)
     , argv_(argv)
     , arguments_mask_(0)
-    , restore_(true)
+    , stats_format_(StatsFormat::kNone)
+    , damage_reported_(false)
 {}
 
 void PrintHelpList() {
     std::cout << "These arguments should be provided: " << std::endl;
 
-    std::cout << "-c (--create) - create new archive" << std::endl;
-    std::cout << "-f (--file)=[ARCHIVE_NAME] - name of a certain archive" << std::endl;
+    std::cout << "-c (--create) - create new archive, optionally with provided files and directories" << std::endl;
+    std::cout << "-f (--file)=[ARCHIVE_NAME] - name of a certain archive, '-' writes a new one to stdout" << std::endl;
     std::cout << "-l (--list) - print the content of archive" << std::endl;
     std::cout << "-x (--extract) - extract one or few provided files" << std::endl;
-    std::cout << "-a (--append) - add the file to an archive" << std::endl;
+    std::cout << "-a (--append) - add files and directories (recursively) to an archive" << std::endl;
+    std::cout << "-u (--update) - add files and directories that are new or changed since they were archived, drop the deleted ones" << std::endl;
     std::cout << "-d (--delete) - delete the file from an archive" << std::endl;
-    std::cout << "-A (--concatenate) - merge two archives" << std::endl;
+    std::cout << "-A (--concatenate) - merge provided archives into one" << std::endl;
+    std::cout << "--compact - drop deleted files from an archive if they take enough space" << std::endl;
+    std::cout << "--scrub - check every codeword of an archive and report the damage" << std::endl;
 
     std::cout << std::endl;
 
     std::cout << "--no-restore - goes with -x (--extract), does not restore damaged files" << std::endl;
+    std::cout << "--repair - goes with --scrub, writes corrected codewords back into the archive" << std::endl;
+    std::cout << "--to-stdout - goes with -x (--extract), writes files to stdout instead of the current directory" << std::endl;
+    std::cout << "--range=[OFFSET:LENGTH] - goes with -x (--extract) and one file, writes only these bytes of it to stdout" << std::endl;
+    std::cout << "--stdin-name=[NAME] - name of the file read from stdin ('-' as a file name, default: stdin)" << std::endl;
+    std::cout << "--threads=[N] - number of threads encoding/decoding a file, 0 - one per core (default: 1)" << std::endl;
+    std::cout << "--io=[auto|mmap|stream|async] - access files through memory mappings, streams or io_uring (default: auto)" << std::endl;
+    std::cout << "--direct - goes with -x (--extract), reads and writes past the page cache (O_DIRECT)" << std::endl;
+    std::cout << "--code=[13/8|39/32|72/64] - error-correcting code of new archives (default: 13/8)" << std::endl;
+    std::cout << "--checksums - new archives keep a CRC32C of every 1 MiB of data, clean data is extracted without decoding" << std::endl;
+    std::cout << "--compress - new archives compress files (LZ) before encoding them, files that do not compress are stored as they are" << std::endl;
+    std::cout << "--dedup - new archives store repeated chunks of files once, new files refer to chunks already in the archive (implies --compress)" << std::endl;
+    std::cout << "--sparse - new archives leave holes and zero runs of files out, extracted files get them back as holes (implies --dedup)" << std::endl;
+    std::cout << "--hash - files added to archives with metadata keep a hash of their contents, -u (--update) skips them if only touched" << std::endl;
+    std::cout << "--compact-threshold=[R] - goes with --compact, share of deleted data to compact at (default: 0.25)" << std::endl;
+    std::cout << "--stats[=json] - print time per phase, bytes, codewords and syscalls of the command to stderr" << std::endl;
 
     std::cout << std::endl;
 }
@@ -67,7 +102,9 @@ std::vector<std::string> ParseMonoOption(char* arg) {
     }
 
     if (result.size() != 2) {
-        throw std::runtime_error("Incorrect arguments. Try --help for more information.");
+        PrintUnknownArgumentInformation(arg);
+
+        exit(1);
     }
 
     return result;
@@ -78,7 +115,195 @@ void PrintUnknownArgumentInformation(std::string arg) {
     std::cerr << "Try --help for more information." << std::endl;
 }
 
-bool CheckOnCorrectness(const uint8_t mask) {
+uint64_t ParseUnsigned(const std::string& value, const char* arg) {
+    size_t parsed = 0;
+    uint64_t result = 0;
+
+    // stoull takes "-1" for the largest value and stops at the first non-digit.
+    try {
+        if (!value.empty() && isdigit(static_cast<unsigned char>(value[0]))) {
+            result = std::stoull(value, &parsed);
+        }
+    } catch (const std::logic_error&) {
+        parsed = 0;
+    }
+
+    if (parsed == 0 || parsed != value.size()) {
+        std::cerr << "Incorrect value in " << arg << std::endl;
+        std::cerr << "Try --help for more information." << std::endl;
+
+        exit(1);
+    }
+
+    return result;
+}
+
+double ParseShare(const std::string& value, const char* arg) {
+    size_t parsed = 0;
+    double result = -1;
+
+    try {
+        result = std::stod(value, &parsed);
+    } catch (const std::logic_error&) {
+        parsed = 0;
+    }
+
+    // NaN fails the comparisons as well.
+    if (parsed == 0 || parsed != value.size() || !(result >= 0 && result <= 1)) {
+        std::cerr << "Incorrect value in " << arg << std::endl;
+        std::cerr << "Try --help for more information." << std::endl;
+
+        exit(1);
+    }
+
+    return result;
+}
+
+char GetUserInput() {
+    char answer;
+        
+    do {
+        std::cin >> answer;
+
+        if (answer != 'y' && answer != 'n') {
+            std::cout << "Please, use 'y' or 'n'. ";
+        }
+    } while (answer != 'y' && answer != 'n');
+
+    return answer;
+}
+
+Resolution AskAboutExisting(Existing what, const std::string& name) {
+    if (what == Existing::kArchive) {
+        std::cout << "Archive " << name << " already exists." << std::endl;
+    } else if (what == Existing::kMember) {
+        std::cout << "Archive already contains file with name " << name << std::endl;
+    } else {
+        std::cout << "File " << name << " already exists." << std::endl;
+    }
+
+    std::cout << "Do you want to replace it? [y/n] ";
+
+    if (GetUserInput() == 'y') {
+        return Resolution::kReplace;
+    }
+
+    if (what != Existing::kFile) {
+        return Resolution::kSkip;
+    }
+
+    std::cout << "Do you want to create a copy? [y/n] ";
+
+    return GetUserInput() == 'y' ? Resolution::kCopy : Resolution::kSkip;
+}
+
+bool AskAboutDamage(const std::string& name) {
+    std::cout << "Data of " << name << " is damaged and cannot be restored." << std::endl;
+    std::cout << "Do you still want to extract it? (could be impossible) [y/n] ";
+
+    return GetUserInput() == 'y';
+}
+
+bool ReportDamage(const std::string& name) {
+    std::cerr << "Data of " << name << " is damaged and cannot be restored." << std::endl;
+
+    return true;
+}
+
+void PrintWarning(const std::string& message) {
+    std::cerr << message << std::endl;
+}
+
+std::string BeautifySize(uint64_t file_size) {
+    const uint16_t kOneStep = 1024;
+    size_t power = 0;
+
+    while (file_size >= kOneStep) {
+        file_size /= kOneStep;
+        ++power;
+    }
+
+    std::string result = std::to_string(file_size) + " ";
+    
+    if (power == 1) {
+        result += "K";
+    } else if (power == 2) {
+        result += "M";
+    } else if (power == 3) {
+        result += "G";
+    } else if (power == 4) {
+        result += "T";
+    } else if (power >= 5) {
+        result += "P";
+    }
+
+    result += "B";
+
+    return result;
+}
+
+void PrintFileData(const HAFInfo& header) {
+    std::cout << header.file_name << " " << BeautifySize(header.file_size);
+
+    // Members streamed into a pipe are framed even where nothing compresses.
+    if (header.compressed && header.stored_size < header.file_size) {
+        std::cout << " (compressed to " << BeautifySize(header.stored_size) << ")";
+    }
+
+    if (header.deduplicated) {
+        std::cout << " (deduplicated, " << BeautifySize(header.stored_size) << " stored)";
+    }
+
+    std::cout << std::endl;
+}
+
+void PrintListing(const std::filesystem::path& archive_path, const ArchiveListing& listing) {
+    uint64_t archive_size = 0;
+
+    std::cout << "Archive " << archive_path << " contains:" << std::endl;
+
+    for (const HAFInfo& header: listing.members) {
+        PrintFileData(header);
+
+        archive_size += header.file_size;
+    }
+
+    if (listing.members.empty()) {
+        std::cout << "Nothing." << std::endl;
+
+        return;
+    }
+
+    std::cout << std::endl;
+    std::cout << "Amount of files: " << listing.members.size() << std::endl;
+    std::cout << "Size archived: " << BeautifySize(archive_size) << std::endl;
+
+    if (listing.dead_bytes != 0) {
+        std::cout << "Deleted, not compacted: " << BeautifySize(listing.dead_bytes) << std::endl;
+    }
+
+    std::cout << "Code: " << GetCodeParameters(listing.code_rate).name << std::endl;
+}
+
+void PrintScrubReport(const std::filesystem::path& archive_path, const ScrubReport& report) {
+    for (const ScrubDamage& damage: report.damage) {
+        std::cout << "Offset " << damage.offset << ": ";
+
+        if (damage.missing) {
+            std::cout << damage.codewords << " codewords missing";
+        } else {
+            std::cout << (damage.corrected ? "corrected" : "cannot be corrected");
+        }
+
+        std::cout << " (" << damage.region << ")" << std::endl;
+    }
+
+    std::cout << "Archive " << archive_path.filename() << " scrubbed: " << BeautifySize(report.archive_size) << std::endl;
+    std::cout << "Corrected codewords: " << report.corrected << (report.repaired ? " (written back)" : "") << std::endl;
+    std::cout << "Uncorrectable codewords: " << report.uncorrectable << std::endl;
+}
+
+bool CheckOnCorrectness(const uint16_t mask) {
     // Exactly one command has to be provided.
     return __builtin_popcount(mask) == 1;
 }
@@ -91,8 +316,10 @@ void Parser::Parse() {
             exit(0);
         }
 
-        if (argv_[i][0] != '-') {
+        // A lone "-" is stdin (or stdout for the archive).
+        if (argv_[i][0] != '-' || strcmp(argv_[i], "-") == 0) {
             files_.insert(argv_[i]);
+            ordered_files_.push_back(argv_[i]);
             ++i;
             
             continue;
@@ -107,7 +334,7 @@ void Parser::Parse() {
         if (argv_[i][1] == 'f' || (argv_[i][1] == '-' && argv_[i][2] == 'f')) {
             std::vector<std::string> params;
 
-            if (i == argc_ - 1 || argv_[i + 1][0] == '-') {
+            if (i == argc_ - 1 || (argv_[i + 1][0] == '-' && strcmp(argv_[i + 1], "-") != 0)) {
                 params = ParseMonoOption(argv_[i]);
                 ++i;
             } else {
@@ -126,6 +353,110 @@ void Parser::Parse() {
             continue;
         }
 
+        if (strncmp(argv_[i], "--threads=", strlen("--threads=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+
+            options_.threads = ParseUnsigned(params[1], argv_[i]);
+            ++i;
+
+            continue;
+        }
+
+        if (strncmp(argv_[i], "--io=", strlen("--io=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+
+            if (params[1] == "auto") {
+                options_.io_backend = IoBackend::kAuto;
+            } else if (params[1] == "mmap") {
+                options_.io_backend = IoBackend::kMmap;
+            } else if (params[1] == "stream") {
+                options_.io_backend = IoBackend::kStream;
+            } else if (params[1] == "async") {
+                options_.io_backend = IoBackend::kAsync;
+            } else {
+                PrintUnknownArgumentInformation(argv_[i]);
+
+                exit(1);
+            }
+
+            ++i;
+
+            continue;
+        }
+
+        if (strncmp(argv_[i], "--stdin-name=", strlen("--stdin-name=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+
+            options_.stdin_name = params[1];
+            ++i;
+
+            continue;
+        }
+
+        if (strncmp(argv_[i], "--range=", strlen("--range=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+            size_t separator = params[1].find(':');
+
+            if (separator == std::string::npos) {
+                PrintUnknownArgumentInformation(argv_[i]);
+
+                exit(1);
+            }
+
+            options_.range = ByteRange{ParseUnsigned(params[1].substr(0, separator), argv_[i]),
+                                       ParseUnsigned(params[1].substr(separator + 1), argv_[i])};
+            ++i;
+
+            continue;
+        }
+
+        if (strncmp(argv_[i], "--compact-threshold=", strlen("--compact-threshold=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+
+            options_.compact_threshold = ParseShare(params[1], argv_[i]);
+            ++i;
+
+            continue;
+        }
+
+        if (strncmp(argv_[i], "--stats=", strlen("--stats=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+
+            if (params[1] != "json") {
+                PrintUnknownArgumentInformation(argv_[i]);
+
+                exit(1);
+            }
+
+            stats_format_ = StatsFormat::kJson;
+            ++i;
+
+            continue;
+        }
+
+        if (strncmp(argv_[i], "--code=", strlen("--code=")) == 0) {
+            std::vector<std::string> params = ParseMonoOption(argv_[i]);
+            const CodeParameters* code = nullptr;
+            uint32_t rate = 0;
+
+            for (; (code = FindCodeParameters(rate)) != nullptr; ++rate) {
+                if (params[1] == code->name) {
+                    break;
+                }
+            }
+
+            if (code == nullptr) {
+                PrintUnknownArgumentInformation(argv_[i]);
+
+                exit(1);
+            }
+
+            options_.code_rate = static_cast<CodeRate>(rate);
+            ++i;
+
+            continue;
+        }
+
         if (strcmp(argv_[i], "-c") == 0 || strcmp(argv_[i], "--create") == 0) {
             arguments_mask_ |= kCreateCommandMask;
         } else if (strcmp(argv_[i], "-l") == 0 || strcmp(argv_[i], "--list") == 0) {
@@ -134,12 +465,36 @@ void Parser::Parse() {
             arguments_mask_ |= kExtractCommandMask;
         } else if (strcmp(argv_[i], "-a") == 0 || strcmp(argv_[i], "--append") == 0) {
             arguments_mask_ |= kAppendCommandMask;
+        } else if (strcmp(argv_[i], "-u") == 0 || strcmp(argv_[i], "--update") == 0) {
+            arguments_mask_ |= kUpdateCommandMask;
         } else if (strcmp(argv_[i], "-d") == 0 || strcmp(argv_[i], "--delete") == 0) {
             arguments_mask_ |= kDeleteCommandMask;
         } else if (strcmp(argv_[i], "-A") == 0 || strcmp(argv_[i], "--concatenate") == 0) {
             arguments_mask_ |= kMergeCommandMask;
+        } else if (strcmp(argv_[i], "--compact") == 0) {
+            arguments_mask_ |= kCompactCommandMask;
+        } else if (strcmp(argv_[i], "--scrub") == 0) {
+            arguments_mask_ |= kScrubCommandMask;
+        } else if (strcmp(argv_[i], "--repair") == 0) {
+            options_.repair = true;
         } else if (strcmp(argv_[i], "--no-restore") == 0) {
-            restore_ = false;
+            options_.restore = false;
+        } else if (strcmp(argv_[i], "--to-stdout") == 0) {
+            options_.to_stdout = true;
+        } else if (strcmp(argv_[i], "--direct") == 0) {
+            options_.direct = true;
+        } else if (strcmp(argv_[i], "--checksums") == 0) {
+            options_.checksums = true;
+        } else if (strcmp(argv_[i], "--compress") == 0) {
+            options_.compress = true;
+        } else if (strcmp(argv_[i], "--dedup") == 0) {
+            options_.dedup = true;
+        } else if (strcmp(argv_[i], "--sparse") == 0) {
+            options_.sparse = true;
+        } else if (strcmp(argv_[i], "--hash") == 0) {
+            options_.content_hash = true;
+        } else if (strcmp(argv_[i], "--stats") == 0) {
+            stats_format_ = StatsFormat::kText;
         } else {
             PrintUnknownArgumentInformation(argv_[i]);
             
@@ -155,6 +510,20 @@ void Parser::Parse() {
 
         exit(1);
     }
+
+    options_.on_existing = AskAboutExisting;
+    options_.on_damage = AskAboutDamage;
+    options_.on_warning = PrintWarning;
+
+    // stdout carries the data there, so damage is only reported, and fails
+    // the command once the data is written.
+    if (options_.to_stdout || options_.range.has_value()) {
+        options_.on_damage = [this](const std::string& name) {
+            damage_reported_ = true;
+
+            return ReportDamage(name);
+        };
+    }
 }
 
 void Parser::Run() {
@@ -164,37 +533,87 @@ void Parser::Run() {
         exit(1);
     }
 
-    Archiver driver(archive_path_, restore_);
+    auto start = std::chrono::steady_clock::now();
+    bool succeeded = true;
+
+    std::vector<std::filesystem::path> paths(ordered_files_.begin(), ordered_files_.end());
+
+    // Errors of the library come as ArchiveError, anything else escaped it.
+    try {
+        succeeded = RunCommand(paths);
+    } catch (const ArchiveError& error) {
+        std::cerr << error.what() << std::endl;
+
+        exit(1);
+    } catch (const std::filesystem::filesystem_error& error) {
+        std::cerr << "Cannot access " << error.path1() << ": " << error.code().message() << "." << std::endl;
+
+        exit(1);
+    } catch (const std::exception& error) {
+        std::cerr << "Unexpected error: " << error.what() << std::endl;
+
+        exit(1);
+    }
+
+    // stdout may carry an archive or extracted data.
+    if (stats_format_ != StatsFormat::kNone) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        PrintStats(std::cerr, CollectStats(), elapsed.count(), stats_format_ == StatsFormat::kJson);
+    }
+
+    if (!succeeded) {
+        exit(1);
+    }
+}
+
+bool Parser::RunCommand(const std::vector<std::filesystem::path>& paths) {
+    Archiver driver(archive_path_, options_);
 
     if (arguments_mask_ == kCreateCommandMask) {
-        driver.Create();
+        driver.Create(paths);
     } else if (arguments_mask_ == kListCommandMask) {
-        driver.ShowData();
+        PrintListing(driver.Path(), driver.List());
     } else if (arguments_mask_ == kExtractCommandMask) {
         driver.Extract(files_);
+
+        return !damage_reported_;
     } else if (arguments_mask_ == kAppendCommandMask) {
-        if (files_.size() > 1) {
-            std::cerr << "Only one file can be appended!" << std::endl;
+        if (paths.empty()) {
+            std::cerr << "No files provided. See --help for more information." << std::endl;
 
             exit(1);
         }
 
-        driver.Append(*files_.begin());
+        driver.Append(paths);
+    } else if (arguments_mask_ == kUpdateCommandMask) {
+        if (paths.empty()) {
+            std::cerr << "No files provided. See --help for more information." << std::endl;
+
+            exit(1);
+        }
+
+        driver.Update(paths);
     } else if (arguments_mask_ == kDeleteCommandMask) {
         driver.Delete(files_);
     } else if (arguments_mask_ == kMergeCommandMask) {
-        if (files_.size() > 2) {
-            std::cerr << "More than two archives provided!" << std::endl;
+        driver.Merge(paths);
+    } else if (arguments_mask_ == kCompactCommandMask) {
+        if (!driver.Compact()) {
+            ArchiveListing listing = driver.List();
 
-            exit(1);
+            std::cout << "Deleted members take " << BeautifySize(listing.dead_bytes) << " of ";
+            std::cout << BeautifySize(listing.data_end) << ", nothing to compact." << std::endl;
         }
+    } else if (arguments_mask_ == kScrubCommandMask) {
+        ScrubReport report = driver.Scrub();
 
-        std::filesystem::path archive1 = *files_.begin();
-        files_.erase(files_.begin());
-        std::filesystem::path archive2 = *files_.begin();
+        PrintScrubReport(driver.Path(), report);
 
-        driver.Merge(archive1, archive2);
+        return report.uncorrectable == 0;
     } else {
         throw std::runtime_error("An error occured while running parser!");
     }
+
+    return true;
 }
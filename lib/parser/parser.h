@@ -1,9 +1,18 @@
 #pragma once
 
+#include "../archiver/archiver.h"
+
 #include <cinttypes>
 #include <filesystem>
 #include <unordered_set>
 #include <string>
+#include <vector>
+
+enum class StatsFormat {
+    kNone,
+    kText,
+    kJson,
+};
 
 class Parser {
 public:
@@ -14,8 +23,16 @@ public:
 private:
     int argc_;
     char** argv_;
-    uint8_t arguments_mask_;
-    bool restore_;
+    uint16_t arguments_mask_;
+    ArchiverOptions options_;
+    StatsFormat stats_format_;
     std::unordered_set<std::string> files_;
+    // Free arguments in command line order.
+    std::vector<std::string> ordered_files_;
     std::filesystem::path archive_path_;
+    // Damage reported while extracting to stdout, the data went on anyway.
+    bool damage_reported_;
+
+    // Returns false if the command found a problem it did not fail on.
+    bool RunCommand(const std::vector<std::filesystem::path>& paths);
 };
@@ -0,0 +1,471 @@
+#include "lib/archiver/archiver.h"
+#include "lib/archiver/writer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Functional tests of the library, one group per run: hamarc_tests GROUP
+// WORK_DIR. Every test works in a directory of its own under WORK_DIR and
+// stops at the first check that does not hold.
+//
+//     roundtrip - every format and I/O backend, append, delete, compact and update
+//     damage    - corrected bit flips, damage the policy takes or declines
+//     scrub     - clean, corrected, repaired and truncated archives
+//     api       - HafWriter into a stream, HafReader from a stream and a buffer
+
+const uint64_t kMegabyte = 1 << 20;
+const char* kUsage = "hamarc_tests roundtrip|damage|scrub|api WORK_DIR\n";
+
+class TestFailure : public std::runtime_error {
+public:
+    explicit TestFailure(const std::string& message) : std::runtime_error(message) {}
+};
+
+struct TestFile {
+    std::string name;
+    std::string data;
+};
+
+void Check(bool condition, const std::string& what);
+// Random bytes, or text that compresses, the same for the same seed.
+std::string MakeData(uint64_t length, uint32_t seed, bool compressible = false);
+void WriteFile(const std::filesystem::path& path, const std::string& data);
+std::string ReadFile(const std::filesystem::path& path);
+// Makes `dir` empty and the current directory.
+void EnterDir(const std::filesystem::path& dir);
+std::vector<TestFile> MakeFiles();
+void WriteFiles(const std::vector<TestFile>& files);
+// Extracts the archive into `dir` and compares every file with its source.
+void CheckExtracted(const std::filesystem::path& archive, const std::vector<TestFile>& files, const ArchiverOptions& options,
+                    const std::filesystem::path& dir);
+void FlipByte(const std::filesystem::path& path, uint64_t offset, uint8_t mask);
+const ArchiveMember& FindMember(Archiver& archiver, const std::string& name);
+
+void TestRoundTrip(const std::filesystem::path& work_dir);
+void TestDamage(const std::filesystem::path& work_dir);
+void TestScrub(const std::filesystem::path& work_dir);
+void TestApi(const std::filesystem::path& work_dir);
+
+void Check(bool condition, const std::string& what) {
+    if (!condition) {
+        throw TestFailure(what);
+    }
+}
+
+std::string MakeData(uint64_t length, uint32_t seed, bool compressible) {
+    std::mt19937 random(seed);
+    std::string data;
+
+    data.reserve(length);
+
+    while (data.size() < length) {
+        if (compressible) {
+            data += "line " + std::to_string(random() % 1000) + " of a text that compresses well\n";
+        } else {
+            data.push_back(static_cast<char>(random()));
+        }
+    }
+
+    data.resize(length);
+
+    return data;
+}
+
+void WriteFile(const std::filesystem::path& path, const std::string& data) {
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+
+    std::ofstream stream(path, std::ios::binary);
+
+    stream.write(data.data(), data.size());
+    Check(static_cast<bool>(stream), "cannot write " + path.string());
+}
+
+std::string ReadFile(const std::filesystem::path& path) {
+    std::ifstream stream(path, std::ios::binary);
+
+    Check(stream.is_open(), path.string() + " does not exist");
+
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+void EnterDir(const std::filesystem::path& dir) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::filesystem::current_path(dir);
+}
+
+std::vector<TestFile> MakeFiles() {
+    std::string sparse = MakeData(kMegabyte, 3);
+
+    // A run of zeros long enough for a hole of a sparse archive.
+    sparse += std::string(2 * kMegabyte, '\0');
+    sparse += MakeData(kMegabyte / 2, 4);
+
+    return {
+        {"random.bin", MakeData(3 * kMegabyte + 123, 1)},
+        {"text.txt", MakeData(2 * kMegabyte, 2, true)},
+        {"copy.bin", MakeData(3 * kMegabyte + 123, 1)}, // repeats random.bin for dedup
+        {"sparse.bin", sparse},
+        {"empty", ""},
+        {"tiny", "x"},
+    };
+}
+
+void WriteFiles(const std::vector<TestFile>& files) {
+    for (const TestFile& file: files) {
+        WriteFile(file.name, file.data);
+    }
+}
+
+void CheckExtracted(const std::filesystem::path& archive, const std::vector<TestFile>& files, const ArchiverOptions& options,
+                    const std::filesystem::path& dir) {
+    std::filesystem::path previous = std::filesystem::current_path();
+
+    EnterDir(dir);
+    Archiver(archive, options).Extract();
+
+    for (const TestFile& file: files) {
+        Check(ReadFile(file.name) == file.data, file.name + " extracted from " + archive.string() + " differs");
+    }
+
+    std::filesystem::current_path(previous);
+}
+
+void FlipByte(const std::filesystem::path& path, uint64_t offset, uint8_t mask) {
+    std::fstream stream(path, std::ios::binary | std::ios::in | std::ios::out);
+    char byte;
+
+    stream.seekg(offset);
+    stream.get(byte);
+    stream.seekp(offset);
+    stream.put(static_cast<char>(byte ^ mask));
+    Check(static_cast<bool>(stream), "cannot damage " + path.string());
+}
+
+const ArchiveMember& FindMember(Archiver& archiver, const std::string& name) {
+    static std::vector<ArchiveMember> members;
+
+    members = archiver.OpenReader().Directory().Members();
+
+    auto it = std::find_if(members.begin(), members.end(), [&](const ArchiveMember& member) {
+        return !member.deleted && member.header.file_name == name;
+    });
+
+    Check(it != members.end(), name + " is not in the archive");
+
+    return *it;
+}
+
+void TestRoundTrip(const std::filesystem::path& work_dir) {
+    std::vector<TestFile> files = MakeFiles();
+    std::vector<std::pair<std::string, ArchiverOptions>> configs;
+
+    EnterDir(work_dir / "files");
+    WriteFiles(files);
+    configs.push_back({"plain", {}});
+
+    for (IoBackend backend: {IoBackend::kStream, IoBackend::kMmap, IoBackend::kAsync}) {
+        ArchiverOptions options;
+
+        options.io_backend = backend;
+        options.threads = 4;
+        configs.push_back({"backend" + std::to_string(static_cast<int>(backend)), options});
+    }
+
+    for (CodeRate code_rate: {CodeRate::kSecded39_32, CodeRate::kSecded72_64}) {
+        ArchiverOptions options;
+
+        options.code_rate = code_rate;
+        options.checksums = true;
+        configs.push_back({"code" + std::to_string(static_cast<int>(code_rate)), options});
+    }
+
+    configs.push_back({"compress", {}});
+    configs.back().second.compress = true;
+    configs.push_back({"dedup", {}});
+    configs.back().second.dedup = true;
+    configs.push_back({"sparse", {}});
+    configs.back().second.sparse = true;
+    configs.back().second.threads = 0;
+
+    for (const auto& [name, options]: configs) {
+        std::filesystem::path archive = work_dir / (name + ".haf");
+        std::vector<std::filesystem::path> paths;
+
+        for (const TestFile& file: files) {
+            paths.push_back(file.name);
+        }
+
+        Archiver(archive, options).Create(paths);
+        Check(Archiver(archive, options).List().members.size() == files.size(), name + ": listing misses members");
+        CheckExtracted(archive, files, options, work_dir / ("out-" + name));
+    }
+
+    // Members are replaced, deleted and compacted away; the rest stays intact.
+    std::filesystem::path archive = work_dir / "edited.haf";
+    std::vector<TestFile> edited = {files[0], files[1]};
+
+    Archiver(archive).Create({files[0].name, files[1].name, files[3].name});
+    edited[1].data = MakeData(kMegabyte, 5, true);
+    WriteFile(edited[1].name, edited[1].data);
+    Archiver(archive).Append({edited[1].name});
+    Archiver(archive).Delete({files[3].name});
+
+    ArchiverOptions compacting;
+
+    compacting.compact_threshold = 0;
+    Check(Archiver(archive, compacting).Compact(), "compact left deleted members");
+    Check(Archiver(archive).List().dead_bytes == 0, "compacted archive keeps deleted bytes");
+    Check(Archiver(archive).List().members.size() == edited.size(), "edited archive has the wrong members");
+    CheckExtracted(archive, edited, {}, work_dir / "out-edited");
+
+    // Update adds nothing for unchanged files and replaces changed ones.
+    std::filesystem::path updated = work_dir / "updated.haf";
+
+    Archiver(updated).Update({edited[0].name, edited[1].name});
+
+    uint64_t size = std::filesystem::file_size(updated);
+
+    Archiver(updated).Update({edited[0].name, edited[1].name});
+    Check(std::filesystem::file_size(updated) == size, "update of unchanged files grew the archive");
+
+    edited[0].data = MakeData(kMegabyte, 6);
+    WriteFile(edited[0].name, edited[0].data);
+    Archiver(updated).Update({edited[0].name, edited[1].name});
+    CheckExtracted(updated, edited, {}, work_dir / "out-updated");
+}
+
+void TestDamage(const std::filesystem::path& work_dir) {
+    std::vector<TestFile> files = {{"first.bin", MakeData(2 * kMegabyte, 7)}, {"second.txt", MakeData(kMegabyte, 8, true)}};
+    std::filesystem::path archive = work_dir / "damaged.haf";
+    std::vector<std::string> reported;
+    ArchiverOptions accepting;
+    ArchiverOptions declining;
+
+    accepting.on_damage = [&](const std::string& name) {
+        reported.push_back(name);
+
+        return true;
+    };
+    declining.on_damage = [&](const std::string& name) {
+        reported.push_back(name);
+
+        return false;
+    };
+
+    EnterDir(work_dir / "files");
+    WriteFiles(files);
+    Archiver(archive).Create({files[0].name, files[1].name});
+
+    // One flipped bit per codeword is corrected, nothing is reported.
+    Archiver source(archive);
+    const ArchiveMember& first = FindMember(source, files[0].name);
+
+    for (uint64_t offset = first.data_offset; offset < first.data_offset + kMegabyte; offset += 4099) {
+        FlipByte(archive, offset, 0x10);
+    }
+
+    CheckExtracted(archive, files, accepting, work_dir / "out-flipped");
+    Check(reported.empty(), "corrected bit flips were reported as damage");
+
+    // Two flipped bits in a codeword are detected and reported under the member name.
+    for (uint64_t offset = first.data_offset + kMegabyte; offset < first.data_offset + kMegabyte + 4096; offset += 256) {
+        FlipByte(archive, offset, 0x03);
+    }
+
+    EnterDir(work_dir / "out-accepted");
+    Archiver(archive, accepting).Extract();
+    Check(!reported.empty() && reported[0] == files[0].name, "damage of " + files[0].name + " was not reported");
+    Check(ReadFile(files[1].name) == files[1].data, "undamaged " + files[1].name + " differs");
+
+    // Declined damage fails the run and leaves the files there as they were.
+    bool failed = false;
+
+    EnterDir(work_dir / "out-declined");
+    WriteFile(files[1].name, "old");
+
+    try {
+        Archiver(archive, declining).Extract();
+    } catch (const ArchiveError&) {
+        failed = true;
+    }
+
+    Check(failed, "declined damage did not fail the extraction");
+    Check(ReadFile(files[1].name) == "old", "a failed extraction replaced " + files[1].name);
+    Check(!std::filesystem::exists(files[0].name), "a failed extraction left " + files[0].name);
+    Check(std::distance(std::filesystem::directory_iterator("."), std::filesystem::directory_iterator()) == 1,
+          "a failed extraction left partial files");
+}
+
+void TestScrub(const std::filesystem::path& work_dir) {
+    std::vector<TestFile> files = {{"data.bin", MakeData(2 * kMegabyte, 9)}, {"text.txt", MakeData(kMegabyte, 10, true)}};
+    std::filesystem::path archive = work_dir / "scrubbed.haf";
+    ArchiverOptions repairing;
+
+    repairing.repair = true;
+    repairing.threads = 0;
+
+    EnterDir(work_dir / "files");
+    WriteFiles(files);
+    Archiver(archive).Create({files[0].name, files[1].name});
+
+    ScrubReport clean = Archiver(archive).Scrub();
+
+    Check(clean.corrected == 0 && clean.uncorrectable == 0 && clean.damage.empty(), "a clean archive has damage");
+    Check(clean.archive_size == std::filesystem::file_size(archive), "scrub did not cover the archive");
+
+    Archiver source(archive);
+    const ArchiveMember& data = FindMember(source, files[0].name);
+
+    FlipByte(archive, data.data_offset + 1000, 0x01);
+    FlipByte(archive, data.header_offset, 0x02);
+
+    ScrubReport flipped = Archiver(archive, repairing).Scrub();
+
+    Check(flipped.corrected == 2 && flipped.uncorrectable == 0 && flipped.repaired, "flipped bits were not corrected");
+    Check(flipped.damage.size() == 2 && flipped.damage[0].region == "header of " + files[0].name
+          && flipped.damage[1].region == files[0].name, "flipped bits were found in the wrong regions");
+    Check(Archiver(archive).Scrub().corrected == 0, "repaired codewords were not written back");
+
+    // A cut through the first member loses the rest of it and the directory.
+    std::filesystem::path truncated = work_dir / "truncated.haf";
+    uint64_t cut = data.data_offset + (std::filesystem::file_size(archive) - data.data_offset) / 4;
+
+    std::filesystem::copy_file(archive, truncated);
+    std::filesystem::resize_file(truncated, cut);
+
+    ScrubReport report = Archiver(truncated).Scrub();
+    uint64_t missing = 0;
+
+    for (const ScrubDamage& damage: report.damage) {
+        missing += damage.missing ? damage.codewords : 0;
+    }
+
+    Check(missing == report.uncorrectable, "missing codewords are not all uncorrectable");
+    Check(report.uncorrectable * 2 >= (data.data_offset + files[0].data.size() * 2 - cut) / 2,
+          "a truncated archive understates its damage");
+    Check(std::any_of(report.damage.begin(), report.damage.end(), [](const ScrubDamage& damage) {
+              return damage.region == "directory" && damage.missing;
+          }), "the lost directory is not reported");
+}
+
+void TestApi(const std::filesystem::path& work_dir) {
+    std::string buffered = MakeData(kMegabyte + 17, 11, true);
+    std::string streamed = MakeData(3 * kMegabyte + 5, 12);
+    std::stringstream archive;
+
+    EnterDir(work_dir);
+
+    for (bool compress: {false, true}) {
+        ArchiverOptions options;
+        std::stringstream data(streamed);
+
+        options.compress = compress;
+        archive.str("");
+        archive.clear();
+
+        HafWriter writer(archive, options);
+
+        writer.Add("buffered.txt", buffered.data(), buffered.size());
+        writer.Add("streamed.bin", data);
+        writer.Add("tiny", "x", 1);
+        writer.Finish();
+
+        std::string bytes = archive.str();
+        HafReader from_stream(archive);
+        HafReader from_buffer(bytes.data(), bytes.size());
+        std::ostringstream extracted;
+        std::string piece(4096, '\0');
+
+        Check(from_stream.Directory().Members().size() == 3, "HafReader does not see every member");
+        from_buffer.Extract("streamed.bin", extracted);
+        Check(extracted.str() == streamed, "a streamed member differs");
+
+        for (uint64_t offset: {uint64_t(0), uint64_t(12345), kMegabyte - 100, uint64_t(buffered.size() - 10)}) {
+            size_t length = from_stream.ReadAt("buffered.txt", offset, piece.data(), piece.size());
+
+            Check(length == std::min<uint64_t>(piece.size(), buffered.size() - offset), "ReadAt read the wrong length");
+            Check(piece.compare(0, length, buffered, offset, length) == 0, "ReadAt read the wrong bytes");
+        }
+
+        // Without the trailer the members are found by their headers,
+        // including the one whose sizes only its frames tell.
+        std::filesystem::path path = work_dir / (compress ? "compressed.haf" : "written.haf");
+
+        WriteFile(path, bytes);
+        std::filesystem::resize_file(path, bytes.size() - kTrailerSize);
+
+        ArchiveListing listing = Archiver(path).List();
+
+        Check(listing.members.size() == 3 && listing.members[1].file_size == streamed.size(),
+              "members of an archive without its trailer are lost");
+
+        std::ostringstream recovered;
+
+        Archiver(path).Extract({"streamed.bin"}, recovered);
+        Check(recovered.str() == streamed, "a streamed member of an archive without its trailer differs");
+    }
+
+    bool failed = false;
+
+    try {
+        std::ostringstream output;
+
+        Archiver(work_dir / "written.haf").Extract({"missing"}, output);
+    } catch (const ArchiveError&) {
+        failed = true;
+    }
+
+    Check(failed, "extracting a missing member did not fail");
+}
+
+int main(int argc, char** argv) {
+    const std::vector<std::pair<std::string, std::function<void(const std::filesystem::path&)>>> groups = {
+        {"roundtrip", TestRoundTrip},
+        {"damage", TestDamage},
+        {"scrub", TestScrub},
+        {"api", TestApi},
+    };
+
+    if (argc != 3) {
+        std::cerr << kUsage;
+
+        return 2;
+    }
+
+    auto group = std::find_if(groups.begin(), groups.end(), [&](const auto& entry) {
+        return entry.first == argv[1];
+    });
+
+    if (group == groups.end()) {
+        std::cerr << kUsage;
+
+        return 2;
+    }
+
+    std::filesystem::path work_dir = std::filesystem::absolute(argv[2]) / argv[1];
+
+    try {
+        group->second(work_dir);
+    } catch (const std::exception& error) {
+        std::cerr << argv[1] << ": " << error.what() << std::endl;
+
+        return 1;
+    }
+
+    std::filesystem::current_path(work_dir.parent_path());
+    std::filesystem::remove_all(work_dir);
+
+    return 0;
+}